@@ -0,0 +1,291 @@
+#include "attribute_store.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include "logging.h"
+#include "znp/encoding.h"
+
+namespace {
+// Magic & format version at the start of both snapshot and journal.
+const std::vector<uint8_t> kFileHeader{'A', 'Q', 'A', 'S', 1};
+// Packed key, wall clock time in ms, link quality, value length.
+const std::size_t kRecordHeaderSize = 8 + 8 + 8 + 1 + 2;
+// Below this, the journal is never folded into the snapshot.
+const std::size_t kMinJournalSize = 16 * 1024;
+
+// Only returns once the data is on disk, so a rename after it can't end up
+// pointing at an empty file after a power loss.
+bool WriteFileSynced(const std::string& filename,
+                     const std::vector<uint8_t>& data) {
+  int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+  std::size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      break;
+    }
+    written += result;
+  }
+  bool synced = written == data.size() && ::fsync(fd) == 0;
+  return ::close(fd) == 0 && synced;
+}
+
+// Makes a rename into the directory of filename durable.
+void SyncDirectoryOf(const std::string& filename) {
+  std::size_t slash = filename.rfind('/');
+  std::string directory =
+      slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+  int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+bool ReadFile(const std::string& filename, std::vector<uint8_t>& data) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  data.assign(std::istreambuf_iterator<char>(file),
+              std::istreambuf_iterator<char>());
+  return true;
+}
+}  // namespace
+
+AttributeStore::AttributeStore(std::string filename)
+    : filename_(std::move(filename)), snapshot_size_(0), journal_size_(0) {
+  if (!filename_.empty()) {
+    Load();
+  }
+}
+
+void AttributeStore::Update(const Key& key, std::string value,
+                            uint8_t link_quality, Clock::time_point now) {
+  PackedKey packed = Pack(key);
+  if (!filename_.empty()) {
+    dirty_.push_back(packed);
+  }
+  auto found = std::lower_bound(keys_.begin(), keys_.end(), packed);
+  std::size_t index = found - keys_.begin();
+  if (found == keys_.end() || *found != packed) {
+    // New attributes are rare compared to updates, so the insertion cost is
+    // worth the compact layout.
+    keys_.insert(found, packed);
+    entries_.insert(entries_.begin() + index,
+                    Entry{std::move(value), now, link_quality});
+    return;
+  }
+  Entry& entry = entries_[index];
+  entry.value = std::move(value);
+  entry.updated = now;
+  entry.link_quality = link_quality;
+}
+
+boost::optional<const AttributeStore::Entry&> AttributeStore::Get(
+    const Key& key, Clock::duration max_age, Clock::time_point now) const {
+  PackedKey packed = Pack(key);
+  auto found = std::lower_bound(keys_.begin(), keys_.end(), packed);
+  if (found == keys_.end() || *found != packed) {
+    return boost::none;
+  }
+  const Entry& entry = entries_[found - keys_.begin()];
+  if (now - entry.updated > max_age) {
+    return boost::none;
+  }
+  return entry;
+}
+
+std::size_t AttributeStore::Size() const { return keys_.size(); }
+
+void AttributeStore::ForEach(
+    std::function<void(const Key&, const Entry&)> callback) const {
+  for (std::size_t index = 0; index < keys_.size(); index++) {
+    callback(Unpack(keys_[index]), entries_[index]);
+  }
+}
+
+void AttributeStore::Save() {
+  if (filename_.empty() || dirty_.empty()) {
+    return;
+  }
+  std::sort(dirty_.begin(), dirty_.end());
+  dirty_.erase(std::unique(dirty_.begin(), dirty_.end()), dirty_.end());
+  auto now = Clock::now();
+  auto wall_now = std::chrono::system_clock::now();
+  std::vector<uint8_t> records;
+  if (journal_size_ == 0) {
+    records = kFileHeader;
+  }
+  for (const auto& packed : dirty_) {
+    auto found = std::lower_bound(keys_.begin(), keys_.end(), packed);
+    AppendRecord(records, found - keys_.begin(), now, wall_now);
+  }
+  // What couldn't be written stays dirty, to be tried again next time.
+  if (journal_size_ + records.size() >
+      std::max(snapshot_size_, kMinJournalSize)) {
+    if (WriteSnapshot()) {
+      dirty_.clear();
+    }
+    return;
+  }
+  std::string journal_filename = filename_ + ".journal";
+  // Cuts off what an earlier failed write may have left, as records appended
+  // behind a partial one would be unreadable.
+  if (journal_size_ > 0 &&
+      ::truncate(journal_filename.c_str(), journal_size_) != 0) {
+    if (WriteSnapshot()) {
+      dirty_.clear();
+    }
+    return;
+  }
+  {
+    auto mode = (journal_size_ == 0) ? std::ios::trunc : std::ios::app;
+    std::ofstream file(journal_filename, std::ios::binary | mode);
+    file.write((const char*)records.data(), records.size());
+    file.flush();
+    if (file) {
+      journal_size_ += records.size();
+      dirty_.clear();
+      return;
+    }
+  }
+  LOG("AttributeStore", warning) << "Unable to write " << journal_filename;
+  if (WriteSnapshot()) {
+    dirty_.clear();
+  }
+}
+
+AttributeStore::PackedKey AttributeStore::Pack(const Key& key) {
+  return PackedKey(key.address, (((uint64_t)key.endpoint) << 32) |
+                                    (((uint64_t)key.cluster_id) << 16) |
+                                    ((uint64_t)key.attribute_id));
+}
+
+AttributeStore::Key AttributeStore::Unpack(const PackedKey& packed) {
+  return Key{packed.first, (uint8_t)(packed.second >> 32),
+             (zcl::ZclClusterId)((packed.second >> 16) & 0xFFFF),
+             (zcl::ZclAttributeId)(packed.second & 0xFFFF)};
+}
+
+void AttributeStore::Load() {
+  std::vector<uint8_t> data;
+  if (ReadFile(filename_, data)) {
+    snapshot_size_ = LoadRecords(data, false);
+  }
+  std::string journal_filename = filename_ + ".journal";
+  if (ReadFile(journal_filename, data)) {
+    journal_size_ = LoadRecords(data, true);
+    if (journal_size_ != data.size()) {
+      // Appending behind a partially written record would make everything
+      // after it unreadable, so start over from a fresh snapshot.
+      LOG("AttributeStore", warning)
+          << journal_filename << " is damaged, writing new snapshot";
+      WriteSnapshot();
+    }
+  }
+  dirty_.clear();
+  LOG("AttributeStore", info)
+      << "Loaded " << keys_.size() << " attribute values from " << filename_;
+}
+
+std::size_t AttributeStore::LoadRecords(const std::vector<uint8_t>& data,
+                                        bool is_journal) {
+  if (data.size() < kFileHeader.size() ||
+      !std::equal(kFileHeader.begin(), kFileHeader.end(), data.begin())) {
+    return 0;
+  }
+  auto now = Clock::now();
+  auto wall_now = std::chrono::system_clock::now();
+  std::size_t offset = kFileHeader.size();
+  while (offset + kRecordHeaderSize <= data.size()) {
+    auto record = znp::DecodePartialT<uint64_t, uint64_t, uint64_t, uint8_t,
+                                      uint16_t>(
+        znp::ByteSpan(data.data() + offset, data.size() - offset));
+    std::size_t value_size = std::get<4>(record);
+    if (offset + kRecordHeaderSize + value_size > data.size()) {
+      break;
+    }
+    auto value_begin = data.begin() + offset + kRecordHeaderSize;
+    std::string value(value_begin, value_begin + value_size);
+    offset += kRecordHeaderSize + value_size;
+
+    // Timestamps are stored as wall clock time, as the steady clock starts
+    // over on every boot.
+    std::chrono::system_clock::time_point wall_updated(
+        std::chrono::milliseconds(std::get<2>(record)));
+    Clock::time_point updated =
+        now + std::chrono::duration_cast<Clock::duration>(wall_updated -
+                                                          wall_now);
+    updated = std::min(updated, now);
+    Key key = Unpack(PackedKey(std::get<0>(record), std::get<1>(record)));
+    if (is_journal) {
+      // If writing a snapshot was interrupted, the old journal may still hold
+      // values older than those in the snapshot.
+      auto existing = Get(key, Clock::duration::max(), now);
+      if (existing && existing->updated > updated) {
+        continue;
+      }
+    }
+    Update(key, std::move(value), std::get<3>(record), updated);
+  }
+  return offset;
+}
+
+void AttributeStore::AppendRecord(
+    std::vector<uint8_t>& target, std::size_t index, Clock::time_point now,
+    std::chrono::system_clock::time_point wall_now) const {
+  const Entry& entry = entries_[index];
+  if (entry.value.size() > 0xFFFF) {
+    return;
+  }
+  auto wall_updated =
+      wall_now + std::chrono::duration_cast<
+                     std::chrono::system_clock::duration>(entry.updated - now);
+  auto record = znp::EncodeT<uint64_t, uint64_t, uint64_t, uint8_t, uint16_t>(
+      keys_[index].first, keys_[index].second,
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          wall_updated.time_since_epoch())
+          .count(),
+      entry.link_quality, (uint16_t)entry.value.size());
+  target.insert(target.end(), record.begin(), record.end());
+  target.insert(target.end(), entry.value.begin(), entry.value.end());
+}
+
+bool AttributeStore::WriteSnapshot() {
+  auto now = Clock::now();
+  auto wall_now = std::chrono::system_clock::now();
+  std::vector<uint8_t> data(kFileHeader);
+  for (std::size_t index = 0; index < keys_.size(); index++) {
+    AppendRecord(data, index, now, wall_now);
+  }
+  // Write to a temporary file first and move it in place, so a crash halfway
+  // through never leaves a truncated snapshot behind.
+  std::string temp_filename = filename_ + ".tmp";
+  if (!WriteFileSynced(temp_filename, data)) {
+    LOG("AttributeStore", warning) << "Unable to write " << temp_filename;
+    return false;
+  }
+  if (std::rename(temp_filename.c_str(), filename_.c_str()) != 0) {
+    LOG("AttributeStore", warning)
+        << "Unable to move " << temp_filename << " to " << filename_;
+    return false;
+  }
+  // The journal may only go once the new snapshot is sure to be there.
+  SyncDirectoryOf(filename_);
+  std::remove((filename_ + ".journal").c_str());
+  snapshot_size_ = data.size();
+  journal_size_ = 0;
+  return true;
+}
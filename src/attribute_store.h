@@ -0,0 +1,76 @@
+#ifndef _ATTRIBUTE_STORE_H_
+#define _ATTRIBUTE_STORE_H_
+#include <boost/optional.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "zcl/zcl.h"
+#include "znp/znp.h"
+
+/**
+ * Last known value of every attribute reported by, or read from, a device.
+ *
+ * Keys are packed into two integers and kept sorted in one contiguous array,
+ * separate from the values, so lookups stay a cheap binary search even with
+ * thousands of attributes. Values are stored as JSON text, ready to publish.
+ *
+ * If a filename is given, the store is loaded from it on creation. Save()
+ * appends the attributes changed since the last call to a journal next to the
+ * snapshot, and only rewrites the full snapshot once the journal has grown
+ * larger than it, keeping the number of bytes written low.
+ */
+class AttributeStore {
+ public:
+  typedef std::chrono::steady_clock Clock;
+  struct Key {
+    znp::IEEEAddress address;
+    uint8_t endpoint;
+    zcl::ZclClusterId cluster_id;
+    zcl::ZclAttributeId attribute_id;
+  };
+  struct Entry {
+    std::string value;
+    Clock::time_point updated;
+    uint8_t link_quality;
+  };
+
+  AttributeStore(std::string filename = "");
+
+  void Update(const Key& key, std::string value, uint8_t link_quality,
+              Clock::time_point now = Clock::now());
+  // Only returns the entry if it was updated no longer than max_age ago.
+  boost::optional<const Entry&> Get(
+      const Key& key, Clock::duration max_age = Clock::duration::max(),
+      Clock::time_point now = Clock::now()) const;
+  std::size_t Size() const;
+  void ForEach(std::function<void(const Key&, const Entry&)> callback) const;
+
+  void Save();
+
+ private:
+  typedef std::pair<uint64_t, uint64_t> PackedKey;
+  static PackedKey Pack(const Key& key);
+  static Key Unpack(const PackedKey& packed);
+
+  void Load();
+  // Returns the number of bytes that could be used.
+  std::size_t LoadRecords(const std::vector<uint8_t>& data, bool is_journal);
+  void AppendRecord(std::vector<uint8_t>& target, std::size_t index,
+                    Clock::time_point now,
+                    std::chrono::system_clock::time_point wall_now) const;
+  // Returns false if the snapshot couldn't be written, leaving the old one
+  // and the journal as they were.
+  bool WriteSnapshot();
+
+  std::string filename_;
+  std::vector<PackedKey> keys_;
+  std::vector<Entry> entries_;
+  // Keys updated since the last Save, may contain duplicates.
+  std::vector<PackedKey> dirty_;
+  std::size_t snapshot_size_;
+  std::size_t journal_size_;
+};
+#endif  // _ATTRIBUTE_STORE_H_
@@ -1,6 +1,7 @@
 #include "clusterdb/cluster_db.h"
 #include <boost/property_tree/info_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <atomic>
 #include <functional>
 #include "clusterdb/searchable_list.h"
 #include "string_enum.h"
@@ -13,6 +14,16 @@ struct ClusterDb::Context {
 };
 
 namespace {
+std::atomic<std::uint64_t> next_generation(1);
+
+// Compiles the arguments for fast decoding & encoding.
+void CompileCommandInfo(CommandInfo& command_info) {
+  command_info.decode_plan =
+      dynamic_encoding::CompileDecodePlan(command_info.data);
+  command_info.encode_index =
+      dynamic_encoding::CompileEncodeIndex(command_info.data);
+}
+
 bool ParseTypeFromPTree(dynamic_encoding::AnyType& type,
                         const std::string& type_name,
                         const boost::property_tree::ptree& tree,
@@ -133,6 +144,7 @@ bool ParseCommandListFromPTree(
                                   name_mangler)) {
       return false;
     }
+    CompileCommandInfo(command_info);
     if (!commands.Add(std::move(command_info))) {
       return false;
     }
@@ -260,9 +272,62 @@ bool ParseFromPTree(const std::unique_ptr<ClusterDb::Context>& ctx,
   }
   return true;
 }
+
+dynamic_encoding::AnyType TypeFromTables(
+    const tables::Tables& tables, std::size_t index,
+    std::function<std::string(std::string)> name_mangler) {
+  const tables::Type& type = tables.types[index];
+  switch (type.kind) {
+    case tables::Type::DataType:
+      return (zcl::DataType)type.datatype;
+    case tables::Type::Variant:
+      return dynamic_encoding::VariantType{};
+    case tables::Type::XiaomiFF01:
+      return dynamic_encoding::XiaomiFF01Type{};
+    case tables::Type::Object: {
+      dynamic_encoding::ObjectType object;
+      for (std::size_t i = type.first; i < type.first + type.count; i++) {
+        object.properties.push_back(
+            dynamic_encoding::ObjectEntry{name_mangler(tables.types[i].name),
+                                          TypeFromTables(tables, i,
+                                                         name_mangler)});
+      }
+      return object;
+    }
+    case tables::Type::Array:
+      return dynamic_encoding::ArrayType{
+          type.length_size, TypeFromTables(tables, type.first, name_mangler)};
+    case tables::Type::ErrorOr:
+      return dynamic_encoding::ErrorOrType{
+          TypeFromTables(tables, type.first, name_mangler)};
+  }
+  throw std::runtime_error("Unknown type kind in cluster tables");
+}
+
+bool CommandListFromTables(
+    SearchableList<CommandInfo>& commands, bool are_global_commands,
+    const tables::Tables& tables, std::size_t first, std::size_t count,
+    std::function<std::string(std::string)> name_mangler) {
+  for (std::size_t i = first; i < first + count; i++) {
+    const tables::Command& command = tables.commands[i];
+    CommandInfo command_info;
+    command_info.id = (zcl::ZclCommandId)command.id;
+    command_info.name = name_mangler(command.name);
+    command_info.is_global = are_global_commands;
+    command_info.data = boost::get<dynamic_encoding::ObjectType>(
+        TypeFromTables(tables, command.type, name_mangler));
+    CompileCommandInfo(command_info);
+    if (!commands.Add(std::move(command_info))) {
+      return false;
+    }
+  }
+  return true;
+}
 }  // namespace
 
-ClusterDb::ClusterDb() : ctx_(std::make_unique<ClusterDb::Context>()) {}
+ClusterDb::ClusterDb()
+    : ctx_(std::make_unique<ClusterDb::Context>()),
+      generation_(next_generation++) {}
 ClusterDb::~ClusterDb() {}
 
 boost::optional<const ClusterInfo&> ClusterDb::ClusterByName(
@@ -333,6 +398,56 @@ bool ClusterDb::ParseFromFile(
   return ParseFromPTree(this->ctx_, tree, name_mangler);
 }
 
+bool ClusterDb::LoadFromTables(
+    const tables::Tables& tables,
+    std::function<std::string(std::string)> name_mangler) {
+  if (!CommandListFromTables(ctx_->global_commands, true, tables, 0,
+                             tables.global_command_count, name_mangler)) {
+    return false;
+  }
+  for (std::size_t i = 0; i < tables.cluster_count; i++) {
+    const tables::Cluster& cluster = tables.clusters[i];
+    ClusterInfo cluster_info;
+    cluster_info.id = (zcl::ZclClusterId)cluster.id;
+    cluster_info.name = name_mangler(cluster.name);
+    for (std::size_t j = cluster.first_attribute;
+         j < cluster.first_attribute + cluster.attribute_count; j++) {
+      const tables::Attribute& attribute = tables.attributes[j];
+      AttributeInfo attribute_info;
+      attribute_info.id = (zcl::ZclAttributeId)attribute.id;
+      attribute_info.name = name_mangler(attribute.name);
+      if (attribute.has_datatype) {
+        attribute_info.datatype = (zcl::DataType)attribute.datatype;
+      }
+      if (!cluster_info.attributes.Add(std::move(attribute_info))) {
+        return false;
+      }
+    }
+    if (!CommandListFromTables(cluster_info.commands_serverToClient, false,
+                               tables, cluster.first_server_to_client,
+                               cluster.server_to_client_count,
+                               name_mangler) ||
+        !CommandListFromTables(cluster_info.commands_clientToServer, false,
+                               tables, cluster.first_client_to_server,
+                               cluster.client_to_server_count,
+                               name_mangler) ||
+        !ctx_->clusters.Add(std::move(cluster_info))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const SearchableList<ClusterInfo>& ClusterDb::Clusters() const {
+  return ctx_->clusters;
+}
+
+const SearchableList<CommandInfo>& ClusterDb::GlobalCommands() const {
+  return ctx_->global_commands;
+}
+
+std::uint64_t ClusterDb::Generation() const { return generation_; }
+
 bool ClusterDb::ParseFromStream(
     std::istream& stream,
     std::function<std::string(std::string)> name_mangler) {
@@ -1,7 +1,10 @@
 #ifndef _CLUSTERDB_CLUSTER_DB_H_
 #define _CLUSTERDB_CLUSTER_DB_H_
+#include <cstdint>
 #include "clusterdb/cluster_info.h"
 #include "clusterdb/command_info.h"
+#include "clusterdb/searchable_list.h"
+#include "clusterdb/tables.h"
 
 namespace clusterdb {
 class ClusterDb {
@@ -27,11 +30,21 @@ class ClusterDb {
                      std::function<std::string(std::string)> name_mangler);
   bool ParseFromStream(std::istream& stream,
                        std::function<std::string(std::string)> name_mangler);
+  bool LoadFromTables(const tables::Tables& tables,
+                      std::function<std::string(std::string)> name_mangler);
+
+  const SearchableList<ClusterInfo>& Clusters() const;
+  const SearchableList<CommandInfo>& GlobalCommands() const;
+
+  // Different for every instance, so caches of what was derived from a
+  // database can tell it apart from the one that replaced it.
+  std::uint64_t Generation() const;
 
   struct Context;
 
  private:
   std::unique_ptr<Context> ctx_;
+  const std::uint64_t generation_;
 };
 }  // namespace clusterdb
 #endif  // _CLUSTERDB_CLUSTER_DB_H_
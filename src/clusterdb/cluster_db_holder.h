@@ -0,0 +1,28 @@
+#ifndef _CLUSTERDB_CLUSTER_DB_HOLDER_H_
+#define _CLUSTERDB_CLUSTER_DB_HOLDER_H_
+#include <memory>
+#include "clusterdb/cluster_db.h"
+
+namespace clusterdb {
+/**
+ * The cluster database in use, which can be replaced as a whole at runtime.
+ *
+ * Handlers take the current database once per message, and keep that
+ * snapshot alive until they're done, so anything in flight during a swap
+ * finishes on the old definitions.
+ */
+class ClusterDbHolder {
+ public:
+  explicit ClusterDbHolder(std::shared_ptr<ClusterDb> db)
+      : db_(std::move(db)) {}
+
+  std::shared_ptr<ClusterDb> Get() const { return std::atomic_load(&db_); }
+  void Set(std::shared_ptr<ClusterDb> db) {
+    std::atomic_store(&db_, std::move(db));
+  }
+
+ private:
+  std::shared_ptr<ClusterDb> db_;
+};
+}  // namespace clusterdb
+#endif  // _CLUSTERDB_CLUSTER_DB_HOLDER_H_
@@ -0,0 +1,223 @@
+// Turns clusters.info into C++ tables (see clusterdb/tables.h), so the hub
+// doesn't have to parse it on startup. Fails if the file can not be parsed,
+// so errors in it surface when building.
+#include <boost/format.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include "clusterdb/cluster_db.h"
+
+namespace {
+struct TypeNode {
+  const char* kind;
+  unsigned int datatype;
+  std::size_t length_size;
+  std::size_t first;
+  std::size_t count;
+  std::string name;
+};
+
+// Lays out a type tree so that the properties of an object are consecutive.
+struct TypeEmitter {
+  typedef void result_type;
+
+  std::vector<TypeNode>& nodes;
+  std::size_t index;
+
+  std::size_t Add(std::string name) {
+    nodes.push_back(TypeNode{"DataType", 0, 0, 0, 0, std::move(name)});
+    return nodes.size() - 1;
+  }
+  void Emit(std::size_t at, const dynamic_encoding::AnyType& type) {
+    TypeEmitter child{nodes, at};
+    type.apply_visitor(child);
+  }
+
+  void operator()(const dynamic_encoding::VariantType& type) {
+    nodes[index].kind = "Variant";
+  }
+  void operator()(const dynamic_encoding::XiaomiFF01Type& type) {
+    nodes[index].kind = "XiaomiFF01";
+  }
+  void operator()(const zcl::DataType& datatype) {
+    nodes[index].kind = "DataType";
+    nodes[index].datatype = (unsigned int)datatype;
+  }
+  void operator()(const dynamic_encoding::ObjectType& object) {
+    nodes[index].kind = "Object";
+    nodes[index].first = nodes.size();
+    nodes[index].count = object.properties.size();
+    for (const auto& property : object.properties) {
+      Add(property.name);
+    }
+    std::size_t first = nodes[index].first;
+    for (std::size_t i = 0; i < object.properties.size(); i++) {
+      Emit(first + i, object.properties[i].type);
+    }
+  }
+  void operator()(const dynamic_encoding::ArrayType& array) {
+    nodes[index].kind = "Array";
+    nodes[index].length_size = array.length_size;
+    // Add may move nodes, so no references into it may be held.
+    std::size_t first = Add("");
+    nodes[index].first = first;
+    nodes[index].count = 1;
+    Emit(first, array.element_type);
+  }
+  void operator()(const dynamic_encoding::ErrorOrType& type) {
+    nodes[index].kind = "ErrorOr";
+    std::size_t first = Add("");
+    nodes[index].first = first;
+    nodes[index].count = 1;
+    Emit(first, type.success_type);
+  }
+};
+
+// As a C++ string literal, octal escapes can't run into following characters.
+std::string Quote(const std::string& value) {
+  std::string quoted("\"");
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (c >= 0x20 && c < 0x7F) {
+      quoted += c;
+    } else {
+      quoted += boost::str(boost::format("\\%03o") % (unsigned int)(uint8_t)c);
+    }
+  }
+  return quoted + "\"";
+}
+
+void WriteArray(std::ostream& output, const std::string& declaration,
+                const std::vector<std::string>& rows,
+                const std::string& empty_row) {
+  output << "const " << declaration << "[] = {\n";
+  for (const auto& row : rows) {
+    output << "    {" << row << "},\n";
+  }
+  if (rows.empty()) {
+    output << "    {" << empty_row << "},\n";
+  }
+  output << "};\n";
+}
+
+struct Generator {
+  std::vector<TypeNode> types;
+  std::vector<std::string> attributes;
+  std::vector<std::string> commands;
+  std::vector<std::string> clusters;
+
+  void AddCommands(
+      const clusterdb::SearchableList<clusterdb::CommandInfo>& command_list) {
+    for (const auto& command : command_list) {
+      std::size_t type = types.size();
+      types.push_back(TypeNode{"Object", 0, 0, 0, 0, ""});
+      TypeEmitter{types, type}(command.data);
+      commands.push_back(boost::str(boost::format("0x%02X, %s, %u") %
+                                    (unsigned int)command.id %
+                                    Quote(command.name) % type));
+    }
+  }
+
+  void AddCluster(const clusterdb::ClusterInfo& cluster) {
+    std::size_t first_attribute = attributes.size();
+    for (const auto& attribute : cluster.attributes) {
+      attributes.push_back(boost::str(
+          boost::format("0x%04X, %s, %s, 0x%02X") %
+          (unsigned int)attribute.id % Quote(attribute.name) %
+          (attribute.datatype ? "true" : "false") %
+          (attribute.datatype ? (unsigned int)*attribute.datatype : 0)));
+    }
+    std::size_t first_server_to_client = commands.size();
+    AddCommands(cluster.commands_serverToClient);
+    std::size_t first_client_to_server = commands.size();
+    AddCommands(cluster.commands_clientToServer);
+    clusters.push_back(boost::str(
+        boost::format("0x%04X, %s, %u, %u, %u, %u, %u, %u") %
+        (unsigned int)cluster.id % Quote(cluster.name) % first_attribute %
+        (attributes.size() - first_attribute) % first_server_to_client %
+        (first_client_to_server - first_server_to_client) %
+        first_client_to_server % (commands.size() - first_client_to_server)));
+  }
+
+  bool Fits() const {
+    std::size_t max = std::numeric_limits<uint16_t>::max();
+    return types.size() <= max && attributes.size() <= max &&
+           commands.size() <= max;
+  }
+
+  void Write(std::ostream& output, std::size_t global_command_count) const {
+    std::vector<std::string> type_rows;
+    for (const auto& type : types) {
+      type_rows.push_back(boost::str(
+          boost::format("tables::Type::%s, 0x%02X, %u, %u, %u, %s") %
+          type.kind % type.datatype % type.length_size % type.first %
+          type.count % Quote(type.name)));
+    }
+    output << "// Generated by clusterdb_codegen from clusters.info, do not "
+              "edit.\n"
+              "#include \"clusterdb/tables.h\"\n"
+              "\n"
+              "namespace clusterdb {\n"
+              "namespace {\n";
+    WriteArray(output, "tables::Type kTypes", type_rows,
+               "tables::Type::Variant, 0, 0, 0, 0, \"\"");
+    WriteArray(output, "tables::Attribute kAttributes", attributes,
+               "0, \"\", false, 0");
+    WriteArray(output, "tables::Command kCommands", commands, "0, \"\", 0");
+    WriteArray(output, "tables::Cluster kClusters", clusters,
+               "0, \"\", 0, 0, 0, 0, 0, 0");
+    output << "const tables::Tables kTables{kTypes, kAttributes, kCommands, "
+           << global_command_count << ", kClusters, " << clusters.size()
+           << "};\n"
+              "}  // namespace\n"
+              "\n"
+              "const tables::Tables* BuiltinTables() { return &kTables; }\n"
+              "}  // namespace clusterdb\n";
+  }
+};
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " clusters.info output.cpp"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  clusterdb::ClusterDb db;
+  try {
+    if (!db.ParseFromFile(argv[1], [](std::string name) { return name; })) {
+      std::cerr << "Unable to parse " << argv[1] << std::endl;
+      return EXIT_FAILURE;
+    }
+  } catch (const std::exception& ex) {
+    std::cerr << "Unable to parse " << argv[1] << ": " << ex.what()
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Generator generator;
+  generator.AddCommands(db.GlobalCommands());
+  std::size_t global_command_count = generator.commands.size();
+  for (const auto& cluster : db.Clusters()) {
+    generator.AddCluster(cluster);
+  }
+  if (!generator.Fits()) {
+    std::cerr << "Too many definitions for 16-bit table indices" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::ofstream file(argv[2], std::ios::trunc);
+  generator.Write(file, global_command_count);
+  file.close();
+  if (!file) {
+    std::cerr << "Unable to write " << argv[2] << std::endl;
+    // Don't leave a truncated source behind for the next build.
+    std::remove(argv[2]);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -1,6 +1,8 @@
 #ifndef _CLUSTERDB_COMMAND_INFO_H_
 #define _CLUSTERDB_COMMAND_INFO_H_
 #include "dynamic_encoding/common.h"
+#include "dynamic_encoding/decode_plan.h"
+#include "dynamic_encoding/streaming_encoding.h"
 #include "zcl/zcl.h"
 
 namespace clusterdb {
@@ -9,6 +11,9 @@ struct CommandInfo {
   std::string name;
   bool is_global;
   dynamic_encoding::ObjectType data;
+  // data, compiled when loading
+  dynamic_encoding::DecodePlan decode_plan;
+  dynamic_encoding::EncodeIndex encode_index;
 };
 }  // namespace clusterdb
 #endif  //_CLUSTERDB_COMMAND_INFO_H_
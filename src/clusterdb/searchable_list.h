@@ -2,56 +2,137 @@
 #define _CLUSTERDB_SEARCHABLE_LIST_H_
 #include <boost/format.hpp>
 #include <boost/optional.hpp>
-#include <list>
-#include <map>
+#include <boost/utility/string_ref.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
 #include "logging.h"
 
 namespace clusterdb {
+/**
+ * Items searchable by both id and name.
+ *
+ * Items are stored contiguously, with two open-addressing hash tables (linear
+ * probing, at most half full) of indices into them. Hashes of the names are
+ * computed once when adding, so a name lookup only compares strings whose
+ * hashes match. Indices, rather than pointers, keep the list movable.
+ */
 template <typename T>
 class SearchableList {
  public:
   typedef T Item;
   typedef decltype(T::id) Id;
   typedef decltype(T::name) Name;
+  typedef typename std::vector<Item>::const_iterator const_iterator;
 
   bool Add(Item item) {
-    if (by_id_.count(item.id) > 0) {
+    if (FindById(item.id)) {
       LOG("SearchableList", warning)
           << "Duplicate ID "
           << boost::str(boost::format("0x%X") % (unsigned int)item.id);
       return false;
     }
-    if (by_name_.count(item.name) > 0) {
+    if (FindByName(item.name)) {
       LOG("SearchableList", warning) << "Duplicate name '" << item.name << "'";
       return false;
     }
+    name_hashes_.push_back(HashName(item.name));
     items_.emplace_back(std::move(item));
-    Item& ref = items_.back();
-    by_id_[ref.id] = &ref;
-    by_name_[ref.name] = &ref;
+    if (items_.size() * 2 > by_id_.size()) {
+      Rehash();
+    } else {
+      Insert(items_.size() - 1);
+    }
     return true;
   }
 
-  boost::optional<const Item&> FindByName(const Name& name) const {
-    auto found = by_name_.find(name);
-    if (found == by_name_.end()) {
+  boost::optional<const Item&> FindByName(boost::string_ref name) const {
+    if (by_name_.empty()) {
       return boost::none;
     }
-    return *found->second;
+    uint64_t hash = HashName(name);
+    for (std::size_t slot = hash & Mask();; slot = (slot + 1) & Mask()) {
+      uint32_t index = by_name_[slot];
+      if (index == kEmpty) {
+        return boost::none;
+      }
+      if (name_hashes_[index] == hash &&
+          name == boost::string_ref(items_[index].name)) {
+        return items_[index];
+      }
+    }
   }
 
+  // In order of adding.
+  const_iterator begin() const { return items_.begin(); }
+  const_iterator end() const { return items_.end(); }
+
   boost::optional<const Item&> FindById(const Id& id) const {
-    auto found = by_id_.find(id);
-    if (found == by_id_.end()) {
+    if (by_id_.empty()) {
       return boost::none;
     }
-    return *found->second;
+    for (std::size_t slot = HashId(id) & Mask();; slot = (slot + 1) & Mask()) {
+      uint32_t index = by_id_[slot];
+      if (index == kEmpty) {
+        return boost::none;
+      }
+      if (items_[index].id == id) {
+        return items_[index];
+      }
+    }
   }
 
  private:
-  std::list<Item> items_;
-  std::map<Id, Item*> by_id_;
-  std::map<Name, Item*> by_name_;
+  static constexpr uint32_t kEmpty = 0xFFFFFFFF;
+
+  // FNV-1a
+  static uint64_t HashName(boost::string_ref name) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (char c : name) {
+      hash = (hash ^ (uint8_t)c) * 0x100000001B3ULL;
+    }
+    return hash;
+  }
+
+  // Fibonacci hashing, ids are often consecutive.
+  static uint64_t HashId(const Id& id) {
+    return (((uint64_t)id) * 0x9E3779B97F4A7C15ULL) >> 32;
+  }
+
+  std::size_t Mask() const { return by_id_.size() - 1; }
+
+  void Insert(std::size_t index) {
+    std::size_t slot = HashId(items_[index].id) & Mask();
+    while (by_id_[slot] != kEmpty) {
+      slot = (slot + 1) & Mask();
+    }
+    by_id_[slot] = (uint32_t)index;
+    slot = name_hashes_[index] & Mask();
+    while (by_name_[slot] != kEmpty) {
+      slot = (slot + 1) & Mask();
+    }
+    by_name_[slot] = (uint32_t)index;
+  }
+
+  void Rehash() {
+    std::size_t size = 8;
+    while (size < items_.size() * 2) {
+      size *= 2;
+    }
+    by_id_.assign(size, kEmpty);
+    by_name_.assign(size, kEmpty);
+    for (std::size_t index = 0; index < items_.size(); index++) {
+      Insert(index);
+    }
+  }
+
+  std::vector<Item> items_;
+  std::vector<uint64_t> name_hashes_;
+  std::vector<uint32_t> by_id_;
+  std::vector<uint32_t> by_name_;
 };
+
+template <typename T>
+constexpr uint32_t SearchableList<T>::kEmpty;
 }  // namespace clusterdb
 #endif  // _CLUSTERDB_SEARCHABLE_LIST_H_
@@ -0,0 +1,70 @@
+#ifndef _CLUSTERDB_TABLES_H_
+#define _CLUSTERDB_TABLES_H_
+#include <cstddef>
+#include <cstdint>
+
+namespace clusterdb {
+/**
+ * Cluster definitions as plain constant tables, as generated from
+ * clusters.info at build time by clusterdb_codegen. Loading these only
+ * copies them into a ClusterDb, with none of the parsing of the file.
+ */
+namespace tables {
+// One node of a type tree. An Object has its properties in the count nodes
+// starting at first, an Array or ErrorOr has its element type at first.
+struct Type {
+  enum Kind : uint8_t {
+    DataType,
+    Variant,
+    XiaomiFF01,
+    Object,
+    Array,
+    ErrorOr,
+  };
+  Kind kind;
+  uint8_t datatype;     // DataType only
+  uint8_t length_size;  // Array only
+  uint16_t first;
+  uint16_t count;
+  const char* name;  // Property name, for properties of an Object
+};
+
+struct Attribute {
+  uint16_t id;
+  const char* name;
+  bool has_datatype;
+  uint8_t datatype;
+};
+
+struct Command {
+  uint8_t id;
+  const char* name;
+  uint16_t type;  // Index of the Object with the arguments
+};
+
+struct Cluster {
+  uint16_t id;
+  const char* name;
+  uint16_t first_attribute;
+  uint16_t attribute_count;
+  uint16_t first_server_to_client;
+  uint16_t server_to_client_count;
+  uint16_t first_client_to_server;
+  uint16_t client_to_server_count;
+};
+
+struct Tables {
+  const Type* types;
+  const Attribute* attributes;
+  const Command* commands;  // Starting with the global commands
+  std::size_t global_command_count;
+  const Cluster* clusters;
+  std::size_t cluster_count;
+};
+}  // namespace tables
+
+// Tables generated from clusters.info when building, or nullptr if the build
+// was unable to run the generator (e.g. when cross-compiling).
+const tables::Tables* BuiltinTables();
+}  // namespace clusterdb
+#endif  // _CLUSTERDB_TABLES_H_
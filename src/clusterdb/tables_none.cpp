@@ -0,0 +1,7 @@
+#include "clusterdb/tables.h"
+
+namespace clusterdb {
+// Linked instead of the generated tables when clusterdb_codegen can not be
+// run as part of the build.
+const tables::Tables* BuiltinTables() { return nullptr; }
+}  // namespace clusterdb
@@ -17,4 +17,43 @@ bool operator==(const XiaomiFF01Type& a, const XiaomiFF01Type& b) {
 bool operator==(const ErrorOrType& a, const ErrorOrType& b) {
   return a.success_type == b.success_type;
 }
+
+void AppendJsonString(std::string& target, const std::string& value) {
+  static const char hex_digits[] = "0123456789abcdef";
+  target += '"';
+  for (char c : value) {
+    switch (c) {
+      case '"':
+        target += "\\\"";
+        break;
+      case '\\':
+        target += "\\\\";
+        break;
+      case '\b':
+        target += "\\b";
+        break;
+      case '\f':
+        target += "\\f";
+        break;
+      case '\n':
+        target += "\\n";
+        break;
+      case '\r':
+        target += "\\r";
+        break;
+      case '\t':
+        target += "\\t";
+        break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          target += "\\u00";
+          target += hex_digits[(unsigned char)c >> 4];
+          target += hex_digits[(unsigned char)c & 0xF];
+        } else {
+          target += c;
+        }
+    }
+  }
+  target += '"';
+}
 }  // namespace dynamic_encoding
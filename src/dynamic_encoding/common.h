@@ -2,6 +2,7 @@
 #define _DYNAMIC_ENCODING_COMMON_H_
 #include <boost/variant.hpp>
 #include <memory>
+#include <string>
 #include "zcl/zcl.h"
 
 namespace clusterdb {
@@ -46,5 +47,8 @@ bool operator==(const ObjectEntry& a, const ObjectEntry& b);
 bool operator==(const ObjectType& a, const ObjectType& b);
 bool operator==(const ArrayType& a, const ArrayType& b);
 bool operator==(const ErrorOrType& a, const ErrorOrType& b);
+
+// Appends value as a quoted & escaped JSON string.
+void AppendJsonString(std::string& target, const std::string& value);
 }  // namespace dynamic_encoding
 #endif  // _DYNAMIC_ENCODING_COMMON_H_
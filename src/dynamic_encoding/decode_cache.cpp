@@ -0,0 +1,92 @@
+#include "dynamic_encoding/decode_cache.h"
+
+namespace dynamic_encoding {
+namespace {
+// Rough cost of the map node, list node, and bookkeeping of an item.
+const std::size_t kItemOverhead = 96;
+}  // namespace
+
+DecodeCache::DecodeCache(std::size_t max_bytes)
+    : max_bytes_(max_bytes), bytes_(0), hits_(0), misses_(0), evictions_(0) {}
+
+std::string DecodeCache::MakeKey(std::uint64_t generation,
+                                 zcl::ZclClusterId cluster_id, bool is_global,
+                                 zcl::ZclDirection direction,
+                                 zcl::ZclCommandId command_id,
+                                 const std::vector<uint8_t>& payload) {
+  std::string key;
+  key.reserve(12 + payload.size());
+  for (int shift = 0; shift < 64; shift += 8) {
+    key.push_back((char)((generation >> shift) & 0xFF));
+  }
+  key.push_back((char)(((unsigned int)cluster_id) & 0xFF));
+  key.push_back((char)(((unsigned int)cluster_id) >> 8));
+  bool to_client = direction == zcl::ZclDirection::ServerToClient;
+  key.push_back((char)((is_global ? 1 : 0) | (to_client ? 2 : 0)));
+  key.push_back((char)command_id);
+  key.append(payload.begin(), payload.end());
+  return key;
+}
+
+const DecodeCache::Entry* DecodeCache::Get(const std::string& key) {
+  if (max_bytes_ == 0) {
+    return nullptr;
+  }
+  auto found = items_.find(key);
+  if (found == items_.end()) {
+    misses_++;
+    return nullptr;
+  }
+  hits_++;
+  lru_.splice(lru_.begin(), lru_, found->second.lru);
+  return &found->second.entry;
+}
+
+void DecodeCache::Put(std::string key, Entry entry) {
+  std::size_t size = SizeOf(key, entry);
+  if (size > max_bytes_) {
+    return;
+  }
+  auto found = items_.find(key);
+  if (found != items_.end()) {
+    bytes_ -= found->second.size;
+    found->second.entry = std::move(entry);
+    found->second.size = size;
+    lru_.splice(lru_.begin(), lru_, found->second.lru);
+  } else {
+    found = items_.emplace(std::move(key), Item{std::move(entry), size, {}})
+                .first;
+    lru_.push_front(&found->first);
+    found->second.lru = lru_.begin();
+  }
+  bytes_ += size;
+  Evict();
+}
+
+void DecodeCache::Clear() {
+  items_.clear();
+  lru_.clear();
+  bytes_ = 0;
+}
+
+DecodeCache::Statistics DecodeCache::GetStatistics() const {
+  return Statistics{items_.size(), bytes_, hits_, misses_, evictions_};
+}
+
+std::size_t DecodeCache::SizeOf(const std::string& key, const Entry& entry) {
+  return kItemOverhead + key.size() + entry.text.size() +
+         entry.record_spans.size() * sizeof(TextSpan) +
+         entry.record_attribute_ids.size() *
+             sizeof(boost::optional<zcl::ZclAttributeId>);
+}
+
+void DecodeCache::Evict() {
+  while (bytes_ > max_bytes_ && !lru_.empty()) {
+    auto found = items_.find(*lru_.back());
+    bytes_ -= found->second.size;
+    lru_.pop_back();
+    items_.erase(found);
+    evictions_++;
+  }
+}
+}  // namespace dynamic_encoding
@@ -0,0 +1,76 @@
+#ifndef _DYNAMIC_ENCODING_DECODE_CACHE_H_
+#define _DYNAMIC_ENCODING_DECODE_CACHE_H_
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "dynamic_encoding/decoding.h"
+#include "zcl/zcl.h"
+
+namespace dynamic_encoding {
+/**
+ * Remembers command payloads decoded to JSON text, as devices often send the
+ * same report byte for byte. Keyed by (cluster, command, payload bytes), so a
+ * hit needs no decoding at all, and by the generation of the cluster database
+ * it was decoded with, so entries put by messages still being handled with a
+ * replaced database are never found with the new one.
+ *
+ * Least recently used entries are evicted once keys, texts, and spans together
+ * take up more than max_bytes. A max_bytes of 0 disables the cache.
+ */
+class DecodeCache {
+ public:
+  struct Entry {
+    std::string text;
+    std::vector<TextSpan> record_spans;
+    bool complete;  // Whether the whole payload was used
+    // Attribute id of every record, resolved when decoding so hits don't
+    // parse the id text again. Empty if the id isn't known.
+    std::vector<boost::optional<zcl::ZclAttributeId>> record_attribute_ids;
+  };
+  struct Statistics {
+    std::size_t entries;
+    std::size_t bytes;
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t evictions;
+  };
+
+  DecodeCache(std::size_t max_bytes = 256 * 1024);
+
+  static std::string MakeKey(std::uint64_t generation,
+                             zcl::ZclClusterId cluster_id, bool is_global,
+                             zcl::ZclDirection direction,
+                             zcl::ZclCommandId command_id,
+                             const std::vector<uint8_t>& payload);
+
+  // Counts as a hit or miss, and marks the entry as most recently used. Not
+  // counted at all when the cache is disabled.
+  const Entry* Get(const std::string& key);
+  void Put(std::string key, Entry entry);
+  void Clear();
+
+  Statistics GetStatistics() const;
+
+ private:
+  struct Item {
+    Entry entry;
+    std::size_t size;
+    std::list<const std::string*>::iterator lru;
+  };
+  static std::size_t SizeOf(const std::string& key, const Entry& entry);
+  void Evict();
+
+  const std::size_t max_bytes_;
+  std::unordered_map<std::string, Item> items_;
+  // Keys of items_, most recently used first.
+  std::list<const std::string*> lru_;
+  std::size_t bytes_;
+  std::uint64_t hits_;
+  std::uint64_t misses_;
+  std::uint64_t evictions_;
+};
+}  // namespace dynamic_encoding
+#endif  // _DYNAMIC_ENCODING_DECODE_CACHE_H_
@@ -0,0 +1,117 @@
+#include "dynamic_encoding/decode_plan.h"
+
+namespace dynamic_encoding {
+namespace {
+// Encoded size of a datatype, or 0 if it depends on the data.
+std::size_t FixedSize(zcl::DataType datatype) {
+  std::size_t type = (std::size_t)datatype;
+  if (type >= (std::size_t)zcl::DataType::data8 &&
+      type <= (std::size_t)zcl::DataType::data64) {
+    return 1 + type - (std::size_t)zcl::DataType::data8;
+  }
+  if (type >= (std::size_t)zcl::DataType::map8 &&
+      type <= (std::size_t)zcl::DataType::map64) {
+    return 1 + type - (std::size_t)zcl::DataType::map8;
+  }
+  if (type >= (std::size_t)zcl::DataType::uint8 &&
+      type <= (std::size_t)zcl::DataType::uint64) {
+    return 1 + type - (std::size_t)zcl::DataType::uint8;
+  }
+  if (type >= (std::size_t)zcl::DataType::int8 &&
+      type <= (std::size_t)zcl::DataType::int64) {
+    return 1 + type - (std::size_t)zcl::DataType::int8;
+  }
+  switch (datatype) {
+    case zcl::DataType::_bool:
+    case zcl::DataType::enum8:
+      return 1;
+    case zcl::DataType::enum16:
+    case zcl::DataType::semi:
+    case zcl::DataType::attribId:
+      return 2;
+    case zcl::DataType::single:
+      return 4;
+    case zcl::DataType::_double:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+struct PlanCompiler {
+  typedef void result_type;
+
+  std::vector<DecodeOp>& ops;
+  std::string name;
+
+  std::size_t Add(DecodeOp::Kind kind) {
+    std::string json_key;
+    AppendJsonString(json_key, name);
+    json_key += ':';
+    ops.push_back(DecodeOp{kind, zcl::DataType::nodata, 0, 0, 0,
+                           std::move(name), std::move(json_key)});
+    name.clear();
+    return ops.size() - 1;
+  }
+
+  void operator()(const VariantType& variant) {
+    std::size_t index = Add(DecodeOp::Kind::Variant);
+    ops[index].next = ops.size();
+  }
+
+  void operator()(const XiaomiFF01Type& type) {
+    std::size_t index = Add(DecodeOp::Kind::XiaomiFF01);
+    ops[index].next = ops.size();
+  }
+
+  void operator()(const zcl::DataType& datatype) {
+    std::size_t index = Add(DecodeOp::Kind::Value);
+    ops[index].datatype = datatype;
+    ops[index].fixed_size = FixedSize(datatype);
+    ops[index].next = ops.size();
+  }
+
+  void operator()(const ObjectType& object) {
+    std::size_t index = Add(DecodeOp::Kind::Object);
+    std::size_t fixed_size = 0;
+    bool is_fixed = true;
+    for (const auto& property : object.properties) {
+      std::size_t operand = ops.size();
+      name = property.name;
+      property.type.apply_visitor(*this);
+      is_fixed = is_fixed && ops[operand].fixed_size > 0;
+      fixed_size += ops[operand].fixed_size;
+    }
+    ops[index].fixed_size = is_fixed ? fixed_size : 0;
+    ops[index].next = ops.size();
+  }
+
+  void operator()(const ArrayType& array) {
+    std::size_t index = Add(DecodeOp::Kind::Array);
+    ops[index].length_size = array.length_size;
+    array.element_type.apply_visitor(*this);
+    ops[index].next = ops.size();
+  }
+
+  void operator()(const ErrorOrType& type) {
+    std::size_t index = Add(DecodeOp::Kind::ErrorOr);
+    type.success_type.apply_visitor(*this);
+    ops[index].next = ops.size();
+  }
+};
+}  // namespace
+
+DecodePlan CompileDecodePlan(const AnyType& type) {
+  DecodePlan plan;
+  PlanCompiler compiler{plan.ops, ""};
+  type.apply_visitor(compiler);
+  return plan;
+}
+
+DecodePlan CompileDecodePlan(const ObjectType& object) {
+  DecodePlan plan;
+  PlanCompiler compiler{plan.ops, ""};
+  compiler(object);
+  return plan;
+}
+}  // namespace dynamic_encoding
@@ -0,0 +1,42 @@
+#ifndef _DYNAMIC_ENCODING_DECODE_PLAN_H_
+#define _DYNAMIC_ENCODING_DECODE_PLAN_H_
+#include <string>
+#include <vector>
+#include "dynamic_encoding/common.h"
+
+namespace dynamic_encoding {
+struct DecodeOp {
+  enum class Kind : uint8_t {
+    Value,
+    Variant,
+    XiaomiFF01,
+    Object,
+    Array,
+    ErrorOr,
+  };
+  Kind kind;
+  zcl::DataType datatype;    // Value only
+  std::size_t length_size;   // Array only
+  std::size_t next;          // Index of the op after this one & its operands
+  std::size_t fixed_size;    // Encoded size if known up front, or 0
+  std::string name;          // Property name, for operands of an Object
+  std::string json_key;      // name as escaped JSON string, followed by ':'
+};
+
+/**
+ * An AnyType tree compiled into a flat list of operations, in pre-order: the
+ * operands of an Object, Array, or ErrorOr op directly follow it, and each op
+ * knows where its operands end. Decoding a plan is a loop over this list,
+ * instead of visiting the variant tree again for every message.
+ *
+ * Property names are also kept pre-escaped, for decoding straight to JSON
+ * text.
+ */
+struct DecodePlan {
+  std::vector<DecodeOp> ops;
+};
+
+DecodePlan CompileDecodePlan(const AnyType& type);
+DecodePlan CompileDecodePlan(const ObjectType& object);
+}  // namespace dynamic_encoding
+#endif  // _DYNAMIC_ENCODING_DECODE_PLAN_H_
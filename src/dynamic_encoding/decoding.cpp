@@ -1,4 +1,5 @@
 #include "dynamic_encoding/decoding.h"
+#include <algorithm>
 #include <type_traits>
 #include "clusterdb/cluster_info.h"
 #include "string_enum.h"
@@ -285,6 +286,414 @@ struct Decoder {
     }
   }
 };
+struct PlanDecoder {
+  const DecodePlan& plan;
+  Decoder& decoder;
+
+  tao::json::value operator()(std::size_t index) {
+    const DecodeOp& op = plan.ops[index];
+    switch (op.kind) {
+      case DecodeOp::Kind::Value:
+        return decoder(op.datatype);
+      case DecodeOp::Kind::Variant:
+        return decoder(VariantType{});
+      case DecodeOp::Kind::XiaomiFF01:
+        return decoder(XiaomiFF01Type{});
+      case DecodeOp::Kind::Object: {
+        tao::json::value::object_t ret;
+        for (std::size_t operand = index + 1; operand < op.next;
+             operand = plan.ops[operand].next) {
+          ret[plan.ops[operand].name] = (*this)(operand);
+        }
+        return ret;
+      }
+      case DecodeOp::Kind::Array: {
+        tao::json::value::array_t ret;
+        std::size_t element = index + 1;
+        std::size_t available =
+            (std::size_t)std::distance(decoder.begin, decoder.end);
+        std::size_t element_size = plan.ops[element].fixed_size;
+        if (op.length_size == 0) {
+          if (element_size > 0) {
+            ret.reserve(available / element_size);
+          }
+          while (decoder.begin != decoder.end) {
+            ret.push_back((*this)(element));
+          }
+        } else {
+          std::size_t length = DecodeInteger<std::size_t>(
+              op.length_size, decoder.begin, decoder.end);
+          if (element_size > 0) {
+            ret.reserve(std::min(length, available / element_size));
+          }
+          while (length--) {
+            ret.push_back((*this)(element));
+          }
+        }
+        return ret;
+      }
+      case DecodeOp::Kind::ErrorOr: {
+        unsigned int status =
+            DecodeInteger<unsigned int>(1, decoder.begin, decoder.end);
+        if (status != 0) {
+          return tao::json::value::object_t{{"error", status}};
+        } else {
+          return tao::json::value::object_t{{"success", (*this)(index + 1)}};
+        }
+      }
+    }
+    throw std::runtime_error("Invalid decode plan");
+  }
+};
+
+void AppendUnsigned(std::string& target, std::uint64_t value) {
+  char buffer[20];
+  char* digits = buffer + sizeof(buffer);
+  do {
+    *(--digits) = '0' + (value % 10);
+    value /= 10;
+  } while (value != 0);
+  target.append(digits, buffer + sizeof(buffer));
+}
+
+void AppendSigned(std::string& target, std::int64_t value) {
+  if (value < 0) {
+    target += '-';
+    AppendUnsigned(target, 0 - (std::uint64_t)value);
+  } else {
+    AppendUnsigned(target, (std::uint64_t)value);
+  }
+}
+
+// Same as Decoder & PlanDecoder, but appends JSON text to target instead of
+// building a tao::json::value.
+struct TextDecoder {
+  std::vector<uint8_t>::const_iterator& begin;
+  const std::vector<uint8_t>::const_iterator& end;
+  const Context& ctx;
+  std::string& target;
+  // Location of the value decoded by the last ErrorOr op, empty for an error.
+  std::size_t success_begin = 0;
+  std::size_t success_end = 0;
+
+  void Variant() {
+    zcl::DataType type;
+    znp::EncodeHelper<zcl::DataType>::Decode(type, begin, end);
+    if (type == zcl::DataType::string &&
+        ctx.last_attribute_id == (zcl::ZclAttributeId)0xFF01) {
+      XiaomiFF01();
+      return;
+    }
+    target += "{\"type\":";
+    AppendJsonString(target, enum_to_string<zcl::DataType>(type));
+    target += ",\"value\":";
+    Value(type);
+    target += '}';
+  }
+
+  void Value(zcl::DataType datatype) {
+    switch (datatype) {
+      case zcl::DataType::nodata:
+        target += "null";
+        return;
+      case zcl::DataType::data8:
+      case zcl::DataType::data16:
+      case zcl::DataType::data24:
+      case zcl::DataType::data32:
+      case zcl::DataType::data40:
+      case zcl::DataType::data48:
+      case zcl::DataType::data56:
+      case zcl::DataType::data64: {
+        std::size_t length =
+            1 + ((std::size_t)datatype - (std::size_t)zcl::DataType::data8);
+        target += '[';
+        for (std::size_t i = 0; i < length; i++) {
+          if (i > 0) {
+            target += ',';
+          }
+          AppendUnsigned(target, DecodeInteger<unsigned int>(1, begin, end));
+        }
+        target += ']';
+        return;
+      }
+      case zcl::DataType::_bool: {
+        uint8_t x = DecodeInteger<uint8_t>(1, begin, end);
+        target += (x == 0xFF) ? "null" : ((x != 0) ? "true" : "false");
+        return;
+      }
+      case zcl::DataType::map8:
+      case zcl::DataType::map16:
+      case zcl::DataType::map24:
+      case zcl::DataType::map32:
+      case zcl::DataType::map40:
+      case zcl::DataType::map48:
+      case zcl::DataType::map56:
+      case zcl::DataType::map64: {
+        std::size_t length =
+            1 + ((std::size_t)datatype - (std::size_t)zcl::DataType::map8);
+        std::uint64_t value = DecodeInteger<std::uint64_t>(length, begin, end);
+        target += '[';
+        for (std::size_t bit = 0; bit < length * 8; bit++) {
+          if (bit > 0) {
+            target += ',';
+          }
+          target += (((value >> bit) & 0x1) != 0) ? "true" : "false";
+        }
+        target += ']';
+        return;
+      }
+      case zcl::DataType::uint8:
+      case zcl::DataType::uint16:
+      case zcl::DataType::uint24:
+      case zcl::DataType::uint32:
+      case zcl::DataType::uint40:
+      case zcl::DataType::uint48:
+      case zcl::DataType::uint56:
+      case zcl::DataType::uint64: {
+        std::size_t length =
+            1 + ((std::size_t)datatype - (std::size_t)zcl::DataType::uint8);
+        AppendUnsigned(target,
+                       DecodeInteger<std::uint64_t>(length, begin, end));
+        return;
+      }
+      case zcl::DataType::int8:
+      case zcl::DataType::int16:
+      case zcl::DataType::int24:
+      case zcl::DataType::int32:
+      case zcl::DataType::int40:
+      case zcl::DataType::int48:
+      case zcl::DataType::int56:
+      case zcl::DataType::int64: {
+        std::size_t length =
+            1 + ((std::size_t)datatype - (std::size_t)zcl::DataType::int8);
+        AppendSigned(target, DecodeInteger<std::int64_t>(length, begin, end));
+        return;
+      }
+      case zcl::DataType::enum8:
+      case zcl::DataType::enum16: {
+        std::size_t length =
+            1 + ((std::size_t)datatype - (std::size_t)zcl::DataType::enum8);
+        AppendUnsigned(target,
+                       DecodeInteger<std::uint64_t>(length, begin, end));
+        return;
+      }
+      case zcl::DataType::semi:
+      case zcl::DataType::single:
+      case zcl::DataType::_double:
+        // Rare enough to not bother with number formatting of our own.
+        target += tao::json::to_string(Decoder{begin, end, ctx}(datatype));
+        return;
+      case zcl::DataType::octstr:
+      case zcl::DataType::octstr16: {
+        std::size_t size_bytes = (datatype == zcl::DataType::octstr16 ? 2 : 1);
+        std::size_t invalid_size = (1 << (size_bytes * 8)) - 1;
+        std::size_t size = DecodeInteger<std::size_t>(size_bytes, begin, end);
+        if (size == invalid_size) {
+          target += "null";
+          return;
+        }
+        if ((std::size_t)std::distance(begin, end) < size) {
+          throw std::runtime_error("Not enough data to decode octet string");
+        }
+        target += '[';
+        for (std::size_t i = 0; i < size; i++) {
+          if (i > 0) {
+            target += ',';
+          }
+          AppendUnsigned(target, *(begin++));
+        }
+        target += ']';
+        return;
+      }
+      case zcl::DataType::string:
+      case zcl::DataType::string16: {
+        std::size_t size_bytes = (datatype == zcl::DataType::string16 ? 2 : 1);
+        std::size_t invalid_size = (1 << (size_bytes * 8)) - 1;
+        std::size_t size = DecodeInteger<std::size_t>(size_bytes, begin, end);
+        if (size == invalid_size) {
+          target += "null";
+          return;
+        }
+        if ((std::size_t)std::distance(begin, end) < size) {
+          throw std::runtime_error(
+              "Not enough data to decode character string");
+        }
+        AppendJsonString(target, std::string(begin, begin + size));
+        begin += size;
+        return;
+      }
+      case zcl::DataType::_struct: {
+        std::size_t invalid_size = 0xFFFF;
+        std::size_t size = DecodeInteger<std::size_t>(2, begin, end);
+        if (size == invalid_size) {
+          target += "null";
+          return;
+        }
+        target += '[';
+        for (std::size_t i = 0; i < size; i++) {
+          if (i > 0) {
+            target += ',';
+          }
+          Variant();
+        }
+        target += ']';
+        return;
+      }
+      case zcl::DataType::array:
+      case zcl::DataType::set:
+      case zcl::DataType::bag: {
+        zcl::DataType datatype;
+        znp::EncodeHelper<zcl::DataType>::Decode(datatype, begin, end);
+        std::size_t invalid_size = 0xFFFF;
+        std::size_t size = DecodeInteger<std::size_t>(2, begin, end);
+        target += "{\"element_type\":";
+        AppendJsonString(target, enum_to_string<zcl::DataType>(datatype));
+        target += ",\"elements\":";
+        if (size == invalid_size) {
+          target += "null}";
+          return;
+        }
+        target += '[';
+        for (std::size_t i = 0; i < size; i++) {
+          if (i > 0) {
+            target += ',';
+          }
+          Value(datatype);
+        }
+        target += "]}";
+        return;
+      }
+      case zcl::DataType::attribId: {
+        zcl::ZclAttributeId id;
+        znp::EncodeHelper<zcl::ZclAttributeId>::Decode(id, begin, end);
+        ctx.last_attribute_id = id;
+        if (ctx.cluster) {
+          if (auto attribute_info = ctx.cluster->attributes.FindById(id)) {
+            AppendJsonString(target, attribute_info->name);
+            return;
+          }
+        }
+        AppendUnsigned(target, (unsigned int)id);
+        return;
+      }
+      case zcl::DataType::unk:
+        target += "null";
+        return;
+      default:
+        throw std::runtime_error(
+            boost::str(boost::format("Decoding of type %s not implemented") %
+                       enum_to_string<zcl::DataType>(datatype)));
+    }
+  }
+
+  void XiaomiFF01() {
+    std::size_t size = DecodeInteger<std::size_t>(1, begin, end);
+    if (size > (std::size_t)std::distance(begin, end)) {
+      LOG("DynamicDecoding", warning)
+          << "Xiami FF01 attribute length mismatch, fixing up.";
+      size = (std::size_t)std::distance(begin, end);
+    }
+    auto attribute_end = begin + size;
+    ctx.last_attribute_id = boost::none;
+    TextDecoder subdecoder{begin, attribute_end, ctx, target};
+    target += "{\"type\":\"xiaomi_ff01\",\"value\":{";
+    bool first = true;
+    while (subdecoder.begin != subdecoder.end) {
+      if (!first) {
+        target += ',';
+      }
+      first = false;
+      target += '"';
+      AppendUnsigned(target, DecodeInteger<unsigned int>(1, subdecoder.begin,
+                                                         subdecoder.end));
+      target += "\":";
+      subdecoder.Variant();
+    }
+    target += "}}";
+  }
+
+  // Record spans are collected for the properties of the op at record_index.
+  void Plan(const DecodePlan& plan, std::size_t index,
+            std::size_t record_index, std::vector<TextSpan>* record_spans) {
+    const DecodeOp& op = plan.ops[index];
+    switch (op.kind) {
+      case DecodeOp::Kind::Value:
+        Value(op.datatype);
+        return;
+      case DecodeOp::Kind::Variant:
+        Variant();
+        return;
+      case DecodeOp::Kind::XiaomiFF01:
+        XiaomiFF01();
+        return;
+      case DecodeOp::Kind::Object: {
+        target += '{';
+        for (std::size_t operand = index + 1; operand < op.next;
+             operand = plan.ops[operand].next) {
+          if (operand != index + 1) {
+            target += ',';
+          }
+          target += plan.ops[operand].json_key;
+          std::size_t value_begin = target.size();
+          Plan(plan, operand, record_index, record_spans);
+          if (index == record_index && record_spans) {
+            TextSpan span{value_begin, target.size(), value_begin,
+                          target.size()};
+            if (plan.ops[operand].kind == DecodeOp::Kind::ErrorOr) {
+              span.value_begin = success_begin;
+              span.value_end = success_end;
+            }
+            record_spans->push_back(span);
+          }
+        }
+        target += '}';
+        return;
+      }
+      case DecodeOp::Kind::Array: {
+        std::size_t element = index + 1;
+        target += '[';
+        if (op.length_size == 0) {
+          for (bool first = true; begin != end; first = false) {
+            if (!first) {
+              target += ',';
+            }
+            Plan(plan, element, record_index, record_spans);
+          }
+        } else {
+          std::size_t length =
+              DecodeInteger<std::size_t>(op.length_size, begin, end);
+          for (std::size_t i = 0; i < length; i++) {
+            if (i > 0) {
+              target += ',';
+            }
+            Plan(plan, element, record_index, record_spans);
+          }
+        }
+        target += ']';
+        return;
+      }
+      case DecodeOp::Kind::ErrorOr: {
+        unsigned int status = DecodeInteger<unsigned int>(1, begin, end);
+        if (status != 0) {
+          target += "{\"error\":";
+          AppendUnsigned(target, status);
+          target += '}';
+          success_begin = success_end = target.size();
+        } else {
+          target += "{\"success\":";
+          std::size_t value_begin = target.size();
+          Plan(plan, index + 1, record_index, record_spans);
+          success_begin = value_begin;
+          success_end = target.size();
+          target += '}';
+        }
+        return;
+      }
+    }
+    throw std::runtime_error("Invalid decode plan");
+  }
+};
+
 tao::json::value Decode(const Context& ctx, const AnyType& type,
                         std::vector<uint8_t>::const_iterator& begin,
                         const std::vector<uint8_t>::const_iterator& end) {
@@ -297,4 +706,32 @@ tao::json::value Decode(const Context& ctx, const ObjectType& object,
   Decoder dec{begin, end, ctx};
   return dec(object);
 }
+tao::json::value Decode(const Context& ctx, const DecodePlan& plan,
+                        std::vector<uint8_t>::const_iterator& begin,
+                        const std::vector<uint8_t>::const_iterator& end) {
+  if (plan.ops.empty()) {
+    throw std::runtime_error("Empty decode plan");
+  }
+  Decoder dec{begin, end, ctx};
+  PlanDecoder plan_dec{plan, dec};
+  return plan_dec(0);
+}
+void DecodeToText(const Context& ctx, const DecodePlan& plan,
+                  std::vector<uint8_t>::const_iterator& begin,
+                  const std::vector<uint8_t>::const_iterator& end,
+                  std::string& target, std::vector<TextSpan>* record_spans) {
+  if (plan.ops.empty()) {
+    throw std::runtime_error("Empty decode plan");
+  }
+  // Records are the elements of a list of objects in the first property, like
+  // the attribute reports in Report Attributes.
+  std::size_t record_index = plan.ops.size();
+  if (plan.ops.size() > 2 && plan.ops[0].kind == DecodeOp::Kind::Object &&
+      plan.ops[1].kind == DecodeOp::Kind::Array &&
+      plan.ops[2].kind == DecodeOp::Kind::Object) {
+    record_index = 2;
+  }
+  TextDecoder dec{begin, end, ctx, target};
+  dec.Plan(plan, 0, record_index, record_spans);
+}
 }  // namespace dynamic_encoding
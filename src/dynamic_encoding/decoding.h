@@ -1,8 +1,10 @@
 #ifndef _DYNAMIC_ENCODING_DECODING_H_
 #define _DYNAMIC_ENCODING_DECODING_H_
+#include <string>
 #include <tao/json.hpp>
 #include <vector>
 #include "dynamic_encoding/common.h"
+#include "dynamic_encoding/decode_plan.h"
 
 namespace dynamic_encoding {
 tao::json::value Decode(const Context& ctx, const AnyType& type,
@@ -11,5 +13,30 @@ tao::json::value Decode(const Context& ctx, const AnyType& type,
 tao::json::value Decode(const Context& ctx, const ObjectType& object,
                         std::vector<uint8_t>::const_iterator& begin,
                         const std::vector<uint8_t>::const_iterator& end);
+// Same result as decoding the type the plan was compiled from.
+tao::json::value Decode(const Context& ctx, const DecodePlan& plan,
+                        std::vector<uint8_t>::const_iterator& begin,
+                        const std::vector<uint8_t>::const_iterator& end);
+
+struct TextSpan {
+  std::size_t begin;
+  std::size_t end;
+  // Where the value itself is. For a status & value, like the records of Read
+  // Attributes Response, that is the value inside "success", or empty for an
+  // "error". The same as begin & end otherwise.
+  std::size_t value_begin;
+  std::size_t value_end;
+};
+// Decodes straight to JSON text, appended to target, without building a
+// tao::json::value in between. Parses to the same value as Decode, except that
+// object keys are in schema order rather than sorted. If record_spans is
+// given, and the first property of the plan is a list of objects (e.g.
+// attribute reports), the location in target of every property of every
+// element is added to it.
+void DecodeToText(const Context& ctx, const DecodePlan& plan,
+                  std::vector<uint8_t>::const_iterator& begin,
+                  const std::vector<uint8_t>::const_iterator& end,
+                  std::string& target,
+                  std::vector<TextSpan>* record_spans = nullptr);
 }  // namespace dynamic_encoding
 #endif  // _DYNAMIC_ENCODING_DECODING_H_
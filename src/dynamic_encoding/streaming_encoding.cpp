@@ -0,0 +1,181 @@
+#include "dynamic_encoding/streaming_encoding.h"
+#include <algorithm>
+#include <tao/json.hpp>
+#include "dynamic_encoding/encoding.h"
+
+namespace dynamic_encoding {
+namespace {
+// Datatypes that are JSON arrays or objects, rather than scalars.
+bool IsScalar(zcl::DataType datatype) {
+  std::size_t type = (std::size_t)datatype;
+  if ((type >= (std::size_t)zcl::DataType::data8 &&
+       type <= (std::size_t)zcl::DataType::data64) ||
+      (type >= (std::size_t)zcl::DataType::map8 &&
+       type <= (std::size_t)zcl::DataType::map64)) {
+    return false;
+  }
+  switch (datatype) {
+    case zcl::DataType::octstr:
+    case zcl::DataType::octstr16:
+    case zcl::DataType::_struct:
+    case zcl::DataType::array:
+    case zcl::DataType::set:
+    case zcl::DataType::bag:
+      return false;
+    default:
+      return true;
+  }
+}
+
+/**
+ * Consumer of tao::json events for the arguments of a command. Values of
+ * unknown properties are skipped, like Encode does.
+ */
+class StreamingObjectEncoder {
+ public:
+  StreamingObjectEncoder(const Context& ctx, const EncodeIndex& index)
+      : ctx_(ctx),
+        index_(index),
+        depth_(0),
+        is_object_(false),
+        is_null_(false),
+        current_(kNone),
+        slots_(index.types.size(), Slot{kNone, 0}) {}
+
+  void null() { Scalar(tao::json::null); }
+  void boolean(const bool value) { Scalar(value); }
+  void number(const std::int64_t value) { Scalar(value); }
+  void number(const std::uint64_t value) { Scalar(value); }
+  void number(const double value) { Scalar(value); }
+  template <typename S>
+  void string(S&& value) {
+    Scalar(std::string(value.data(), value.size()));
+  }
+  template <typename B>
+  void binary(B&& value) {
+    throw std::runtime_error("Binary values are not supported");
+  }
+
+  void begin_array(const std::size_t size = 0) { BeginNested(); }
+  void element() {}
+  void end_array(const std::size_t size = 0) { depth_--; }
+
+  void begin_object(const std::size_t size = 0) {
+    if (depth_ == 0) {
+      is_object_ = true;
+      depth_++;
+      return;
+    }
+    BeginNested();
+  }
+  template <typename S>
+  void key(S&& name) {
+    if (depth_ != 1) {
+      return;
+    }
+    std::string key_name(name.data(), name.size());
+    auto found = std::lower_bound(
+        index_.by_name.begin(), index_.by_name.end(), key_name,
+        [](const std::pair<std::string, std::size_t>& entry,
+           const std::string& name) { return entry.first < name; });
+    if (found == index_.by_name.end() || found->first != key_name) {
+      current_ = kNone;
+      return;
+    }
+    current_ = found->second;
+    if (slots_[current_].offset != kNone) {
+      throw std::runtime_error("Duplicate property '" + key_name + "'");
+    }
+  }
+  void member() {}
+  void end_object(const std::size_t size = 0) { depth_--; }
+
+  void Finish(std::vector<uint8_t>& target) {
+    if (!is_object_) {
+      if (is_null_ && index_.types.empty()) {
+        // If this object type has no properties, null is also a valid value.
+        return;
+      }
+      throw std::runtime_error("Expected a JSON object");
+    }
+    for (std::size_t i = 0; i < index_.types.size(); i++) {
+      const Slot& slot = slots_[i];
+      if (slot.offset == kNone) {
+        Encode(ctx_, index_.types[i], tao::json::null, target);
+      } else {
+        target.insert(target.end(), buffer_.begin() + slot.offset,
+                      buffer_.begin() + slot.offset + slot.size);
+      }
+    }
+  }
+
+ private:
+  static constexpr std::size_t kNone = (std::size_t)-1;
+  struct Slot {
+    std::size_t offset;
+    std::size_t size;
+  };
+
+  void Scalar(const tao::json::value& value) {
+    if (depth_ == 0) {
+      if (value != tao::json::null) {
+        throw std::runtime_error("Expected a JSON object");
+      }
+      is_null_ = true;
+      return;
+    }
+    if (depth_ > 1 || current_ == kNone) {
+      return;
+    }
+    std::size_t offset = buffer_.size();
+    Encode(ctx_, index_.types[current_], value, buffer_);
+    slots_[current_] = Slot{offset, buffer_.size() - offset};
+  }
+
+  void BeginNested() {
+    if (depth_ == 0 || (depth_ == 1 && current_ != kNone)) {
+      throw std::runtime_error("Unexpected JSON array or object");
+    }
+    depth_++;
+  }
+
+  const Context& ctx_;
+  const EncodeIndex& index_;
+  std::size_t depth_;
+  bool is_object_;
+  bool is_null_;
+  std::size_t current_;
+  std::vector<Slot> slots_;
+  std::vector<uint8_t> buffer_;
+};
+constexpr std::size_t StreamingObjectEncoder::kNone;
+}  // namespace
+
+EncodeIndex CompileEncodeIndex(const ObjectType& object) {
+  EncodeIndex index{true, {}, {}};
+  for (const auto& property : object.properties) {
+    const zcl::DataType* datatype = boost::get<zcl::DataType>(&property.type);
+    if (!datatype || !IsScalar(*datatype)) {
+      return EncodeIndex{false, {}, {}};
+    }
+    index.by_name.emplace_back(property.name, index.types.size());
+    index.types.push_back(*datatype);
+  }
+  std::sort(index.by_name.begin(), index.by_name.end());
+  return index;
+}
+
+void EncodeFromString(const Context& ctx, const EncodeIndex& index,
+                      const std::string& json, std::vector<uint8_t>& target) {
+  if (!index.streamable) {
+    throw std::runtime_error("Type can not be encoded from a stream");
+  }
+  StreamingObjectEncoder encoder(ctx, index);
+  if (json.empty()) {
+    encoder.null();
+  } else {
+    tao::json::events::from_string(encoder, json);
+  }
+  encoder.Finish(target);
+}
+}  // namespace dynamic_encoding
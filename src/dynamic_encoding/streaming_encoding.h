@@ -0,0 +1,29 @@
+#ifndef _DYNAMIC_ENCODING_STREAMING_ENCODING_H_
+#define _DYNAMIC_ENCODING_STREAMING_ENCODING_H_
+#include <string>
+#include <utility>
+#include <vector>
+#include "dynamic_encoding/common.h"
+
+namespace dynamic_encoding {
+/**
+ * Properties of an object type, looked up by name when encoding straight from
+ * JSON text. Only streamable if every property is a scalar datatype, which
+ * holds for most cluster specific commands.
+ */
+struct EncodeIndex {
+  bool streamable;
+  std::vector<zcl::DataType> types;  // In encoding order
+  // Sorted by name, with the index into types.
+  std::vector<std::pair<std::string, std::size_t>> by_name;
+};
+
+EncodeIndex CompileEncodeIndex(const ObjectType& object);
+
+// Same result as parsing json and passing it to Encode, but without building a
+// tao::json::value: values are encoded as they are parsed, each into a slot of
+// its own, and the slots are joined in encoding order at the end.
+void EncodeFromString(const Context& ctx, const EncodeIndex& index,
+                      const std::string& json, std::vector<uint8_t>& target);
+}  // namespace dynamic_encoding
+#endif  // _DYNAMIC_ENCODING_STREAMING_ENCODING_H_
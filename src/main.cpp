@@ -8,25 +8,33 @@
 #include <boost/log/utility/setup/console.hpp>
 #include <boost/program_options.hpp>
 #include <iostream>
-#include <regex>
 #include <sstream>
+#include <stlab/concurrency/default_executor.hpp>
 #include <stlab/concurrency/future.hpp>
 #include <stlab/concurrency/immediate_executor.hpp>
 #include <stlab/concurrency/utility.hpp>
+#include <unordered_map>
 
 #include "asio_executor.h"
+#include "attribute_store.h"
 #include "clusterdb/cluster_db.h"
+#include "clusterdb/cluster_db_holder.h"
 #include "coro.h"
+#include "dynamic_encoding/decode_cache.h"
 #include "dynamic_encoding/decoding.h"
 #include "dynamic_encoding/encoding.h"
+#include "dynamic_encoding/streaming_encoding.h"
 #include "logging.h"
 #include "mqtt_wrapper.h"
 #include "string_enum.h"
+#include "topic_cache.h"
+#include "topic_router.h"
 #include "zcl/encoding.h"
 #include "zcl/zcl.h"
 #include "zcl/zcl_endpoint.h"
 #include "zcl/zcl_string_enum.h"
 #include "znp/encoding.h"
+#include "znp/znp_address_cache.h"
 #include "znp/znp_api.h"
 #include "znp/znp_port.h"
 
@@ -147,12 +155,91 @@ void OnPublishDirectJoin(std::shared_ptr<znp::ZnpApi> api,
   return;
 }
 
+const tao::json::value& JsonGetProperty(const tao::json::value& object,
+                                        const std::string& property) {
+  static tao::json::value not_found = tao::json::null;
+  if (!object.is_object()) {
+    return not_found;
+  }
+  const tao::json::value::object_t& object_map = object.get_object();
+  auto found = object_map.find(property);
+  if (found == object_map.end()) {
+    return not_found;
+  }
+  return found->second;
+}
+
+const tao::json::value::array_t& JsonAsArray(const tao::json::value& array) {
+  static tao::json::value::array_t empty{};
+  if (!array.is_array()) {
+    return empty;
+  }
+  return array.get_array();
+}
+
+/** Target of an outgoing command, either a single endpoint on a device, or all
+ * members of a group. */
+struct CommandDestination {
+  static CommandDestination Device(znp::IEEEAddress address,
+                                   std::uint8_t endpoint) {
+    return {false, address, endpoint, 0};
+  }
+  static CommandDestination Group(uint16_t group_id) {
+    return {true, 0, 0, group_id};
+  }
+
+  bool is_group;
+  znp::IEEEAddress address;
+  std::uint8_t endpoint;
+  uint16_t group_id;
+};
+
+std::ostream& operator<<(std::ostream& stream,
+                         const CommandDestination& destination) {
+  if (destination.is_group) {
+    return stream << "group " << destination.group_id;
+  }
+  return stream << boost::format("%016X") % destination.address
+                << ", endpoint " << (unsigned int)destination.endpoint;
+}
+
+/** Sends a Zigbee cluster library command with an already encoded payload. */
+void SendEncodedCommand(
+    std::shared_ptr<zcl::ZclEndpoint> endpoint,
+    const CommandDestination& destination,
+    std::shared_ptr<const clusterdb::ClusterInfo> cluster_info,
+    std::shared_ptr<const clusterdb::CommandInfo> command_info,
+    const std::vector<uint8_t>& payload) {
+  LOG("SendCommand", info) << "Encoded payload: "
+                           << boost::log::dump(payload.data(), payload.size());
+
+  stlab::future<void> sent;
+  if (destination.is_group) {
+    sent = endpoint->SendGroupCommand(
+        destination.group_id, cluster_info->id, command_info->is_global,
+        zcl::ZclDirection::ClientToServer, command_info->id, payload);
+  } else {
+    sent = endpoint->SendCommandExt(
+        destination.address, destination.endpoint, cluster_info->id,
+        command_info->is_global, zcl::ZclDirection::ClientToServer,
+        command_info->id, payload);
+  }
+  sent.recover([](auto f) {
+        try {
+          f.get_try();
+          LOG("SendCommand", info) << "Command sent";
+        } catch (const std::exception& ex) {
+          LOG("SendCommand", warning)
+              << "Exception while sending command: " << ex.what();
+        }
+      })
+      .detach();
+}
+
 /** Sends a Zigbee cluster library command. Expects cluster_id & command already
  * resolved, and the arguments already turned to a JSON array. */
-void SendCommand(std::shared_ptr<znp::ZnpApi> api,
-                 std::shared_ptr<zcl::ZclEndpoint> endpoint,
-                 znp::IEEEAddress destination_address,
-                 std::uint8_t destination_endpoint,
+void SendCommand(std::shared_ptr<zcl::ZclEndpoint> endpoint,
+                 const CommandDestination& destination,
                  std::shared_ptr<const clusterdb::ClusterInfo> cluster_info,
                  std::shared_ptr<const clusterdb::CommandInfo> command_info,
                  const tao::json::value& json_data) {
@@ -167,58 +254,100 @@ void SendCommand(std::shared_ptr<znp::ZnpApi> api,
         << ex.what();
     return;
   }
+  SendEncodedCommand(endpoint, destination, cluster_info, command_info,
+                     payload);
+}
 
-  LOG("SendCommand", info) << "Encoded payload: "
-                           << boost::log::dump(payload.data(), payload.size());
+/**
+ * Cluster and command info looked up by name, for one long-form command topic
+ * pattern. Only successful lookups are kept, so the size is bounded by the
+ * cluster database, which clears it when reloaded.
+ */
+class CommandLookupCache {
+ public:
+  struct Entry {
+    std::shared_ptr<const clusterdb::ClusterInfo> cluster_info;
+    std::shared_ptr<const clusterdb::CommandInfo> command_info;
+  };
 
-  LOG("SendCommand", info) << "Looking up Short Address from IEEE address";
-  api->UtilAddrmgrExtAddrLookup(destination_address)
-      .then([endpoint, destination_endpoint, cluster_info, command_info,
-             payload](znp::ShortAddress short_address) {
-        LOG("SendCommand", info) << "Response received, short address: "
-                                 << (unsigned int)short_address;
-        return endpoint->SendCommand(short_address, destination_endpoint,
-                                     cluster_info->id, command_info->is_global,
-                                     zcl::ZclDirection::ClientToServer,
-                                     command_info->id, payload);
-      })
-      .recover([](auto f) {
-        try {
-          f.get_try();
-          LOG("SendCommand", info) << "Command sent";
-        } catch (const std::exception& ex) {
-          LOG("SendCommand", warning)
-              << "Exception while sending command: " << ex.what();
-        }
-      })
-      .detach();
-}
+  const Entry* Find(const std::shared_ptr<clusterdb::ClusterDb>& cluster_db,
+                    const std::string& key) {
+    if (cluster_db_.lock() != cluster_db) {
+      entries_.clear();
+      cluster_db_ = cluster_db;
+      return nullptr;
+    }
+    auto found = entries_.find(key);
+    return found == entries_.end() ? nullptr : &found->second;
+  }
+
+  const Entry* Insert(const std::string& key, Entry entry) {
+    return &(entries_[key] = std::move(entry));
+  }
+
+ private:
+  std::weak_ptr<clusterdb::ClusterDb> cluster_db_;
+  std::unordered_map<std::string, Entry> entries_;
+};
 
 /** Called on MQTT publish of a long-form command, e.g. the command name is part
  * of the MQTT topic. */
-void OnPublishCommandLong(std::shared_ptr<znp::ZnpApi> api,
-                          std::shared_ptr<zcl::ZclEndpoint> endpoint,
+void OnPublishCommandLong(std::shared_ptr<zcl::ZclEndpoint> endpoint,
                           std::shared_ptr<clusterdb::ClusterDb> cluster_db,
-                          znp::IEEEAddress destination_address,
-                          std::uint8_t destination_endpoint,
+                          std::shared_ptr<CommandLookupCache> lookup_cache,
+                          CommandDestination destination,
                           std::string cluster_name, std::string command_name,
                           std::string message) {
   LOG("OnPublishCommandLong", debug)
-      << "Destination " << destination_address << ", endpoint "
-      << (unsigned int)destination_endpoint << ", cluster name '"
-      << cluster_name << "', command name '" << command_name << "'";
-  auto cluster_info = cluster_db->ClusterByName(cluster_name);
-  if (!cluster_info) {
-    LOG("OnPublishCommandLong", warning)
-        << "Unable to look up cluster info for '" << cluster_name << "'";
-    return;
+      << "Destination " << destination << ", cluster name '" << cluster_name
+      << "', command name '" << command_name << "'";
+  // Topic levels can't contain '/', so this can't be ambiguous.
+  std::string key = cluster_name + "/" + command_name;
+  const CommandLookupCache::Entry* resolved =
+      lookup_cache->Find(cluster_db, key);
+  if (!resolved) {
+    auto cluster_info = cluster_db->ClusterByName(cluster_name);
+    if (!cluster_info) {
+      LOG("OnPublishCommandLong", warning)
+          << "Unable to look up cluster info for '" << cluster_name << "'";
+      return;
+    }
+    auto command_info = cluster_db->CommandByName(
+        cluster_info->id, zcl::ZclDirection::ClientToServer, command_name);
+    if (!command_info) {
+      LOG("OnPublishCommandLong", warning)
+          << "Unable to look up command info for '" << command_name
+          << "' in cluster '" << cluster_name << "'";
+      return;
+    }
+    resolved = lookup_cache->Insert(
+        key, CommandLookupCache::Entry{
+                 std::shared_ptr<const clusterdb::ClusterInfo>(
+                     cluster_db, cluster_info.get_ptr()),
+                 std::shared_ptr<const clusterdb::CommandInfo>(
+                     cluster_db, command_info.get_ptr())});
   }
-  auto command_info = cluster_db->CommandByName(
-      cluster_info->id, zcl::ZclDirection::ClientToServer, command_name);
-  if (!command_info) {
-    LOG("OnPublishCommandLong", warning)
-        << "Unable to look up command info for '" << command_name
-        << "' in cluster '" << cluster_name << "'";
+  const std::shared_ptr<const clusterdb::ClusterInfo>& cluster_info_ptr =
+      resolved->cluster_info;
+  const std::shared_ptr<const clusterdb::CommandInfo>& command_info_ptr =
+      resolved->command_info;
+  const clusterdb::ClusterInfo* cluster_info = cluster_info_ptr.get();
+  const clusterdb::CommandInfo* command_info = command_info_ptr.get();
+  if (command_info->encode_index.streamable) {
+    // Encode straight from the message text, without a JSON DOM.
+    std::vector<uint8_t> payload;
+    try {
+      dynamic_encoding::Context ctx;
+      ctx.cluster = *cluster_info;
+      dynamic_encoding::EncodeFromString(ctx, command_info->encode_index,
+                                         message, payload);
+    } catch (const std::exception& ex) {
+      LOG("OnPublishCommandLong", error)
+          << "Unable to encode message payload: " << ex.what();
+      return;
+    }
+    SendEncodedCommand(endpoint, destination, cluster_info_ptr,
+                       command_info_ptr, payload);
     return;
   }
   tao::json::value json_data = tao::json::null;
@@ -232,26 +361,19 @@ void OnPublishCommandLong(std::shared_ptr<znp::ZnpApi> api,
     }
   }
 
-  SendCommand(api, endpoint, destination_address, destination_endpoint,
-              std::shared_ptr<const clusterdb::ClusterInfo>(
-                  cluster_db, cluster_info.get_ptr()),
-              std::shared_ptr<const clusterdb::CommandInfo>(
-                  cluster_db, command_info.get_ptr()),
+  SendCommand(endpoint, destination, cluster_info_ptr, command_info_ptr,
               json_data);
 }
 
 /** Called on MQTT publish of a short-form command, e.g. command name part of
  * the JSON payload. */
-void OnPublishCommandShort(std::shared_ptr<znp::ZnpApi> api,
-                           std::shared_ptr<zcl::ZclEndpoint> endpoint,
+void OnPublishCommandShort(std::shared_ptr<zcl::ZclEndpoint> endpoint,
                            std::shared_ptr<clusterdb::ClusterDb> cluster_db,
-                           znp::IEEEAddress destination_address,
-                           std::uint8_t destination_endpoint,
+                           CommandDestination destination,
                            std::string cluster_name, std::string message) {
-  LOG("OnPublishCommandShort", debug)
-      << "Destination " << destination_address << ", endpoint "
-      << (unsigned int)destination_endpoint << ", cluster name '"
-      << cluster_name << "'";
+  LOG("OnPublishCommandShort", debug) << "Destination " << destination
+                                      << ", cluster name '" << cluster_name
+                                      << "'";
   auto cluster_info = cluster_db->ClusterByName(cluster_name);
   if (!cluster_info) {
     LOG("OnPublishCommandShort", warning)
@@ -287,7 +409,7 @@ void OnPublishCommandShort(std::shared_ptr<znp::ZnpApi> api,
   if (found_arguments != obj_message.end()) {
     arguments = found_arguments->second;
   }
-  SendCommand(api, endpoint, destination_address, destination_endpoint,
+  SendCommand(endpoint, destination,
               std::shared_ptr<const clusterdb::ClusterInfo>(
                   cluster_db, cluster_info.get_ptr()),
               std::shared_ptr<const clusterdb::CommandInfo>(
@@ -295,6 +417,396 @@ void OnPublishCommandShort(std::shared_ptr<znp::ZnpApi> api,
               arguments);
 }
 
+/** Called on MQTT publish to add a device endpoint to, or remove it from, a
+ * group. Translated to the corresponding Groups cluster command. */
+void OnPublishGroupMembership(std::shared_ptr<zcl::ZclEndpoint> endpoint,
+                              std::shared_ptr<clusterdb::ClusterDb> cluster_db,
+                              CommandDestination destination,
+                              std::string action, std::string message) {
+  std::string command_name;
+  tao::json::value arguments = tao::json::null;
+  if (action == "remove_all") {
+    command_name = "Remove all groups";
+  } else {
+    std::size_t endpos;
+    unsigned long group_id = std::stoul(message, &endpos, 10);
+    if (endpos != message.size() || group_id > 0xFFFF) {
+      LOG("OnPublishGroupMembership", warning)
+          << "Unable to parse group id '" << message << "'";
+      return;
+    }
+    if (action == "add") {
+      command_name = "Add group";
+      arguments = {{"Group ID", group_id}, {"Group Name", ""}};
+    } else if (action == "remove") {
+      command_name = "Remove group";
+      arguments = {{"Group ID", group_id}};
+    } else {
+      LOG("OnPublishGroupMembership", warning)
+          << "Unknown group action '" << action << "'";
+      return;
+    }
+  }
+  const zcl::ZclClusterId groups_cluster_id = (zcl::ZclClusterId)0x0004;
+  auto cluster_info = cluster_db->ClusterById(groups_cluster_id);
+  if (!cluster_info) {
+    LOG("OnPublishGroupMembership", error)
+        << "Groups cluster missing from cluster info";
+    return;
+  }
+  auto command_info = cluster_db->CommandByName(
+      cluster_info->id, zcl::ZclDirection::ClientToServer, command_name);
+  if (!command_info) {
+    LOG("OnPublishGroupMembership", error)
+        << "Command '" << command_name << "' missing from cluster info";
+    return;
+  }
+  SendCommand(endpoint, destination,
+              std::shared_ptr<const clusterdb::ClusterInfo>(
+                  cluster_db, cluster_info.get_ptr()),
+              std::shared_ptr<const clusterdb::CommandInfo>(
+                  cluster_db, command_info.get_ptr()),
+              arguments);
+}
+
+void PublishResponse(std::shared_ptr<MqttWrapper> mqtt_wrapper,
+                     std::string topic, const tao::json::value& response) {
+  mqtt_wrapper
+      ->Publish(topic, tao::json::to_string(response),
+                mqtt::qos::at_least_once, false)
+      .recover([](auto f) {
+        try {
+          f.get_try();
+        } catch (const std::exception& ex) {
+          LOG("PublishResponse", warning) << "Publish failure: " << ex.what();
+        }
+      })
+      .detach();
+}
+
+/** Describes the response to a request in JSON, with the payload decoded if
+ * the command is known. */
+tao::json::value ResponseToJson(
+    std::shared_ptr<clusterdb::ClusterDb> cluster_db,
+    std::shared_ptr<const clusterdb::ClusterInfo> cluster_info,
+    const zcl::ZclEndpoint::Response& response) {
+  auto command_info = cluster_db->CommandById(
+      response.cluster_id, response.command_id, response.is_global_command,
+      response.direction);
+  if (!command_info) {
+    std::string payload(response.payload.begin(), response.payload.end());
+    return {{"command", (unsigned int)response.command_id},
+            {"payload", boost::algorithm::hex(payload)}};
+  }
+  dynamic_encoding::Context ctx;
+  ctx.cluster = *cluster_info;
+  auto parsed_until = response.payload.cbegin();
+  return {{"command", command_info->name},
+          {"payload",
+           dynamic_encoding::Decode(ctx, command_info->decode_plan,
+                                    parsed_until, response.payload.cend())}};
+}
+
+/** Called on MQTT publish to a request topic. Sends the command, and publishes
+ * its response, or the reason there is none, to the matching response topic.
+ * The "id" of the request is copied to the response, so they can be matched
+ * up. */
+void OnPublishRequest(std::shared_ptr<zcl::ZclEndpoint> endpoint,
+                      std::shared_ptr<znp::AddressCache> address_cache,
+                      std::shared_ptr<clusterdb::ClusterDb> cluster_db,
+                      std::shared_ptr<MqttWrapper> mqtt_wrapper,
+                      std::string response_topic,
+                      znp::IEEEAddress destination_address,
+                      std::uint64_t destination_endpoint,
+                      std::string cluster_name, std::string command_name,
+                      std::string message) {
+  tao::json::value request = tao::json::null;
+  if (message.size() > 0) {
+    try {
+      request = tao::json::from_string(message);
+    } catch (const std::exception& ex) {
+      LOG("OnPublishRequest", error)
+          << "Unable to decode message payload as JSON: " << ex.what();
+      return;
+    }
+  }
+  const tao::json::value id = JsonGetProperty(request, "id");
+  auto fail = [mqtt_wrapper, response_topic, id](std::string error) {
+    LOG("OnPublishRequest", warning) << error;
+    PublishResponse(mqtt_wrapper, response_topic,
+                    {{"id", id}, {"error", error}});
+  };
+  if (destination_endpoint > 0xFF) {
+    fail("Endpoint " + std::to_string(destination_endpoint) + " out of range");
+    return;
+  }
+
+  auto cluster_info = cluster_db->ClusterByName(cluster_name);
+  if (!cluster_info) {
+    fail("Unknown cluster '" + cluster_name + "'");
+    return;
+  }
+  auto command_info = cluster_db->CommandByName(
+      cluster_info->id, zcl::ZclDirection::ClientToServer, command_name);
+  if (!command_info) {
+    fail("Unknown command '" + command_name + "'");
+    return;
+  }
+  std::shared_ptr<const clusterdb::ClusterInfo> ptr_cluster_info(
+      cluster_db, cluster_info.get_ptr());
+  std::vector<uint8_t> payload;
+  try {
+    dynamic_encoding::Context ctx;
+    ctx.cluster = *cluster_info;
+    dynamic_encoding::Encode(ctx, command_info->data,
+                             JsonGetProperty(request, "arguments"), payload);
+  } catch (const std::exception& ex) {
+    fail(std::string("Unable to encode arguments: ") + ex.what());
+    return;
+  }
+  std::chrono::milliseconds timeout = std::chrono::seconds(5);
+  const tao::json::value& timeout_value = JsonGetProperty(request, "timeout");
+  if (timeout_value.is_unsigned()) {
+    timeout = std::chrono::milliseconds(timeout_value.get_unsigned());
+  }
+  // Left to the endpoint, which only repeats commands that are safe to.
+  boost::optional<unsigned int> retries;
+  const tao::json::value& retries_value = JsonGetProperty(request, "retries");
+  if (retries_value.is_unsigned()) {
+    retries = retries_value.get_unsigned();
+  }
+
+  // The short address is needed to tell the response apart from those of
+  // other devices.
+  address_cache->GetShortAddress(destination_address)
+      .then([endpoint, destination_address, destination_endpoint,
+             cluster_id = cluster_info->id, command_info, payload, timeout,
+             retries](znp::ShortAddress short_address) {
+        return endpoint->Request(destination_address, short_address,
+                                 destination_endpoint, cluster_id,
+                                 command_info->is_global,
+                                 zcl::ZclDirection::ClientToServer,
+                                 command_info->id, payload, timeout, retries);
+      })
+      .then([cluster_db,
+             ptr_cluster_info](const zcl::ZclEndpoint::Response& response) {
+        return ResponseToJson(cluster_db, ptr_cluster_info, response);
+      })
+      .recover([mqtt_wrapper, response_topic, id](auto f) {
+        try {
+          PublishResponse(mqtt_wrapper, response_topic,
+                          {{"id", id}, {"response", *f.get_try()}});
+        } catch (const std::exception& ex) {
+          LOG("OnPublishRequest", info) << "Request failed: " << ex.what();
+          PublishResponse(mqtt_wrapper, response_topic,
+                          {{"id", id}, {"error", ex.what()}});
+        }
+      })
+      .detach();
+}
+
+/** Looks up an attribute by name in the cluster, or takes it as a numeric
+ * attribute ID. */
+boost::optional<zcl::ZclAttributeId> AttributeIdFromJson(
+    const clusterdb::ClusterInfo& cluster_info,
+    const tao::json::value& attribute) {
+  if (attribute.is_string()) {
+    if (auto attribute_info =
+            cluster_info.attributes.FindByName(attribute.get_string())) {
+      return attribute_info->id;
+    }
+    return boost::none;
+  }
+  if (attribute.is_unsigned() && attribute.get_unsigned() <= 0xFFFF) {
+    return (zcl::ZclAttributeId)attribute.get_unsigned();
+  }
+  return boost::none;
+}
+
+/** If the command is a list of per-attribute records, with an attribId as
+ * first property, returns the type of a record. */
+const dynamic_encoding::ObjectType* PerAttributeRecordType(
+    const clusterdb::CommandInfo& command_info) {
+  if (command_info.data.properties.size() > 0) {
+    if (const auto* repeated_type =
+            boost::relaxed_get<dynamic_encoding::ArrayType>(
+                &command_info.data.properties[0].type)) {
+      if (const auto* repeated_object_type =
+              boost::relaxed_get<dynamic_encoding::ObjectType>(
+                  &repeated_type->element_type)) {
+        if (repeated_object_type->properties.size() >= 2 &&
+            repeated_object_type->properties[0].type ==
+                dynamic_encoding::AnyType(zcl::DataType::attribId)) {
+          return repeated_object_type;
+        }
+      }
+    }
+  }
+  return nullptr;
+}
+
+/** Takes the value of the attribute from the response to reading it, throwing
+ * the reason if there is none. */
+tao::json::value ReadAttributeValue(
+    const clusterdb::ClusterDb& cluster_db,
+    const clusterdb::ClusterInfo& cluster_info,
+    zcl::ZclAttributeId attribute_id,
+    const zcl::ZclEndpoint::Response& response) {
+  if (response.is_global_command &&
+      response.command_id == (zcl::ZclCommandId)0x0B &&
+      response.payload.size() >= 2) {
+    throw std::runtime_error(boost::str(
+        boost::format("Read failed with status 0x%02X") %
+        (unsigned int)response.payload[1]));
+  }
+  auto command_info = cluster_db.CommandById(
+      response.cluster_id, response.command_id, response.is_global_command,
+      response.direction);
+  const dynamic_encoding::ObjectType* record_type =
+      command_info ? PerAttributeRecordType(*command_info) : nullptr;
+  if (!response.is_global_command ||
+      response.command_id != (zcl::ZclCommandId)0x01 || !record_type) {
+    throw std::runtime_error("Unexpected response to Read Attributes");
+  }
+  dynamic_encoding::Context ctx;
+  ctx.cluster = cluster_info;
+  auto parsed_until = response.payload.cbegin();
+  tao::json::value decoded = dynamic_encoding::Decode(
+      ctx, command_info->decode_plan, parsed_until, response.payload.cend());
+  const tao::json::value::array_t& records = JsonAsArray(
+      JsonGetProperty(decoded, command_info->data.properties[0].name));
+  for (const auto& record : records) {
+    const tao::json::value& record_id =
+        JsonGetProperty(record, record_type->properties[0].name);
+    if (AttributeIdFromJson(cluster_info, record_id) != attribute_id) {
+      continue;
+    }
+    // Either {"success": value} or {"error": status}
+    const tao::json::value& result =
+        JsonGetProperty(record, record_type->properties[1].name);
+    const tao::json::value& value = JsonGetProperty(result, "success");
+    if (value == tao::json::null) {
+      throw std::runtime_error(
+          "Attribute could not be read: " +
+          tao::json::to_string(JsonGetProperty(result, "error")));
+    }
+    return value;
+  }
+  throw std::runtime_error("Attribute missing from the response");
+}
+
+tao::json::value AttributeValueToJson(const tao::json::value& id,
+                                      const AttributeStore::Entry& entry,
+                                      std::string source) {
+  auto age = std::chrono::duration_cast<std::chrono::milliseconds>(
+      AttributeStore::Clock::now() - entry.updated);
+  return {{"id", id},
+          {"value", tao::json::from_string(entry.value)},
+          {"age_ms", (uint64_t)age.count()},
+          {"linkquality", (unsigned int)entry.link_quality},
+          {"source", source}};
+}
+
+/** Called on MQTT publish to a get topic. Answers with the last known value of
+ * the attribute if it is recent enough, and reads it from the device
+ * otherwise. */
+void OnPublishGet(std::shared_ptr<zcl::ZclEndpoint> endpoint,
+                  std::shared_ptr<znp::AddressCache> address_cache,
+                  std::shared_ptr<clusterdb::ClusterDb> cluster_db,
+                  std::shared_ptr<AttributeStore> attribute_store,
+                  std::shared_ptr<MqttWrapper> mqtt_wrapper,
+                  std::string response_topic, znp::IEEEAddress address,
+                  std::uint64_t source_endpoint, std::string cluster_name,
+                  std::string attribute_name, std::string message) {
+  tao::json::value request = tao::json::null;
+  if (message.size() > 0) {
+    try {
+      request = tao::json::from_string(message);
+    } catch (const std::exception& ex) {
+      LOG("OnPublishGet", error)
+          << "Unable to decode message payload as JSON: " << ex.what();
+      return;
+    }
+  }
+  const tao::json::value id = JsonGetProperty(request, "id");
+  auto fail = [mqtt_wrapper, response_topic, id](std::string error) {
+    LOG("OnPublishGet", warning) << error;
+    PublishResponse(mqtt_wrapper, response_topic,
+                    {{"id", id}, {"error", error}});
+  };
+  if (source_endpoint > 0xFF) {
+    fail("Endpoint " + std::to_string(source_endpoint) + " out of range");
+    return;
+  }
+
+  auto cluster_info = cluster_db->ClusterByName(cluster_name);
+  if (!cluster_info) {
+    fail("Unknown cluster '" + cluster_name + "'");
+    return;
+  }
+  boost::optional<zcl::ZclAttributeId> attribute_id =
+      AttributeIdFromJson(*cluster_info, attribute_name);
+  if (!attribute_id) {
+    try {
+      std::size_t endpos;
+      unsigned long numeric_id = std::stoul(attribute_name, &endpos, 0);
+      if (endpos == attribute_name.size() && numeric_id <= 0xFFFF) {
+        attribute_id = (zcl::ZclAttributeId)numeric_id;
+      }
+    } catch (...) {
+    }
+  }
+  if (!attribute_id) {
+    fail("Unknown attribute '" + attribute_name + "'");
+    return;
+  }
+  AttributeStore::Key key{address, (std::uint8_t)source_endpoint,
+                          cluster_info->id, *attribute_id};
+  AttributeStore::Clock::duration max_age =
+      AttributeStore::Clock::duration::max();
+  const tao::json::value& max_age_value = JsonGetProperty(request, "max_age");
+  if (max_age_value.is_unsigned()) {
+    max_age = std::chrono::milliseconds(max_age_value.get_unsigned());
+  }
+  if (auto entry = attribute_store->Get(key, max_age)) {
+    PublishResponse(mqtt_wrapper, response_topic,
+                    AttributeValueToJson(id, *entry, "cache"));
+    return;
+  }
+
+  std::shared_ptr<const clusterdb::ClusterInfo> ptr_cluster_info(
+      cluster_db, cluster_info.get_ptr());
+  // Not known, or too old: read it. The reply is taken from the response
+  // itself, as storing it happens once its sender's IEEE address is known,
+  // which may well be after the request resolves.
+  address_cache->GetShortAddress(address)
+      .then([endpoint, address, source_endpoint, cluster_id = cluster_info->id,
+             attribute_id](znp::ShortAddress short_address) {
+        return endpoint->Request(address, short_address, source_endpoint,
+                                 cluster_id, true,
+                                 zcl::ZclDirection::ClientToServer,
+                                 (zcl::ZclCommandId)0x00,
+                                 znp::Encode(*attribute_id));
+      })
+      .recover([cluster_db, ptr_cluster_info, mqtt_wrapper, response_topic, id,
+                attribute_id](auto f) {
+        try {
+          const zcl::ZclEndpoint::Response& response = *f.get_try();
+          AttributeStore::Entry entry{
+              tao::json::to_string(ReadAttributeValue(
+                  *cluster_db, *ptr_cluster_info, *attribute_id, response)),
+              AttributeStore::Clock::now(), response.link_quality};
+          PublishResponse(mqtt_wrapper, response_topic,
+                          AttributeValueToJson(id, entry, "device"));
+        } catch (const std::exception& ex) {
+          LOG("OnPublishGet", info) << "Get failed: " << ex.what();
+          PublishResponse(mqtt_wrapper, response_topic,
+                          {{"id", id}, {"error", ex.what()}});
+        }
+      })
+      .detach();
+}
+
 void MakePrefixEndWithSlash(std::string &mqtt_prefix) {
   if (mqtt_prefix.size() > 0 && mqtt_prefix[mqtt_prefix.size() - 1] != '/') {
     mqtt_prefix += "/";
@@ -303,59 +815,165 @@ void MakePrefixEndWithSlash(std::string &mqtt_prefix) {
 
 const std::string controlTopic = "control/";
 
+/** {dec} takes any 64-bit number, while endpoints & group ids are narrower.
+ * Commands have no topic to reply on, so the rejection is only logged. */
+bool CheckRange(const char* what, std::uint64_t value, std::uint64_t max) {
+  if (value > max) {
+    LOG("OnPublish", warning) << what << " " << value << " out of range";
+    return false;
+  }
+  return true;
+}
+
+/** Sets up the handlers of all MQTT topics below the prefix. Each handler
+ * takes a snapshot of the cluster database when called, so reloads apply to
+ * the next message. */
+std::shared_ptr<TopicRouter> BuildTopicRouter(
+    std::shared_ptr<znp::ZnpApi> api,
+    std::shared_ptr<zcl::ZclEndpoint> endpoint,
+    std::shared_ptr<znp::AddressCache> address_cache,
+    std::shared_ptr<AttributeStore> attribute_store,
+    std::shared_ptr<MqttWrapper> mqtt_wrapper, std::string mqtt_prefix,
+    std::string instance_id,
+    std::shared_ptr<clusterdb::ClusterDbHolder> cluster_db_holder,
+    std::function<void()> reload_cluster_db) {
+  typedef TopicRouter::Match Match;
+  auto router = std::make_shared<TopicRouter>();
+  // The instance id is matched as literal levels, so may contain anything.
+  MakePrefixEndWithSlash(instance_id);
+  auto on_permitjoin = [api](const Match& match, const std::string& message) {
+    OnPublishPermitJoin(api, message);
+  };
+  router->Add(controlTopic + "permitjoin", on_permitjoin);
+  if (instance_id.size() > 0) {
+    router->Add(controlTopic + instance_id + "permitjoin", on_permitjoin);
+  }
+  router->Add(controlTopic + instance_id + "directjoin/{hex}",
+              [api](const Match& match, const std::string& message) {
+                OnPublishDirectJoin(api, match.number[0]);
+              });
+  auto on_reload = [reload_cluster_db](const Match& match,
+                                       const std::string& message) {
+    reload_cluster_db();
+  };
+  router->Add(controlTopic + "reload_clusters", on_reload);
+  if (instance_id.size() > 0) {
+    router->Add(controlTopic + instance_id + "reload_clusters", on_reload);
+  }
+
+  router->Add("group/{dec}/out/{name}",
+              [endpoint, cluster_db_holder](const Match& match,
+                                            const std::string& message) {
+                if (!CheckRange("Group id", match.number[0], 0xFFFF)) {
+                  return;
+                }
+                OnPublishCommandShort(
+                    endpoint, cluster_db_holder->Get(),
+                    CommandDestination::Group(match.number[0]),
+                    match.text[1].to_string(), message);
+              });
+  auto group_lookup_cache = std::make_shared<CommandLookupCache>();
+  router->Add("group/{dec}/out/{name}/{name}",
+              [endpoint, cluster_db_holder, group_lookup_cache](
+                  const Match& match, const std::string& message) {
+                if (!CheckRange("Group id", match.number[0], 0xFFFF)) {
+                  return;
+                }
+                OnPublishCommandLong(
+                    endpoint, cluster_db_holder->Get(), group_lookup_cache,
+                    CommandDestination::Group(match.number[0]),
+                    match.text[1].to_string(), match.text[2].to_string(),
+                    message);
+              });
+  router->Add("{hex}/{dec}/out/{name}",
+              [endpoint, cluster_db_holder](const Match& match,
+                                            const std::string& message) {
+                if (!CheckRange("Endpoint", match.number[1], 0xFF)) {
+                  return;
+                }
+                OnPublishCommandShort(
+                    endpoint, cluster_db_holder->Get(),
+                    CommandDestination::Device(match.number[0],
+                                               match.number[1]),
+                    match.text[2].to_string(), message);
+              });
+  auto device_lookup_cache = std::make_shared<CommandLookupCache>();
+  router->Add("{hex}/{dec}/out/{name}/{name}",
+              [endpoint, cluster_db_holder, device_lookup_cache](
+                  const Match& match, const std::string& message) {
+                if (!CheckRange("Endpoint", match.number[1], 0xFF)) {
+                  return;
+                }
+                OnPublishCommandLong(
+                    endpoint, cluster_db_holder->Get(), device_lookup_cache,
+                    CommandDestination::Device(match.number[0],
+                                               match.number[1]),
+                    match.text[2].to_string(), match.text[3].to_string(),
+                    message);
+              });
+  router->Add(
+      "{hex}/{dec}/request/{name}/{name}",
+      [endpoint, address_cache, cluster_db_holder, mqtt_wrapper, mqtt_prefix](
+          const Match& match, const std::string& message) {
+        OnPublishRequest(
+            endpoint, address_cache, cluster_db_holder->Get(), mqtt_wrapper,
+            boost::str(boost::format("%s%s/%s/response/%s/%s") % mqtt_prefix %
+                       match.text[0] % match.text[1] % match.text[2] %
+                       match.text[3]),
+            match.number[0], match.number[1], match.text[2].to_string(),
+            match.text[3].to_string(), message);
+      });
+  router->Add(
+      "{hex}/{dec}/get/{name}/{name}",
+      [endpoint, address_cache, cluster_db_holder, attribute_store,
+       mqtt_wrapper, mqtt_prefix](const Match& match,
+                                  const std::string& message) {
+        OnPublishGet(
+            endpoint, address_cache, cluster_db_holder->Get(),
+            attribute_store, mqtt_wrapper,
+            boost::str(boost::format("%s%s/%s/value/%s/%s") % mqtt_prefix %
+                       match.text[0] % match.text[1] % match.text[2] %
+                       match.text[3]),
+            match.number[0], match.number[1], match.text[2].to_string(),
+            match.text[3].to_string(), message);
+      });
+  for (std::string action : {"add", "remove", "remove_all"}) {
+    router->Add("{hex}/{dec}/groups/" + action,
+                [endpoint, cluster_db_holder, action](
+                    const Match& match, const std::string& message) {
+                  if (!CheckRange("Endpoint", match.number[1], 0xFF)) {
+                    return;
+                  }
+                  OnPublishGroupMembership(
+                      endpoint, cluster_db_holder->Get(),
+                      CommandDestination::Device(match.number[0],
+                                                 match.number[1]),
+                      action, message);
+                });
+  }
+  return router;
+}
+
 void OnPublish(std::shared_ptr<znp::ZnpApi> api,
-               std::shared_ptr<zcl::ZclEndpoint> endpoint,
-               std::string mqtt_prefix, std::string instance_id,
-               std::shared_ptr<clusterdb::ClusterDb> cluster_db,
+               std::shared_ptr<TopicRouter> router, std::string mqtt_prefix,
                std::string topic, std::string message, std::uint8_t qos,
                bool retain) {
+  // Requests coming in through MQTT are somebody waiting for a response, so
+  // let them skip ahead of background work.
+  znp::ZnpApi::PriorityScope priority(*api,
+                                      znp::ZnpApi::SReqPriority::Interactive);
   try {
     if (!boost::starts_with(topic, mqtt_prefix)) {
       LOG("OnPublish", debug)
           << "Ignoring publish not starting with our prefix";
       return;
     }
-    topic = topic.substr(mqtt_prefix.size());
-    std::smatch match;
-    if (boost::starts_with(topic, controlTopic)) {
-      topic = topic.substr(controlTopic.size());
-      MakePrefixEndWithSlash(instance_id);
-     
-      static std::regex re_write_permitjoin_g("permitjoin");
-      if (std::regex_match(topic, re_write_permitjoin_g)) {
-        OnPublishPermitJoin(api, message);
-        return;
-      }
-      static std::regex re_write_permitjoin(instance_id+"permitjoin");
-      if (std::regex_match(topic, re_write_permitjoin)) {
-        OnPublishPermitJoin(api, message);
-        return;
-      }
-      static std::regex re_write_directjoin(instance_id+"directjoin/([0-9a-fA-F]+)");
-      if (std::regex_match(topic, match, re_write_directjoin)) {
-        OnPublishDirectJoin(api, std::stoull(match[1], 0, 16));
-        return;
-      }
-      LOG("OnPublish", debug) << "Unhandled MQTT publish to " << topic << " in prefix " << mqtt_prefix + controlTopic;
-      return;
-    }
-    static std::regex re_command_short("([0-9a-fA-F]+)/([0-9]+)/out/([^/]+)");
-    if (std::regex_match(topic, match, re_command_short)) {
-      OnPublishCommandShort(api, endpoint, cluster_db,
-                            std::stoull(match[1], 0, 16),
-                            std::stoul(match[2], 0, 10), match[3], message);
-      return;
-    }
-
-    static std::regex re_command_long(
-        "([0-9a-fA-F]+)/([0-9]+)/out/([^/]+)/([^/]+)");
-    if (std::regex_match(topic, match, re_command_long)) {
-      OnPublishCommandLong(
-          api, endpoint, cluster_db, std::stoull(match[1], 0, 16),
-          std::stoul(match[2], 0, 10), match[3], match[4], message);
-      return;
+    boost::string_ref relative_topic(topic);
+    relative_topic.remove_prefix(mqtt_prefix.size());
+    if (!router->Route(relative_topic, message)) {
+      LOG("OnPublish", debug) << "Unhandled MQTT publish to " << relative_topic
+                              << " in prefix " << mqtt_prefix;
     }
-    LOG("OnPublish", debug) << "Unhandled MQTT publish to " << topic << " in prefix " << mqtt_prefix;
   } catch (const std::exception& ex) {
     LOG("OnPublish", debug) << "Exception: " << ex.what();
   }
@@ -445,14 +1063,17 @@ void OnEndDeviceAnnounce(std::shared_ptr<MqttWrapper> mqtt_wrapper,
 }
 
 void OnIncomingMsg(std::shared_ptr<znp::ZnpApi> api,
+                   std::shared_ptr<znp::AddressCache> address_cache,
                    std::shared_ptr<MqttWrapper> mqtt_wrapper,
-                   std::string mqtt_prefix, const znp::IncomingMsg& message) {
-  api->UtilAddrmgrNwkAddrLookup(message.SrcAddr)
-      .then([message, mqtt_wrapper, mqtt_prefix](znp::IEEEAddress ieee_addr) {
+                   std::shared_ptr<TopicCache> topic_cache,
+                   const znp::IncomingMsg& message) {
+  znp::ZnpApi::PriorityScope priority(*api,
+                                      znp::ZnpApi::SReqPriority::Background);
+  address_cache->GetIEEEAddress(message.SrcAddr)
+      .then([message, mqtt_wrapper, topic_cache](znp::IEEEAddress ieee_addr) {
         return mqtt_wrapper->Publish(
-            boost::str(boost::format("%s%016X/linkquality") % mqtt_prefix %
-                       ieee_addr),
-            boost::str(boost::format("%d") % (unsigned int)message.LinkQuality),
+            topic_cache->LinkQualityTopic(ieee_addr),
+            std::to_string((unsigned int)message.LinkQuality),
             mqtt::qos::at_least_once, false);
       })
       .recover([](auto f) {
@@ -466,38 +1087,45 @@ void OnIncomingMsg(std::shared_ptr<znp::ZnpApi> api,
       .detach();
 }
 
+/** Publishes a value that is already in JSON text form. */
+stlab::future<void> PublishText(std::shared_ptr<MqttWrapper> mqtt_wrapper,
+                                const TopicCache::Topic& topic,
+                                std::string text) {
+  LOG("PublishValue", info) << "Publishing to '" << *topic << "': " << text;
+  return mqtt_wrapper
+      ->Publish(topic, std::move(text), mqtt::qos::at_least_once, false)
+      .recover([](auto f) {
+        try {
+          f.get_try();
+        } catch (const std::exception& ex) {
+          LOG("PublishValue", warning)
+              << "Unable to publish to MQTT: " << ex.what();
+        }
+      });
+}
+
 stlab::future<void> PublishValue(std::shared_ptr<MqttWrapper> mqtt_wrapper,
-                                 const std::string& topic, bool recursive,
+                                 const TopicCache::Topic& topic, bool recursive,
                                  const tao::json::value& value) {
-  std::string value_as_string(tao::json::to_string(value));
-  LOG("PublishValue", info)
-      << "Publishing to '" << topic << "': " << value_as_string;
   std::vector<stlab::future<void>> futures;
   futures.push_back(
-      mqtt_wrapper
-          ->Publish(topic, value_as_string, mqtt::qos::at_least_once, false)
-          .recover([](auto f) {
-            try {
-              f.get_try();
-            } catch (const std::exception& ex) {
-              LOG("PublishValue", warning)
-                  << "Unable to publish to MQTT: " << ex.what();
-            }
-          }));
+      PublishText(mqtt_wrapper, topic, tao::json::to_string(value)));
   if (recursive) {
     if (value.is_object()) {
       const tao::json::value::object_t& object_value = value.get_object();
       for (const auto& item : object_value) {
         futures.push_back(PublishValue(
             mqtt_wrapper,
-            boost::str(boost::format("%s/%s") % topic % item.first), recursive,
-            item.second));
+            std::make_shared<const std::string>(*topic + "/" + item.first),
+            recursive, item.second));
       }
     } else if (value.is_array()) {
       const tao::json::value::array_t& array_value = value.get_array();
       for (std::size_t index = 0; index < array_value.size(); index++) {
         futures.push_back(PublishValue(
-            mqtt_wrapper, boost::str(boost::format("%s/%d") % topic % index),
+            mqtt_wrapper,
+            std::make_shared<const std::string>(*topic + "/" +
+                                                std::to_string(index)),
             recursive, array_value[index]));
       }
     }
@@ -511,93 +1139,185 @@ stlab::future<void> PublishValue(std::shared_ptr<MqttWrapper> mqtt_wrapper,
   }
 }
 
-const tao::json::value& JsonGetProperty(const tao::json::value& object,
-                                        const std::string& property) {
-  static tao::json::value not_found = tao::json::null;
-  if (!object.is_object()) {
-    return not_found;
-  }
-  const tao::json::value::object_t& object_map = object.get_object();
-  auto found = object_map.find(property);
-  if (found == object_map.end()) {
-    return not_found;
+std::string AttributeSubtopic(const tao::json::value& attribute_id) {
+  if (attribute_id.is_string()) {
+    return attribute_id.get_string();
+  } else if (attribute_id.is_unsigned()) {
+    return boost::str(boost::format("0x%04X") % attribute_id.get_unsigned());
+  } else {
+    return tao::json::to_string(attribute_id);
   }
-  return found->second;
 }
 
-const tao::json::value::array_t& JsonAsArray(const tao::json::value& array) {
-  static tao::json::value::array_t empty{};
-  if (!array.is_array()) {
-    return empty;
-  }
-  return array.get_array();
+/** Remembers an attribute value, as JSON text, from a report or read response.
+ * Expects the value already taken out of the "success" of a read response. */
+void StoreAttributeValue(AttributeStore& attribute_store,
+                         const clusterdb::ClusterInfo& cluster_info,
+                         znp::IEEEAddress source_address,
+                         uint8_t source_endpoint,
+                         zcl::ZclAttributeId attribute_id, std::string value,
+                         uint8_t link_quality) {
+  attribute_store.Update(
+      {source_address, source_endpoint, cluster_info.id, attribute_id},
+      std::move(value), link_quality);
 }
 
 void OnZclCommand(std::shared_ptr<MqttWrapper> mqtt_wrapper,
-                  std::string mqtt_prefix, bool mqtt_recursive_publish,
+                  std::shared_ptr<TopicCache> topic_cache,
+                  bool mqtt_recursive_publish,
+                  std::shared_ptr<AttributeStore> attribute_store,
+                  std::shared_ptr<dynamic_encoding::DecodeCache> decode_cache,
                   znp::IEEEAddress source_address, uint8_t source_endpoint,
+                  uint8_t link_quality, zcl::ZclDirection direction,
+                  std::uint64_t cluster_db_generation,
                   std::shared_ptr<const clusterdb::ClusterInfo> cluster_info,
                   std::shared_ptr<const clusterdb::CommandInfo> command_info,
                   std::vector<uint8_t> payload) {
-  std::string topic(boost::str(
-      boost::format("%s%016X/%d/in/%s/%s") % mqtt_prefix % source_address %
-      (unsigned int)source_endpoint % cluster_info->name % command_info->name));
+  TopicCache::CommandTopics& topics = topic_cache->Command(
+      source_address, source_endpoint, direction, *cluster_info,
+      *command_info, cluster_db_generation);
+  const TopicCache::Topic& topic = topics.topic;
+  const dynamic_encoding::ObjectType* record_type =
+      PerAttributeRecordType(*command_info);
+  if (record_type) {
+    LOG("OnZclCommand", info) << "Looks like something per-attribute. "
+                                 "Publishing per-attribute too";
+  }
+  // Values from Read Attributes Response & Report Attributes are remembered,
+  // so MQTT get requests can be answered without a read.
+  bool store_values = record_type && command_info->is_global &&
+                      (command_info->id == (zcl::ZclCommandId)0x01 ||
+                       command_info->id == (zcl::ZclCommandId)0x0A);
+  // Read responses wrap the value in "success" or "error", only successful
+  // reads are kept.
+  bool values_have_status =
+      record_type && record_type->properties.size() > 1 &&
+      boost::relaxed_get<dynamic_encoding::ErrorOrType>(
+          &record_type->properties[1].type) != nullptr;
+
   tao::json::value json_payload;
-  try {
-    dynamic_encoding::Context ctx;
-    ctx.cluster = *cluster_info;
-    auto parsed_until = payload.cbegin();
-    json_payload = dynamic_encoding::Decode(ctx, command_info->data,
-                                            parsed_until, payload.cend());
-    if (parsed_until != payload.cend()) {
-      LOG("OnZclCommand", warning) << "Not all data properly parsed";
+  // Only used from the IO thread, and reused to save on allocations.
+  static std::string text_payload;
+  text_payload.clear();
+  std::vector<dynamic_encoding::TextSpan> record_spans;
+  std::vector<boost::optional<zcl::ZclAttributeId>> record_attribute_ids;
+  std::size_t record_size = record_type ? record_type->properties.size() : 0;
+  // Repeated payloads are published from the decode cache. Not used for
+  // recursive publishing, which needs the decoded value rather than text.
+  std::string cache_key;
+  const dynamic_encoding::DecodeCache::Entry* cached = nullptr;
+  if (!mqtt_recursive_publish) {
+    cache_key = dynamic_encoding::DecodeCache::MakeKey(
+        cluster_db_generation, cluster_info->id, command_info->is_global,
+        direction, command_info->id, payload);
+    cached = decode_cache->Get(cache_key);
+  }
+  bool complete = cached ? cached->complete : true;
+  if (!cached) {
+    try {
+      dynamic_encoding::Context ctx;
+      ctx.cluster = *cluster_info;
+      auto parsed_until = payload.cbegin();
+      if (mqtt_recursive_publish) {
+        // Sub-topics are published from the decoded value
+        json_payload = dynamic_encoding::Decode(
+            ctx, command_info->decode_plan, parsed_until, payload.cend());
+      } else {
+        // Only JSON text is needed, so skip the tao::json::value in between.
+        dynamic_encoding::DecodeToText(
+            ctx, command_info->decode_plan, parsed_until, payload.cend(),
+            text_payload, record_type ? &record_spans : nullptr);
+        for (std::size_t index = 0; index + 1 < record_spans.size();
+             index += record_size) {
+          const auto& id_span = record_spans[index];
+          record_attribute_ids.push_back(AttributeIdFromJson(
+              *cluster_info,
+              tao::json::from_string(text_payload.substr(
+                  id_span.begin, id_span.end - id_span.begin))));
+        }
+      }
+      complete = parsed_until == payload.cend();
+    } catch (const std::exception& ex) {
+      LOG("OnZclCommand", warning)
+          << "Unable to decode command payload: " << ex.what();
+      return;
+    }
+    if (!mqtt_recursive_publish) {
+      decode_cache->Put(
+          std::move(cache_key),
+          dynamic_encoding::DecodeCache::Entry{
+              text_payload, record_spans, complete, record_attribute_ids});
     }
-  } catch (const std::exception& ex) {
-    LOG("OnZclCommand", warning)
-        << "Unable to decode command payload: " << ex.what();
-    return;
   }
-  std::vector<stlab::future<void>> futures;
-  futures.push_back(
-      PublishValue(mqtt_wrapper, topic, mqtt_recursive_publish, json_payload));
+  if (!complete) {
+    LOG("OnZclCommand", warning) << "Not all data properly parsed";
+  }
+  const std::string& text = cached ? cached->text : text_payload;
+  const std::vector<dynamic_encoding::TextSpan>& spans =
+      cached ? cached->record_spans : record_spans;
+  const std::vector<boost::optional<zcl::ZclAttributeId>>& attribute_ids =
+      cached ? cached->record_attribute_ids : record_attribute_ids;
 
-  // Is this a repeated object type, with attribId as first property?
-  if (command_info->data.properties.size() > 0) {
-    if (const auto* repeated_type =
-            boost::relaxed_get<dynamic_encoding::ArrayType>(
-                &command_info->data.properties[0].type)) {
-      if (const auto* repeated_object_type =
-              boost::relaxed_get<dynamic_encoding::ObjectType>(
-                  &repeated_type->element_type)) {
-        if (repeated_object_type->properties.size() >= 2 &&
-            repeated_object_type->properties[0].type ==
-                dynamic_encoding::AnyType(zcl::DataType::attribId)) {
-          LOG("OnZclCommand", info) << "Looks like something per-attribute. "
-                                       "Publishing per-attribute too";
-          // All checks succeeded, let's attempt to unpack the JSON!
-          const tao::json::value::array_t& reports =
-              JsonAsArray(JsonGetProperty(
-                  json_payload, command_info->data.properties[0].name));
-          for (const auto& report : reports) {
-            const tao::json::value& attribute_id = JsonGetProperty(
-                report, repeated_object_type->properties[0].name);
-            const tao::json::value& attribute_value = JsonGetProperty(
-                report, repeated_object_type->properties[1].name);
-            std::string subtopic;
-            if (attribute_id.is_string()) {
-              subtopic = attribute_id.get_string();
-            } else if (attribute_id.is_unsigned()) {
-              subtopic = boost::str(boost::format("0x%04X") %
-                                    attribute_id.get_unsigned());
-            } else {
-              subtopic = tao::json::to_string(attribute_id);
-            }
-            futures.push_back(PublishValue(mqtt_wrapper, topic + "/" + subtopic,
-                                           mqtt_recursive_publish,
-                                           attribute_value));
+  std::vector<stlab::future<void>> futures;
+  if (mqtt_recursive_publish) {
+    futures.push_back(PublishValue(mqtt_wrapper, topic, true, json_payload));
+    if (record_type) {
+      const tao::json::value::array_t& records = JsonAsArray(
+          JsonGetProperty(json_payload, command_info->data.properties[0].name));
+      for (const auto& record : records) {
+        const tao::json::value& attribute_id =
+            JsonGetProperty(record, record_type->properties[0].name);
+        const tao::json::value& attribute_value =
+            JsonGetProperty(record, record_type->properties[1].name);
+        const tao::json::value& stored_value =
+            values_have_status ? JsonGetProperty(attribute_value, "success")
+                               : attribute_value;
+        if (store_values && stored_value != tao::json::null) {
+          if (auto resolved_id =
+                  AttributeIdFromJson(*cluster_info, attribute_id)) {
+            StoreAttributeValue(*attribute_store, *cluster_info,
+                                source_address, source_endpoint, *resolved_id,
+                                tao::json::to_string(stored_value),
+                                link_quality);
           }
         }
+        futures.push_back(PublishValue(
+            mqtt_wrapper,
+            topic_cache->AttributeTopic(
+                topics, tao::json::to_string(attribute_id),
+                [&attribute_id]() { return AttributeSubtopic(attribute_id); }),
+            true, attribute_value));
+      }
+    }
+  } else {
+    futures.push_back(PublishText(mqtt_wrapper, topic, text));
+    for (std::size_t index = 0; index + 1 < spans.size();
+         index += record_size) {
+      const auto& id_span = spans[index];
+      const auto& value_span = spans[index + 1];
+      std::string attribute_id_text =
+          text.substr(id_span.begin, id_span.end - id_span.begin);
+      std::string attribute_value = text.substr(
+          value_span.begin, value_span.end - value_span.begin);
+      const auto& attribute_id = attribute_ids[index / record_size];
+      // An empty value is a read that failed.
+      if (store_values && attribute_id &&
+          value_span.value_end > value_span.value_begin) {
+        StoreAttributeValue(
+            *attribute_store, *cluster_info, source_address, source_endpoint,
+            *attribute_id,
+            text.substr(value_span.value_begin,
+                        value_span.value_end - value_span.value_begin),
+            link_quality);
       }
+      // The id is only parsed when its topic isn't known yet.
+      TopicCache::Topic attribute_topic = topic_cache->AttributeTopic(
+          topics, attribute_id_text, [&attribute_id_text]() {
+            return AttributeSubtopic(
+                tao::json::from_string(attribute_id_text));
+          });
+      futures.push_back(PublishText(mqtt_wrapper, attribute_topic,
+                                    std::move(attribute_value)));
     }
   }
 
@@ -613,10 +1333,15 @@ void OnZclCommand(std::shared_ptr<MqttWrapper> mqtt_wrapper,
 
 void OnZclCommand(std::shared_ptr<clusterdb::ClusterDb> cluster_db,
                   std::shared_ptr<znp::ZnpApi> api,
+                  std::shared_ptr<znp::AddressCache> address_cache,
                   std::shared_ptr<MqttWrapper> mqtt_wrapper,
-                  std::string mqtt_prefix, bool mqtt_recursive_publish,
+                  std::shared_ptr<TopicCache> topic_cache,
+                  bool mqtt_recursive_publish,
+                  std::shared_ptr<AttributeStore> attribute_store,
+                  std::shared_ptr<dynamic_encoding::DecodeCache> decode_cache,
                   znp::ShortAddress source_address, uint8_t source_endpoint,
-                  zcl::ZclClusterId cluster_id, bool is_global_command,
+                  uint8_t link_quality, zcl::ZclClusterId cluster_id,
+                  bool is_global_command,
                   zcl::ZclDirection direction, zcl::ZclCommandId command_id,
                   std::vector<uint8_t> payload) {
   auto cluster_info = cluster_db->ClusterById(cluster_id);
@@ -640,13 +1365,18 @@ void OnZclCommand(std::shared_ptr<clusterdb::ClusterDb> cluster_db,
   std::shared_ptr<const clusterdb::ClusterInfo> ptr_cluster_info(
       cluster_db, cluster_info.get_ptr());
 
-  api->UtilAddrmgrNwkAddrLookup(source_address)
-      .then([mqtt_wrapper, mqtt_prefix, mqtt_recursive_publish, source_endpoint,
+  znp::ZnpApi::PriorityScope priority(*api,
+                                      znp::ZnpApi::SReqPriority::Background);
+  address_cache->GetIEEEAddress(source_address)
+      .then([mqtt_wrapper, topic_cache, mqtt_recursive_publish,
+             attribute_store, decode_cache, source_endpoint, link_quality,
+             direction, generation = cluster_db->Generation(),
              ptr_cluster_info, ptr_command_info,
              payload](znp::IEEEAddress source_address) {
-        OnZclCommand(mqtt_wrapper, mqtt_prefix, mqtt_recursive_publish,
-                     source_address, source_endpoint, ptr_cluster_info,
-                     ptr_command_info, payload);
+        OnZclCommand(mqtt_wrapper, topic_cache, mqtt_recursive_publish,
+                     attribute_store, decode_cache, source_address,
+                     source_endpoint, link_quality, direction, generation,
+                     ptr_cluster_info, ptr_command_info, payload);
       })
       .recover([](auto f) {
         try {
@@ -660,13 +1390,66 @@ void OnZclCommand(std::shared_ptr<clusterdb::ClusterDb> cluster_db,
       .detach();
 }
 
+/** Publishes all attribute values restored from the snapshot, so consumers
+ * know the last state of sleepy devices right away. Not retained, as get
+ * replies on the same topics aren't either, and a retained snapshot would be
+ * handed to every later subscriber long after newer values came in. */
+void PublishRestoredAttributes(
+    std::shared_ptr<clusterdb::ClusterDb> cluster_db,
+    std::shared_ptr<AttributeStore> attribute_store,
+    std::shared_ptr<MqttWrapper> mqtt_wrapper, std::string mqtt_prefix) {
+  attribute_store->ForEach([&](const AttributeStore::Key& key,
+                               const AttributeStore::Entry& entry) {
+    auto cluster_info = cluster_db->ClusterById(key.cluster_id);
+    if (!cluster_info) {
+      return;
+    }
+    std::string attribute_name;
+    if (auto attribute_info =
+            cluster_info->attributes.FindById(key.attribute_id)) {
+      attribute_name = attribute_info->name;
+    } else {
+      attribute_name = boost::str(boost::format("0x%04X") %
+                                  (unsigned int)key.attribute_id);
+    }
+    tao::json::value value =
+        AttributeValueToJson(tao::json::null, entry, "snapshot");
+    value.get_object().erase("id");
+    mqtt_wrapper
+        ->Publish(boost::str(boost::format("%s%016X/%d/value/%s/%s") %
+                             mqtt_prefix % key.address %
+                             (unsigned int)key.endpoint % cluster_info->name %
+                             attribute_name),
+                  tao::json::to_string(value), mqtt::qos::at_least_once, false)
+        .recover([](auto f) {
+          try {
+            f.get_try();
+          } catch (const std::exception& ex) {
+            LOG("PublishRestoredAttributes", warning)
+                << "Publish failure: " << ex.what();
+          }
+        })
+        .detach();
+  });
+}
+
 std::shared_ptr<zcl::ZclEndpoint> Initialize(
-    coro::Await await, std::shared_ptr<znp::ZnpApi> api, uint16_t pan_id,
+    coro::Await await, std::shared_ptr<znp::ZnpApi> api,
+    std::shared_ptr<znp::AddressCache> address_cache,
+    std::shared_ptr<AttributeStore> attribute_store,
+    std::shared_ptr<dynamic_encoding::DecodeCache> decode_cache,
+    std::shared_ptr<TopicCache> topic_cache,
+    uint16_t pan_id,
     uint32_t chan_list, std::array<uint8_t, 16> presharedkey,
     std::shared_ptr<MqttWrapper> mqtt_wrapper,
     std::string mqtt_prefix, std::string instance_id, 
     bool mqtt_recursive_publish,
-    std::shared_ptr<clusterdb::ClusterDb> cluster_db) {
+    std::shared_ptr<clusterdb::ClusterDbHolder> cluster_db_holder,
+    std::function<void()> reload_cluster_db) {
+  // No need to wait for the dongle, the last known state can be published
+  // right away.
+  PublishRestoredAttributes(cluster_db_holder->Get(), attribute_store,
+                            mqtt_wrapper, mqtt_prefix);
   LOG("Initialize", debug) << "Doing initial reset (this may take up to a full "
                               "minute after a dongle power-cycle)";
   std::ignore = await(api->SysReset(true));
@@ -717,23 +1500,27 @@ std::shared_ptr<zcl::ZclEndpoint> Initialize(
   std::weak_ptr<znp::ZnpApi> weak_api(api);
 
   endpoint->on_command_.connect(
-      [cluster_db, weak_api, mqtt_wrapper, mqtt_prefix, mqtt_recursive_publish](
+      [cluster_db_holder, weak_api, address_cache, mqtt_wrapper, topic_cache,
+       mqtt_recursive_publish, attribute_store, decode_cache](
           znp::ShortAddress source_address, uint8_t source_endpoint,
-          zcl::ZclClusterId cluster_id, bool is_global_command,
-          zcl::ZclDirection direction, zcl::ZclCommandId command_id,
-          std::vector<uint8_t> payload) {
+          uint8_t link_quality, zcl::ZclClusterId cluster_id,
+          bool is_global_command, zcl::ZclDirection direction,
+          zcl::ZclCommandId command_id, std::vector<uint8_t> payload) {
         if (auto api = weak_api.lock()) {
-          OnZclCommand(cluster_db, api, mqtt_wrapper, mqtt_prefix,
-                       mqtt_recursive_publish, source_address, source_endpoint,
-                       cluster_id, is_global_command, direction, command_id,
+          OnZclCommand(cluster_db_holder->Get(), api, address_cache,
+                       mqtt_wrapper, topic_cache, mqtt_recursive_publish,
+                       attribute_store, decode_cache, source_address,
+                       source_endpoint, link_quality, cluster_id,
+                       is_global_command, direction, command_id,
                        std::move(payload));
         }
       });
 
   api->zdo_on_permit_join_.connect(std::bind(
       &OnPermitJoin, mqtt_wrapper, mqtt_prefix, instance_id, std::placeholders::_1));
-  api->af_on_incoming_msg_.connect(std::bind(
-      &OnIncomingMsg, api, mqtt_wrapper, mqtt_prefix, std::placeholders::_1));
+  api->af_on_incoming_msg_.connect(
+      std::bind(&OnIncomingMsg, api, address_cache, mqtt_wrapper, topic_cache,
+                std::placeholders::_1));
   api->zdo_on_trustcenter_device_.connect(
       std::bind(&OnTcDevice, mqtt_wrapper, mqtt_prefix, std::placeholders::_1,
                 std::placeholders::_2, std::placeholders::_3));
@@ -741,19 +1528,172 @@ std::shared_ptr<zcl::ZclEndpoint> Initialize(
       &OnEndDeviceAnnounce, mqtt_wrapper, mqtt_prefix, std::placeholders::_1,
       std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
 
-  mqtt_wrapper->on_publish_.connect(std::bind(
-      &OnPublish, api, endpoint, mqtt_prefix, instance_id, cluster_db, std::placeholders::_1,
-      std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+  auto router = BuildTopicRouter(api, endpoint, address_cache, attribute_store,
+                                 mqtt_wrapper, mqtt_prefix, instance_id,
+                                 cluster_db_holder, reload_cluster_db);
+  mqtt_wrapper->on_publish_.connect(
+      std::bind(&OnPublish, api, router, mqtt_prefix, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3,
+                std::placeholders::_4));
   await(mqtt_wrapper->Subscribe({
       {mqtt_prefix + controlTopic + "#", mqtt::qos::at_least_once},
+      // Also covers group/[group-id]/out/#
       {mqtt_prefix + "+/+/out/#", mqtt::qos::at_least_once},
+      {mqtt_prefix + "+/+/groups/#", mqtt::qos::at_least_once},
+      {mqtt_prefix + "+/+/request/#", mqtt::qos::at_least_once},
+      {mqtt_prefix + "+/+/get/#", mqtt::qos::at_least_once},
   }));
   return endpoint;
 }
 
+tao::json::value AddressCacheStatisticsToJson(
+    const znp::AddressCache::Statistics& statistics) {
+  return {{"entries", statistics.entries},
+          {"hits", statistics.hits},
+          {"misses", statistics.misses}};
+}
+
+tao::json::value DuplicateStatisticsToJson(
+    const zcl::DuplicateFilter::Statistics& statistics) {
+  return {{"entries", statistics.entries},
+          {"passed", statistics.passed},
+          {"suppressed", statistics.suppressed}};
+}
+
+tao::json::value DecodeCacheStatisticsToJson(
+    const dynamic_encoding::DecodeCache::Statistics& statistics) {
+  std::uint64_t lookups = statistics.hits + statistics.misses;
+  return {{"entries", statistics.entries},
+          {"bytes", statistics.bytes},
+          {"hits", statistics.hits},
+          {"misses", statistics.misses},
+          {"evictions", statistics.evictions},
+          {"hit_rate",
+           lookups > 0 ? (double)statistics.hits / lookups : 0.0}};
+}
+
+tao::json::value MqttSpoolStatisticsToJson(
+    const MqttSpool::Statistics& statistics) {
+  return {{"records", statistics.records},
+          {"bytes", statistics.bytes},
+          {"spooled", statistics.spooled},
+          {"drained", statistics.drained},
+          {"dropped", statistics.dropped}};
+}
+
+tao::json::value MqttStatisticsToJson(
+    const MqttWrapper::Statistics& statistics) {
+  tao::json::value json = {
+      {"queued", statistics.queued},
+      {"in_flight", statistics.in_flight},
+      {"acknowledged", statistics.acknowledged},
+      {"requeued", statistics.requeued},
+      {"last_ack_latency_ms", statistics.last_ack_latency.count()},
+      {"max_ack_latency_ms", statistics.max_ack_latency.count()},
+      {"average_ack_latency_ms",
+       statistics.acknowledged > 0
+           ? (double)statistics.total_ack_latency.count() /
+                 statistics.acknowledged
+           : 0.0},
+      {"reconnects", statistics.reconnects},
+      {"reconnect_attempts", statistics.reconnect_attempts},
+      {"last_reconnect_time_ms", statistics.last_reconnect_time.count()},
+      {"max_reconnect_time_ms", statistics.max_reconnect_time.count()},
+      {"average_reconnect_time_ms",
+       statistics.reconnects > 0
+           ? (double)statistics.total_reconnect_time.count() /
+                 statistics.reconnects
+           : 0.0}};
+  if (statistics.spool) {
+    json["spool"] = MqttSpoolStatisticsToJson(*statistics.spool);
+  }
+  return json;
+}
+
+tao::json::value SReqStatisticsToJson(
+    const znp::ZnpApi::SReqStatistics& statistics) {
+  return {
+      {"queue_depth",
+       {{"interactive",
+         statistics.queue_depth[(std::size_t)
+                                    znp::ZnpApi::SReqPriority::Interactive]},
+        {"normal",
+         statistics.queue_depth[(std::size_t)
+                                    znp::ZnpApi::SReqPriority::Normal]},
+        {"background",
+         statistics.queue_depth[(std::size_t)
+                                    znp::ZnpApi::SReqPriority::Background]}}},
+      {"in_flight", statistics.in_flight},
+      {"completed", statistics.completed},
+      {"timeouts", statistics.timeouts},
+      {"last_wait_ms", statistics.last_wait.count()},
+      {"max_wait_ms", statistics.max_wait.count()},
+      {"average_wait_ms",
+       statistics.completed > 0
+           ? (double)statistics.total_wait.count() / statistics.completed
+           : 0.0}};
+}
+
+/** Periodically publishes internal statistics to the report/statistics topic.
+ */
+void PublishStatistics(std::shared_ptr<boost::asio::deadline_timer> timer,
+                       boost::posix_time::time_duration interval,
+                       std::shared_ptr<znp::ZnpApi> api,
+                       std::shared_ptr<znp::AddressCache> address_cache,
+                       std::shared_ptr<dynamic_encoding::DecodeCache>
+                           decode_cache,
+                       std::shared_ptr<zcl::ZclEndpoint> endpoint,
+                       std::shared_ptr<MqttWrapper> mqtt_wrapper,
+                       std::string mqtt_prefix) {
+  const tao::json::value statistics = {
+      {"sreq", SReqStatisticsToJson(api->GetSReqStatistics())},
+      {"address_cache",
+       AddressCacheStatisticsToJson(address_cache->GetStatistics())},
+      {"duplicates",
+       DuplicateStatisticsToJson(endpoint->GetDuplicateStatistics())},
+      {"decode_cache",
+       DecodeCacheStatisticsToJson(decode_cache->GetStatistics())},
+      {"mqtt", MqttStatisticsToJson(mqtt_wrapper->GetStatistics())}};
+  mqtt_wrapper
+      ->Publish(mqtt_prefix + "report/statistics",
+                tao::json::to_string(statistics), mqtt::qos::at_most_once,
+                false)
+      .recover([](auto f) {
+        try {
+          f.get_try();
+        } catch (const std::exception& ex) {
+          LOG("PublishStatistics", debug) << "Publish failure: " << ex.what();
+        }
+      })
+      .detach();
+  timer->expires_from_now(interval);
+  timer->async_wait([timer, interval, api, address_cache, decode_cache,
+                     endpoint, mqtt_wrapper,
+                     mqtt_prefix](const boost::system::error_code& ec) {
+    if (!ec) {
+      PublishStatistics(timer, interval, api, address_cache, decode_cache,
+                        endpoint, mqtt_wrapper, mqtt_prefix);
+    }
+  });
+}
+
+/** Periodically writes changes to disk, e.g. of attribute values or known
+ * addresses. */
+void SavePeriodically(std::shared_ptr<boost::asio::deadline_timer> timer,
+                      boost::posix_time::time_duration interval,
+                      std::function<void()> save) {
+  save();
+  timer->expires_from_now(interval);
+  timer->async_wait(
+      [timer, interval, save](const boost::system::error_code& ec) {
+        if (!ec) {
+          SavePeriodically(timer, interval, save);
+        }
+      });
+}
+
 void OnFrameDebug(std::string prefix, znp::ZnpCommandType cmdtype,
-                  znp::ZnpCommand command,
-                  const std::vector<uint8_t>& payload) {
+                  znp::ZnpCommand command, znp::ByteSpan payload) {
   LOG("FRAME", debug) << prefix << " " << cmdtype << " " << command << " "
                       << boost::log::dump(payload.data(), payload.size());
 }
@@ -763,6 +1703,65 @@ std::string MakeNameSafeForMqtt(std::string name) {
   return std::string(name.begin(), new_end);
 }
 
+/** Parses the cluster info file again, off the IO thread, and only swaps it in
+ * if it was valid. Messages already being handled finish on the old one. */
+void ReloadClusterDb(
+    boost::asio::io_service& io_service,
+    std::shared_ptr<clusterdb::ClusterDbHolder> cluster_db,
+    std::shared_ptr<dynamic_encoding::DecodeCache> decode_cache,
+    std::shared_ptr<TopicCache> topic_cache, std::string cluster_info_file) {
+  if (cluster_info_file.empty()) {
+    LOG("ReloadClusterDb", warning)
+        << "Using built-in cluster information, start with --cluster-info to "
+           "be able to reload";
+    return;
+  }
+  LOG("ReloadClusterDb", info) << "Reloading '" << cluster_info_file << "'";
+  stlab::async(stlab::default_executor,
+               [cluster_info_file]() {
+                 auto reloaded = std::make_shared<clusterdb::ClusterDb>();
+                 if (!reloaded->ParseFromFile(cluster_info_file,
+                                              MakeNameSafeForMqtt)) {
+                   throw std::runtime_error("Unable to parse '" +
+                                            cluster_info_file + "'");
+                 }
+                 return reloaded;
+               })
+      .then(AsioExecutor(io_service),
+            [cluster_db, decode_cache,
+             topic_cache](std::shared_ptr<clusterdb::ClusterDb> reloaded) {
+              cluster_db->Set(reloaded);
+              // Cached texts were decoded with, and topics named after, the
+              // old definitions. Messages still being handled with those put
+              // theirs back under the old generation, which the new one
+              // doesn't find.
+              decode_cache->Clear();
+              topic_cache->Clear();
+              LOG("ReloadClusterDb", info) << "Cluster information reloaded";
+            })
+      .recover([](auto f) {
+        try {
+          f.get_try();
+        } catch (const std::exception& ex) {
+          LOG("ReloadClusterDb", error)
+              << "Keeping current cluster information: " << ex.what();
+        }
+      })
+      .detach();
+}
+
+/** Reloads the cluster info file on every SIGHUP. */
+void ReloadOnSignal(std::shared_ptr<boost::asio::signal_set> signals,
+                    std::function<void()> reload_cluster_db) {
+  signals->async_wait([signals, reload_cluster_db](
+                          const boost::system::error_code& ec, int signal) {
+    if (!ec) {
+      reload_cluster_db();
+      ReloadOnSignal(signals, reload_cluster_db);
+    }
+  });
+}
+
 int main(int argc, const char** argv) {
   // Set up logging to console (stderr)
   auto console_log = boost::log::add_console_log(std::cerr);
@@ -793,6 +1792,32 @@ int main(int argc, const char** argv) {
     ("topic,t",
      boost::program_options::value<std::string>()->default_value("AqaraHub"),
      "MQTT Root topic, e.g. AqaraHub")
+    ("mqtt-max-in-flight",
+     boost::program_options::value<std::size_t>()->default_value(20),
+     "Maximum number of QoS 1 & 2 publishes waiting for the MQTT server to acknowledge them, further publishes are queued. 0 for no limit")
+    ("mqtt-reconnect-delay",
+     boost::program_options::value<unsigned int>()->default_value(1000),
+     "Time in milliseconds to wait at most before the second attempt to reconnect to the MQTT server, the first is made right away. The limit doubles with every further attempt")
+    ("mqtt-reconnect-max-delay",
+     boost::program_options::value<unsigned int>()->default_value(60000),
+     "Time in milliseconds to wait at most between attempts to reconnect to the MQTT server")
+    ("mqtt-persistent-session",
+     "Ask the MQTT server to keep subscriptions and unacknowledged publishes while disconnected, rather than starting a clean session on every connection")
+    ("mqtt-spool",
+     boost::program_options::value<std::string>()->default_value(""),
+     "File to spool publishes to while the MQTT server can't be reached, so they are sent once it can, even after a restart. Segments are stored next to it as FILE.1, FILE.2, ... Empty to keep them in memory")
+    ("mqtt-spool-max-size",
+     boost::program_options::value<std::size_t>()->default_value(64),
+     "Maximum size of the MQTT spool in MiB, the oldest publishes are dropped beyond that")
+    ("mqtt-spool-max-age",
+     boost::program_options::value<unsigned int>()->default_value(24 * 60 * 60),
+     "Time in seconds after which spooled publishes are no longer sent")
+    ("mqtt-spool-latest-only",
+     boost::program_options::value<std::vector<std::string>>()->composing(),
+     "MQTT topic filter, e.g. AqaraHub/+/linkquality, for which only the latest spooled publish of each topic is sent. May be given more than once")
+    ("mqtt-spool-skip",
+     boost::program_options::value<std::vector<std::string>>()->composing(),
+     "MQTT topic filter for which publishes are dropped rather than spooled. report/statistics never is. May be given more than once")
     ("instance-id,i",
      boost::program_options::value<std::string>()->default_value(""),
      "Allows multiple sticks to share the same MQTT Root topic by separating only the control commands, but leaving publishing as if one stick.")
@@ -806,13 +1831,40 @@ int main(int argc, const char** argv) {
      boost::program_options::value<std::string>(),
      "Zigbee Network pre-shared key in hexadecimal notation, maximum of 16 bytes (32 hex characters), will be padded with 0-bytes.")
     ("cluster-info",
-     boost::program_options::value<std::string>()->default_value("../clusters.info"),
-     "Boost property-tree info file containing cluster, attribute, and command information")
+     boost::program_options::value<std::string>()->default_value(""),
+     "Boost property-tree info file containing cluster, attribute, and command information. Empty to use the definitions built in from clusters.info")
     ("recursive-publish",
      "Recursively publish object properties and array elements to sub-topics")
     ("channelmask,c",
      boost::program_options::value<std::string>()->default_value("0x0800"),
      "Allowed channel mask. Bit 0 channel 1 to bit 31 channel 32, i.e. channel 11 - 0x0800, channel 26 = 0x04000000")
+    ("sreq-timeout",
+     boost::program_options::value<unsigned int>()->default_value(5000),
+     "Time in milliseconds to wait for the ZNP dongle to respond to a request")
+    ("af-window",
+     boost::program_options::value<unsigned int>()->default_value(4),
+     "Maximum number of outgoing messages the ZNP dongle is handling at once")
+    ("af-confirm-timeout",
+     boost::program_options::value<unsigned int>()->default_value(10000),
+     "Time in milliseconds to wait for an outgoing message to be confirmed")
+    ("znp-max-write-size",
+     boost::program_options::value<std::size_t>()->default_value(1024),
+     "Maximum number of bytes of queued frames to write to the serial port at once. A single frame is always written whole, so 1 writes every frame separately")
+    ("address-cache",
+     boost::program_options::value<std::string>()->default_value("addresses.cache"),
+     "File to store known network & IEEE addresses in, so they don't have to be looked up again after a restart. Empty to disable")
+    ("attribute-snapshot",
+     boost::program_options::value<std::string>()->default_value("attributes.snapshot"),
+     "File to store the last known attribute values in, so they can be republished after a restart. Empty to disable")
+    ("attribute-snapshot-interval",
+     boost::program_options::value<unsigned int>()->default_value(60),
+     "Interval in seconds at which changed attribute values are written to the snapshot file")
+    ("decode-cache-size",
+     boost::program_options::value<std::size_t>()->default_value(256 * 1024),
+     "Maximum number of bytes of decoded payloads to remember, so reports repeating the same bytes are not decoded again. 0 to disable")
+    ("statistics-interval",
+     boost::program_options::value<unsigned int>()->default_value(0),
+     "Interval in seconds at which to publish statistics to report/statistics, 0 to disable")
     ;
   // clang-format on
   boost::program_options::variables_map variables;
@@ -837,12 +1889,23 @@ int main(int argc, const char** argv) {
 
   // Read cluster, command, & attribute names
   auto cluster_db = std::make_shared<clusterdb::ClusterDb>();
-  if (!cluster_db->ParseFromFile(variables["cluster-info"].as<std::string>(),
-                                 MakeNameSafeForMqtt)) {
-    LOG("Main", critical) << "Unable to read '"
-                          << variables["cluster-info"].as<std::string>()
-                          << "' for cluster information";
-    return EXIT_FAILURE;
+  std::string cluster_info_file = variables["cluster-info"].as<std::string>();
+  const clusterdb::tables::Tables* builtin_tables = clusterdb::BuiltinTables();
+  if (cluster_info_file.empty() && builtin_tables) {
+    if (!cluster_db->LoadFromTables(*builtin_tables, MakeNameSafeForMqtt)) {
+      LOG("Main", critical) << "Unable to load built-in cluster information";
+      return EXIT_FAILURE;
+    }
+  } else {
+    if (cluster_info_file.empty()) {
+      // Built without generated tables
+      cluster_info_file = "../clusters.info";
+    }
+    if (!cluster_db->ParseFromFile(cluster_info_file, MakeNameSafeForMqtt)) {
+      LOG("Main", critical) << "Unable to read '" << cluster_info_file
+                            << "' for cluster information";
+      return EXIT_FAILURE;
+    }
   }
 
   // Start working
@@ -850,7 +1913,9 @@ int main(int argc, const char** argv) {
   boost::asio::io_service::work work(io_service);
 
   LOG("Main", info) << "Setting up ZNP connection";
-  auto port = std::make_shared<znp::ZnpPort>(io_service, serial_port);
+  auto port = std::make_shared<znp::ZnpPort>(
+      io_service, serial_port,
+      variables["znp-max-write-size"].as<std::size_t>());
   port->on_frame_.connect(std::bind(OnFrameDebug, "<<", std::placeholders::_1,
                                     std::placeholders::_2,
                                     std::placeholders::_3));
@@ -858,14 +1923,88 @@ int main(int argc, const char** argv) {
                                    std::placeholders::_2,
                                    std::placeholders::_3));
   auto api = std::make_shared<znp::ZnpApi>(io_service, port);
+  api->SetSReqTimeout(
+      std::chrono::milliseconds(variables["sreq-timeout"].as<unsigned int>()));
+  api->SetAfDataRequestWindow(variables["af-window"].as<unsigned int>());
+  api->SetAfDataConfirmTimeout(std::chrono::milliseconds(
+      variables["af-confirm-timeout"].as<unsigned int>()));
+  auto address_cache = std::make_shared<znp::AddressCache>(
+      api, variables["address-cache"].as<std::string>());
+  SavePeriodically(std::make_shared<boost::asio::deadline_timer>(io_service),
+                   boost::posix_time::seconds(5),
+                   [address_cache]() { address_cache->Save(); });
+  auto attribute_store = std::make_shared<AttributeStore>(
+      variables["attribute-snapshot"].as<std::string>());
+  SavePeriodically(std::make_shared<boost::asio::deadline_timer>(io_service),
+                   boost::posix_time::seconds(std::max(
+                       1u, variables["attribute-snapshot-interval"]
+                               .as<unsigned int>())),
+                   [attribute_store]() { attribute_store->Save(); });
+
+  std::string mqtt_prefix = variables["topic"].as<std::string>();
+  MakePrefixEndWithSlash(mqtt_prefix);
+
+  auto decode_cache = std::make_shared<dynamic_encoding::DecodeCache>(
+      variables["decode-cache-size"].as<std::size_t>());
+  auto topic_cache = std::make_shared<TopicCache>(mqtt_prefix);
+
+  auto cluster_db_holder =
+      std::make_shared<clusterdb::ClusterDbHolder>(cluster_db);
+  // Empty if the built-in tables are used, which can't change.
+  std::function<void()> reload_cluster_db = [&io_service, cluster_db_holder,
+                                             decode_cache, topic_cache,
+                                             cluster_info_file]() {
+    ReloadClusterDb(io_service, cluster_db_holder, decode_cache, topic_cache,
+                    cluster_info_file);
+  };
+  ReloadOnSignal(
+      std::make_shared<boost::asio::signal_set>(io_service, SIGHUP),
+      reload_cluster_db);
 
   std::string instance_id = variables["instance-id"].as<std::string>();
 
   LOG("Main", info) << "Setting up MQTT connection";
   std::shared_ptr<MqttWrapper> mqtt_wrapper;
   try {
+    MqttWrapper::Options mqtt_options;
+    mqtt_options.max_in_flight =
+        variables["mqtt-max-in-flight"].as<std::size_t>();
+    mqtt_options.reconnect_delay = std::chrono::milliseconds(
+        variables["mqtt-reconnect-delay"].as<unsigned int>());
+    mqtt_options.reconnect_max_delay = std::chrono::milliseconds(
+        variables["mqtt-reconnect-max-delay"].as<unsigned int>());
+    mqtt_options.clean_session =
+        (variables.count("mqtt-persistent-session") == 0);
+    std::string spool_file = variables["mqtt-spool"].as<std::string>();
+    if (!spool_file.empty()) {
+      MqttSpool::Options spool_options;
+      spool_options.filename = spool_file;
+      spool_options.max_bytes =
+          variables["mqtt-spool-max-size"].as<std::size_t>() * 1024 * 1024;
+      spool_options.max_age = std::chrono::seconds(
+          variables["mqtt-spool-max-age"].as<unsigned int>());
+      spool_options.policies.emplace_back(mqtt_prefix + "report/statistics",
+                                          MqttSpool::Policy::Drop);
+      if (variables.count("mqtt-spool-skip")) {
+        for (const auto& filter :
+             variables["mqtt-spool-skip"].as<std::vector<std::string>>()) {
+          spool_options.policies.emplace_back(filter, MqttSpool::Policy::Drop);
+        }
+      }
+      if (variables.count("mqtt-spool-latest-only")) {
+        for (const auto& filter : variables["mqtt-spool-latest-only"]
+                                      .as<std::vector<std::string>>()) {
+          spool_options.policies.emplace_back(filter,
+                                              MqttSpool::Policy::KeepLatest);
+        }
+      }
+      LOG("Main", info) << "Spooling MQTT publishes to '" << spool_file
+                        << "' while disconnected";
+      mqtt_options.spool = std::make_shared<MqttSpool>(spool_options);
+    }
     mqtt_wrapper =
-        MqttWrapper::FromUrl(io_service, variables["mqtt"].as<std::string>(), instance_id);
+        MqttWrapper::FromUrl(io_service, variables["mqtt"].as<std::string>(),
+                             instance_id, mqtt_options);
   } catch (const std::exception& ex) {
     std::cerr << ex.what() << std::endl;
     return EXIT_FAILURE;
@@ -873,13 +2012,14 @@ int main(int argc, const char** argv) {
   if (instance_id.size() > 0)
     LOG("Main", info) << "Instance id '" << instance_id << "'";
 
-  std::string mqtt_prefix = variables["topic"].as<std::string>();
-  MakePrefixEndWithSlash(mqtt_prefix);
   LOG("Main", info) << "Using MQTT prefix '" << mqtt_prefix << "'";
 
   bool mqtt_recursive_publish = (variables.count("recursive-publish") > 0);
   LOG("Main", info) << "Recursively publishing object and array properties";
 
+  unsigned int statistics_interval =
+      variables["statistics-interval"].as<unsigned int>();
+
   // Creating pre-shared-key
   std::array<uint8_t, 16> presharedkey;
   presharedkey.fill(0);
@@ -931,16 +2071,33 @@ int main(int argc, const char** argv) {
   int exit_code = EXIT_SUCCESS;
   auto endpoint =
       coro::Run(
-          AsioExecutor(io_service), Initialize, api,
+          AsioExecutor(io_service), Initialize, api, address_cache,
+          attribute_store, decode_cache, topic_cache,
           variables["panid"].as<uint16_t>(),
           std::stoul(variables["channelmask"].as<std::string>(), nullptr, 0) &
               CHANNEL_ALL_MASK,
           presharedkey, mqtt_wrapper,
           mqtt_prefix, instance_id,
           mqtt_recursive_publish,
-          cluster_db)
-          .then([](auto r) {
+          cluster_db_holder, reload_cluster_db)
+          .then([&io_service, statistics_interval, api, address_cache,
+                 decode_cache, mqtt_wrapper, mqtt_prefix](auto r) {
             LOG("Main", info) << "Initialization complete!";
+            if (statistics_interval > 0) {
+              auto interval = boost::posix_time::seconds(statistics_interval);
+              auto timer =
+                  std::make_shared<boost::asio::deadline_timer>(io_service);
+              timer->expires_from_now(interval);
+              timer->async_wait([timer, interval, api, address_cache,
+                                 decode_cache, r, mqtt_wrapper, mqtt_prefix](
+                                    const boost::system::error_code& ec) {
+                if (!ec) {
+                  PublishStatistics(timer, interval, api, address_cache,
+                                    decode_cache, r, mqtt_wrapper,
+                                    mqtt_prefix);
+                }
+              });
+            }
             return r;
           })
           .recover([&io_service, &exit_code](auto f) {
@@ -963,8 +2120,21 @@ int main(int argc, const char** argv) {
     io_service.stop();
   });
 
+  // Stop on SIGINT & SIGTERM rather than being killed, so what is only in
+  // memory yet gets saved below.
+  boost::asio::signal_set stop_signals(io_service, SIGINT, SIGTERM);
+  stop_signals.async_wait(
+      [&io_service](const boost::system::error_code& ec, int signal) {
+        if (!ec) {
+          LOG("Main", info) << "Stopping on signal " << signal;
+          io_service.stop();
+        }
+      });
+
   std::cout << "IO Service starting" << std::endl;
   io_service.run();
   std::cout << "IO Service done" << std::endl;
+  attribute_store->Save();
+  address_cache->Save();
   return exit_code;
 }
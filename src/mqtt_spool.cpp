@@ -0,0 +1,534 @@
+#include "mqtt_spool.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <boost/crc.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include "logging.h"
+
+namespace {
+// Body length & CRC-32 of the body
+const std::size_t kRecordHeaderSize = 4 + 4;
+// Time in ms, QoS, retain, topic length
+const std::size_t kBodyHeaderSize = 8 + 1 + 1 + 2;
+
+void PutUint(std::vector<uint8_t>& target, uint64_t value, std::size_t size) {
+  for (std::size_t i = 0; i < size; i++) {
+    target.push_back((uint8_t)(value >> (8 * i)));
+  }
+}
+
+uint64_t GetUint(const uint8_t* data, std::size_t size) {
+  uint64_t value = 0;
+  for (std::size_t i = 0; i < size; i++) {
+    value |= ((uint64_t)data[i]) << (8 * i);
+  }
+  return value;
+}
+
+uint32_t Crc(const uint8_t* data, std::size_t size) {
+  boost::crc_32_type crc;
+  crc.process_bytes(data, size);
+  return crc.checksum();
+}
+
+bool ReadFrom(const std::string& filename, std::uint64_t offset,
+              std::vector<uint8_t>& data) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  file.seekg(offset);
+  data.insert(data.end(), std::istreambuf_iterator<char>(file),
+              std::istreambuf_iterator<char>());
+  return true;
+}
+
+// Size of the complete & intact record at data, or 0 if there is none.
+std::size_t RecordSize(const uint8_t* data, std::size_t available) {
+  if (available < kRecordHeaderSize) {
+    return 0;
+  }
+  std::size_t length = GetUint(data, 4);
+  if (length < kBodyHeaderSize ||
+      available - kRecordHeaderSize < length ||
+      Crc(data + kRecordHeaderSize, length) != GetUint(data + 4, 4)) {
+    return 0;
+  }
+  const uint8_t* body = data + kRecordHeaderSize;
+  if (GetUint(body + 10, 2) > length - kBodyHeaderSize) {
+    return 0;
+  }
+  return kRecordHeaderSize + length;
+}
+
+MqttSpool::Record DecodeRecord(const uint8_t* data, std::size_t size) {
+  const uint8_t* body = data + kRecordHeaderSize;
+  std::size_t topic_length = GetUint(body + 10, 2);
+  const char* topic = (const char*)body + kBodyHeaderSize;
+  const char* end = (const char*)data + size;
+  std::chrono::milliseconds time(GetUint(body, 8));
+  return MqttSpool::Record{std::string(topic, topic_length),
+                           std::string(topic + topic_length, end),
+                           (uint8_t)body[8], body[9] != 0,
+                           MqttSpool::Clock::time_point(time), 0};
+}
+
+std::string TopicOf(const uint8_t* data) {
+  const uint8_t* body = data + kRecordHeaderSize;
+  return std::string((const char*)body + kBodyHeaderSize,
+                     GetUint(body + 10, 2));
+}
+
+bool WriteAll(int fd, const uint8_t* data, std::size_t size) {
+  std::size_t written = 0;
+  while (written < size) {
+    ssize_t result = ::write(fd, data + written, size - written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      return false;
+    }
+    written += result;
+  }
+  return true;
+}
+
+bool WriteFileSynced(const std::string& filename, const std::string& data) {
+  int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = WriteAll(fd, (const uint8_t*)data.data(), data.size()) &&
+                 ::fsync(fd) == 0;
+  return ::close(fd) == 0 && written;
+}
+
+std::string DirectoryOf(const std::string& filename) {
+  std::size_t slash = filename.rfind('/');
+  if (slash == std::string::npos) {
+    return ".";
+  }
+  return slash == 0 ? "/" : filename.substr(0, slash);
+}
+
+std::string BaseNameOf(const std::string& filename) {
+  std::size_t slash = filename.rfind('/');
+  return slash == std::string::npos ? filename : filename.substr(slash + 1);
+}
+
+// So a rename in it survives a crash.
+bool SyncDirectoryOf(const std::string& filename) {
+  int fd = ::open(DirectoryOf(filename).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool synced = ::fsync(fd) == 0;
+  ::close(fd);
+  return synced;
+}
+}  // namespace
+
+MqttSpool::MqttSpool(Options options)
+    : options_(std::move(options)),
+      write_fd_(-1),
+      dirty_(false),
+      read_number_(0),
+      read_base_(0),
+      read_offset_(0),
+      read_records_(0),
+      records_(0),
+      bytes_(0),
+      spooled_(0),
+      drained_(0),
+      dropped_(0) {
+  std::uint64_t first = 0;
+  std::uint64_t offset = 0;
+  bool have_cursor = false;
+  {
+    std::ifstream cursor(options_.filename + ".cursor");
+    if (cursor) {
+      have_cursor = !!(cursor >> first >> offset);
+      if (!have_cursor) {
+        LOG("MqttSpool", warning) << options_.filename
+                                  << ".cursor is invalid, sending all of "
+                                     "the spool again";
+      }
+    }
+  }
+  // Without a cursor, the spool starts at whichever segment is left first.
+  for (std::uint64_t number : ListSegments()) {
+    if (have_cursor && number < first) {
+      // Drained, but removing it was cut short.
+      std::remove(SegmentFilename(number).c_str());
+      continue;
+    }
+    segments_.push_back(Segment{number, 0, 0});
+    Scan(segments_.back(), have_cursor && number == first ? offset : 0);
+  }
+  if (segments_.empty() || !have_cursor || segments_.front().number != first) {
+    offset = 0;
+  }
+  if (records_ > 0) {
+    LOG("MqttSpool", info) << records_ << " publishes left in "
+                           << options_.filename << " to be sent";
+  }
+  StartSegment();
+  StartReading(segments_.front().number);
+  read_base_ = read_offset_ = offset;
+}
+
+MqttSpool::~MqttSpool() {
+  Sync();
+  if (write_fd_ >= 0) {
+    ::close(write_fd_);
+  }
+}
+
+bool MqttSpool::Append(const std::string& topic, const std::string& message,
+                       std::uint8_t qos, bool retain, Clock::time_point now) {
+  Policy policy = PolicyFor(topic);
+  if (policy == Policy::Drop || topic.size() > 0xFFFF) {
+    dropped_++;
+    return false;
+  }
+  std::vector<uint8_t> record(kRecordHeaderSize);
+  PutUint(record,
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              now.time_since_epoch())
+              .count(),
+          8);
+  PutUint(record, qos, 1);
+  PutUint(record, retain ? 1 : 0, 1);
+  PutUint(record, topic.size(), 2);
+  record.insert(record.end(), topic.begin(), topic.end());
+  record.insert(record.end(), message.begin(), message.end());
+  std::size_t length = record.size() - kRecordHeaderSize;
+  std::vector<uint8_t> header;
+  PutUint(header, length, 4);
+  PutUint(header, Crc(record.data() + kRecordHeaderSize, length), 4);
+  std::copy(header.begin(), header.end(), record.begin());
+
+  if (segments_.back().bytes > 0 &&
+      segments_.back().bytes + record.size() > options_.segment_bytes) {
+    StartSegment();
+  }
+  Segment& segment = segments_.back();
+  if (!WriteAll(write_fd_, record.data(), record.size())) {
+    std::string error = std::strerror(errno);
+    LOG("MqttSpool", warning) << "Unable to write to spool: " << error;
+    // Don't leave a partial record for the next one to be appended to.
+    if (::ftruncate(write_fd_, segment.bytes) != 0) {
+      StartSegment();
+    }
+    dropped_++;
+    throw std::runtime_error("Unable to write to spool: " + error);
+  }
+  if (policy == Policy::KeepLatest) {
+    latest_[topic] = (segment.number << 32) | segment.bytes;
+  }
+  segment.bytes += record.size();
+  segment.records++;
+  bytes_ += record.size();
+  records_++;
+  spooled_++;
+  dirty_ = true;
+  while (bytes_ > options_.max_bytes && segments_.size() > 1) {
+    DropOldestSegment();
+  }
+  return true;
+}
+
+boost::optional<MqttSpool::Record> MqttSpool::Next(Clock::time_point now) {
+  while (records_ > 0) {
+    std::size_t position = read_offset_ - read_base_;
+    std::size_t size = RecordSize(read_buffer_.data() + position,
+                                  read_buffer_.size() - position);
+    if (size == 0) {
+      if (ReadMore()) {
+        continue;
+      }
+      if (read_number_ == segments_.back().number) {
+        // Only the segment being written is left, and it has been read up
+        // to where it was written.
+        break;
+      }
+      // Done with this segment, or the rest of it is damaged.
+      auto segment = FindSegment(read_number_);
+      std::size_t unread = segment->records - read_records_;
+      records_ -= unread;
+      dropped_ += unread;
+      dirty_ = true;
+      StartReading((segment + 1)->number);
+      RemoveDrainedSegments();
+      continue;
+    }
+    const uint8_t* data = read_buffer_.data() + position;
+    Position location = (read_number_ << 32) | read_offset_;
+    read_offset_ += size;
+    read_records_++;
+    records_--;
+    dirty_ = true;
+    Record record = DecodeRecord(data, size);
+    if (PolicyFor(record.topic) == Policy::KeepLatest) {
+      auto found = latest_.find(record.topic);
+      if (found != latest_.end()) {
+        if (found->second != location) {
+          // A later value of this topic is still to come.
+          dropped_++;
+          continue;
+        }
+        latest_.erase(found);
+      }
+    }
+    if (now - record.time > options_.max_age) {
+      dropped_++;
+      continue;
+    }
+    record.position = location;
+    unacknowledged_.insert(location);
+    drained_++;
+    return record;
+  }
+  return boost::none;
+}
+
+void MqttSpool::Acknowledge(Position position) {
+  if (unacknowledged_.erase(position) == 0) {
+    return;
+  }
+  dirty_ = true;
+  RemoveDrainedSegments();
+}
+
+bool MqttSpool::Empty() const { return records_ == 0; }
+
+void MqttSpool::Sync() {
+  if (!dirty_) {
+    return;
+  }
+  if (write_fd_ >= 0 && ::fsync(write_fd_) != 0) {
+    LOG("MqttSpool", warning) << "Unable to sync spool: "
+                              << std::strerror(errno);
+  }
+  WriteCursor();
+  dirty_ = false;
+}
+
+MqttSpool::Statistics MqttSpool::GetStatistics() const {
+  return Statistics{records_, bytes_, spooled_, drained_, dropped_};
+}
+
+bool MqttSpool::TopicMatches(const std::string& filter,
+                             const std::string& topic) {
+  std::size_t filter_start = 0;
+  std::size_t topic_start = 0;
+  while (true) {
+    std::size_t filter_end = filter.find('/', filter_start);
+    std::size_t topic_end = topic.find('/', topic_start);
+    if (filter.compare(filter_start, filter_end - filter_start, "#") == 0) {
+      return true;
+    }
+    if (filter.compare(filter_start, filter_end - filter_start, "+") != 0 &&
+        filter.compare(filter_start, filter_end - filter_start, topic,
+                       topic_start, topic_end - topic_start) != 0) {
+      return false;
+    }
+    if (topic_end == std::string::npos) {
+      // "a/#" also matches "a"
+      return filter_end == std::string::npos ||
+             filter.compare(filter_end + 1, std::string::npos, "#") == 0;
+    }
+    if (filter_end == std::string::npos) {
+      return false;
+    }
+    filter_start = filter_end + 1;
+    topic_start = topic_end + 1;
+  }
+}
+
+MqttSpool::Policy MqttSpool::PolicyFor(const std::string& topic) const {
+  for (const auto& policy : options_.policies) {
+    if (TopicMatches(policy.first, topic)) {
+      return policy.second;
+    }
+  }
+  return Policy::KeepAll;
+}
+
+std::string MqttSpool::SegmentFilename(std::uint64_t number) const {
+  return options_.filename + "." + std::to_string(number);
+}
+
+std::vector<std::uint64_t> MqttSpool::ListSegments() const {
+  std::vector<std::uint64_t> numbers;
+  std::string prefix = BaseNameOf(options_.filename) + ".";
+  DIR* dir = ::opendir(DirectoryOf(options_.filename).c_str());
+  if (dir == nullptr) {
+    return numbers;
+  }
+  while (struct dirent* entry = ::readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.size() <= prefix.size() || name.size() > prefix.size() + 19 ||
+        name.compare(0, prefix.size(), prefix) != 0 ||
+        name.find_first_not_of("0123456789", prefix.size()) !=
+            std::string::npos) {
+      continue;
+    }
+    numbers.push_back(std::stoull(name.substr(prefix.size())));
+  }
+  ::closedir(dir);
+  std::sort(numbers.begin(), numbers.end());
+  return numbers;
+}
+
+std::deque<MqttSpool::Segment>::iterator MqttSpool::FindSegment(
+    std::uint64_t number) {
+  // Numbers only go up, but a restart can leave gaps.
+  return std::lower_bound(
+      segments_.begin(), segments_.end(), number,
+      [](const Segment& segment, std::uint64_t number) {
+        return segment.number < number;
+      });
+}
+
+void MqttSpool::Scan(Segment& segment, std::uint64_t start) {
+  std::vector<uint8_t> data;
+  ReadFrom(SegmentFilename(segment.number), 0, data);
+  segment.bytes = data.size();
+  bytes_ += data.size();
+  std::size_t position = start;
+  while (position < data.size()) {
+    std::size_t size =
+        RecordSize(data.data() + position, data.size() - position);
+    if (size == 0) {
+      LOG("MqttSpool", warning)
+          << SegmentFilename(segment.number) << " is damaged at offset "
+          << position << ", skipping the rest of it";
+      break;
+    }
+    std::string topic = TopicOf(data.data() + position);
+    if (PolicyFor(topic) == Policy::KeepLatest) {
+      latest_[topic] = (segment.number << 32) | position;
+    }
+    segment.records++;
+    position += size;
+  }
+  records_ += segment.records;
+}
+
+void MqttSpool::StartSegment() {
+  std::uint64_t number = 1;
+  if (!segments_.empty()) {
+    number = segments_.back().number + 1;
+  }
+  if (write_fd_ >= 0) {
+    ::fsync(write_fd_);
+    ::close(write_fd_);
+  }
+  std::string filename = SegmentFilename(number);
+  write_fd_ = ::open(filename.c_str(),
+                     O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (write_fd_ < 0) {
+    throw std::runtime_error("Unable to open " + filename + ": " +
+                             std::strerror(errno));
+  }
+  segments_.push_back(Segment{number, 0, 0});
+}
+
+void MqttSpool::DropOldestSegment() {
+  std::uint64_t number = segments_.front().number;
+  std::size_t unread = 0;
+  if (number == read_number_) {
+    unread = segments_.front().records - read_records_;
+    records_ -= unread;
+    dropped_ += unread;
+    StartReading(segments_[1].number);
+  }
+  // Whatever of it is still waiting for the server is gone as well.
+  std::size_t unacknowledged = std::distance(
+      unacknowledged_.begin(), unacknowledged_.lower_bound((number + 1) << 32));
+  unacknowledged_.erase(unacknowledged_.begin(),
+                        unacknowledged_.lower_bound((number + 1) << 32));
+  for (auto it = latest_.begin(); it != latest_.end();) {
+    if ((it->second >> 32) == number) {
+      it = latest_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  LOG("MqttSpool", warning) << "Spool is full, dropping "
+                            << unread + unacknowledged << " publishes";
+  RemoveSegment();
+}
+
+void MqttSpool::RemoveDrainedSegments() {
+  while (segments_.front().number < read_number_ &&
+         (unacknowledged_.empty() ||
+          *unacknowledged_.begin() >= (segments_.front().number + 1) << 32)) {
+    RemoveSegment();
+  }
+}
+
+void MqttSpool::RemoveSegment() {
+  std::string filename = SegmentFilename(segments_.front().number);
+  bytes_ -= segments_.front().bytes;
+  segments_.pop_front();
+  // Move the cursor past the segment first, so it isn't sent again if
+  // removing it is cut short.
+  WriteCursor();
+  std::remove(filename.c_str());
+}
+
+void MqttSpool::StartReading(std::uint64_t number) {
+  read_number_ = number;
+  read_buffer_.clear();
+  read_base_ = read_offset_ = 0;
+  read_records_ = 0;
+}
+
+bool MqttSpool::ReadMore() {
+  read_buffer_.erase(read_buffer_.begin(),
+                     read_buffer_.begin() + (read_offset_ - read_base_));
+  read_base_ = read_offset_;
+  std::size_t before = read_buffer_.size();
+  ReadFrom(SegmentFilename(read_number_), read_base_ + read_buffer_.size(),
+           read_buffer_);
+  return read_buffer_.size() > before;
+}
+
+MqttSpool::Position MqttSpool::CursorPosition() const {
+  if (!unacknowledged_.empty()) {
+    return *unacknowledged_.begin();
+  }
+  return (read_number_ << 32) | read_offset_;
+}
+
+void MqttSpool::WriteCursor() {
+  std::string filename = options_.filename + ".cursor";
+  std::string temp_filename = filename + ".tmp";
+  Position position = CursorPosition();
+  if (!WriteFileSynced(temp_filename,
+                       std::to_string(position >> 32) + " " +
+                           std::to_string(position & 0xFFFFFFFF) + "\n")) {
+    LOG("MqttSpool", warning) << "Unable to write " << temp_filename << ": "
+                              << std::strerror(errno);
+    return;
+  }
+  if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    LOG("MqttSpool", warning) << "Unable to rename " << temp_filename << " to "
+                              << filename;
+    return;
+  }
+  if (!SyncDirectoryOf(filename)) {
+    LOG("MqttSpool", warning) << "Unable to sync the directory of " << filename;
+  }
+}
@@ -0,0 +1,135 @@
+#ifndef _MQTT_SPOOL_H_
+#define _MQTT_SPOOL_H_
+#include <boost/optional.hpp>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Publishes that can't be sent to the MQTT server yet, kept on disk so that
+ * neither a long outage nor a restart loses them, and memory use stays flat.
+ *
+ * Records are appended to numbered segment files, {filename}.{number}, which
+ * are deleted once drained. Every start writes to a new segment, so a record
+ * torn by a crash is never appended to. Appends are only made durable by
+ * Sync(), so a burst of reports costs one fsync rather than one each. How far
+ * draining got is kept in {filename}.cursor, also written by Sync(). It only
+ * moves up to the oldest record drained but not acknowledged yet, so records
+ * the server hasn't confirmed, or acknowledged after the last Sync(), are
+ * drained again after a restart.
+ *
+ * Limits apply to the spool as a whole: once the segments take up more than
+ * max_bytes, the oldest segment is dropped, and records older than max_age are
+ * skipped when draining. Per class of topic, given as MQTT topic filters, the
+ * policy can be to only keep the latest value of each topic, or to not spool
+ * at all, e.g. for statistics which are stale by the time they're drained.
+ */
+class MqttSpool {
+ public:
+  // Wall clock, as record times have to survive restarts.
+  typedef std::chrono::system_clock Clock;
+  enum class Policy { KeepAll, KeepLatest, Drop };
+  struct Options {
+    std::string filename;
+    std::size_t max_bytes = 64 * 1024 * 1024;
+    Clock::duration max_age = std::chrono::hours(24);
+    std::size_t segment_bytes = 1024 * 1024;
+    // First matching filter wins, KeepAll if none match.
+    std::vector<std::pair<std::string, Policy>> policies;
+  };
+  // Where a record is, (segment number << 32) | offset in the segment.
+  typedef std::uint64_t Position;
+  struct Record {
+    std::string topic;
+    std::string message;
+    std::uint8_t qos;
+    bool retain;
+    Clock::time_point time;
+    Position position;
+  };
+  struct Statistics {
+    std::size_t records;  // Still to be drained, including superseded ones
+    std::size_t bytes;
+    std::uint64_t spooled;
+    std::uint64_t drained;
+    // By policy, size or age limit
+    std::uint64_t dropped;
+  };
+
+  // Picks up the segments left by a previous run. Throws if the spool can't
+  // be written to.
+  explicit MqttSpool(Options options);
+  ~MqttSpool();
+  MqttSpool(const MqttSpool&) = delete;
+  MqttSpool& operator=(const MqttSpool&) = delete;
+
+  // Returns false if the policy for the topic is to drop it. Throws if the
+  // record can't be written.
+  bool Append(const std::string& topic, const std::string& message,
+              std::uint8_t qos, bool retain,
+              Clock::time_point now = Clock::now());
+  // The oldest record not drained yet, skipping superseded & expired ones.
+  // It stays in the spool until acknowledged.
+  boost::optional<Record> Next(Clock::time_point now = Clock::now());
+  // Once the server has the record. Positions no longer in the spool, e.g.
+  // because their segment was dropped in the mean time, are ignored.
+  void Acknowledge(Position position);
+  bool Empty() const;
+  void Sync();
+
+  Statistics GetStatistics() const;
+
+  static bool TopicMatches(const std::string& filter, const std::string& topic);
+
+ private:
+  struct Segment {
+    std::uint64_t number;
+    std::size_t bytes;
+    std::size_t records;
+  };
+
+  Policy PolicyFor(const std::string& topic) const;
+  std::string SegmentFilename(std::uint64_t number) const;
+  std::vector<std::uint64_t> ListSegments() const;
+  std::deque<Segment>::iterator FindSegment(std::uint64_t number);
+  void Scan(Segment& segment, std::uint64_t start);
+  void StartSegment();
+  void DropOldestSegment();
+  // Removes the segments before the one being read without records still
+  // waiting to be acknowledged.
+  void RemoveDrainedSegments();
+  void RemoveSegment();
+  void StartReading(std::uint64_t number);
+  bool ReadMore();
+  Position CursorPosition() const;
+  void WriteCursor();
+
+  const Options options_;
+  std::deque<Segment> segments_;
+  int write_fd_;
+  bool dirty_;
+  // Reading from segment read_number_, with buffer holding its bytes from
+  // read_base_ on. Segments before it are only kept for records that weren't
+  // acknowledged yet.
+  std::uint64_t read_number_;
+  std::vector<std::uint8_t> read_buffer_;
+  std::uint64_t read_base_;
+  std::uint64_t read_offset_;
+  std::size_t read_records_;
+  // Position of the latest record of each topic that only has its latest
+  // value kept.
+  std::unordered_map<std::string, Position> latest_;
+  // Drained, but not acknowledged yet
+  std::set<Position> unacknowledged_;
+  std::size_t records_;
+  std::size_t bytes_;
+  std::uint64_t spooled_;
+  std::uint64_t drained_;
+  std::uint64_t dropped_;
+};
+#endif  // _MQTT_SPOOL_H_
@@ -1,4 +1,5 @@
 #include "mqtt_wrapper.h"
+#include <algorithm>
 #include <boost/optional/optional_io.hpp>
 #include <regex>
 #include "mqtt_wrapper_impl.h"
@@ -88,10 +89,27 @@ boost::optional<MqttWrapper::Parameters> MqttWrapper::ParseUrl(
   return std::move(params);
 }
 
+std::chrono::milliseconds MqttWrapper::ReconnectDelay(const Options& options,
+                                                      unsigned int attempt,
+                                                      double jitter) {
+  if (attempt == 0) {
+    return std::chrono::milliseconds(0);
+  }
+  std::chrono::milliseconds limit = options.reconnect_delay;
+  for (unsigned int i = 1; i < attempt && limit < options.reconnect_max_delay;
+       i++) {
+    limit *= 2;
+  }
+  limit = std::min(limit, options.reconnect_max_delay);
+  return std::chrono::milliseconds((std::chrono::milliseconds::rep)(
+      limit.count() * std::min(std::max(jitter, 0.0), 1.0)));
+}
+
 std::shared_ptr<MqttWrapper> MqttWrapper::FromParameters(
     boost::asio::io_service& io_service,
     MqttWrapper::Parameters params,
-    std::string instance_id) {
+    std::string instance_id,
+    MqttWrapper::Options options) {
   if (!params.port)
     params.port  = "1883";
   if (!params.client_id) {
@@ -117,7 +135,7 @@ std::shared_ptr<MqttWrapper> MqttWrapper::FromParameters(
             if (password) client->set_password(*password);
             return client;
           },
-          io_service, params.hostname, *params.port,
+          io_service, options, params.hostname, *params.port,
           *params.client_id, params.username,
           params.password);
     } else {
@@ -132,7 +150,7 @@ std::shared_ptr<MqttWrapper> MqttWrapper::FromParameters(
             if (password) client->set_password(*password);
             return client;
           },
-          io_service, params.hostname, *params.port,
+          io_service, options, params.hostname, *params.port,
           *params.client_id, params.username,
           params.password);
     }
@@ -153,7 +171,7 @@ std::shared_ptr<MqttWrapper> MqttWrapper::FromParameters(
             if (password) client->set_password(*password);
             return client;
           },
-          io_service, params.hostname, *params.port,
+          io_service, options, params.hostname, *params.port,
           *params.client_id, params.username,
           params.password);
     } else {
@@ -168,7 +186,7 @@ std::shared_ptr<MqttWrapper> MqttWrapper::FromParameters(
             if (password) client->set_password(*password);
             return client;
           },
-          io_service, params.hostname, *params.port,
+          io_service, options, params.hostname, *params.port,
           *params.client_id, params.username,
           params.password);
     }
@@ -176,10 +194,11 @@ std::shared_ptr<MqttWrapper> MqttWrapper::FromParameters(
 }
 
 std::shared_ptr<MqttWrapper> MqttWrapper::FromUrl(
-    boost::asio::io_service& io_service, std::string url, std::string instance_id) {
+    boost::asio::io_service& io_service, std::string url, std::string instance_id,
+    Options options) {
   auto params = ParseUrl(url);
   if (!params) {
     throw std::runtime_error("MQTT URI Parse error");
   }
-  return FromParameters(io_service, *params, instance_id);
+  return FromParameters(io_service, *params, instance_id, options);
 }
@@ -1,20 +1,74 @@
 #ifndef _MQTT_WRAPPER_H_
 #define _MQTT_WRAPPER_H_
 #include <boost/asio.hpp>
+#include <boost/optional.hpp>
 #include <boost/signals2.hpp>
+#include <chrono>
+#include <memory>
 #include <mqtt/qos.hpp>
 #include <set>
 #include <stlab/concurrency/future.hpp>
 #include <string>
+#include "mqtt_spool.h"
 
 class MqttWrapper {
  public:
+  // Tuning of the connection, apart from where to connect to.
+  struct Options {
+    // Maximum number of QoS 1 and 2 publishes sent but not yet acknowledged,
+    // 0 for no limit. Further publishes are queued in order. Defaults to the
+    // limit mosquitto applies per client.
+    std::size_t max_in_flight = 20;
+    // Publishes made while not connected go here rather than into memory,
+    // and are sent once connected again. Optional.
+    std::shared_ptr<MqttSpool> spool;
+    std::chrono::milliseconds spool_sync_interval = std::chrono::seconds(1);
+    // After losing the connection, the first attempt to reconnect is made
+    // right away. Every attempt after that waits a random time up to twice
+    // as long as the previous limit, starting at reconnect_delay and capped
+    // at reconnect_max_delay, so hubs don't all return at once after the
+    // server restarts. The delays only start over after staying connected
+    // for reconnect_max_delay.
+    std::chrono::milliseconds reconnect_delay = std::chrono::seconds(1);
+    std::chrono::milliseconds reconnect_max_delay = std::chrono::minutes(1);
+    // With a persistent session, the server keeps subscriptions & QoS 1 and 2
+    // publishes in flight while disconnected.
+    bool clean_session = true;
+  };
+  struct Statistics {
+    std::size_t queued;     // Waiting for the connection or the window
+    std::size_t in_flight;  // Waiting for an acknowledgement
+    std::uint64_t acknowledged;
+    // Sent again after the connection was lost before an acknowledgement
+    std::uint64_t requeued;
+    // Time from sending until the acknowledgement
+    std::chrono::milliseconds last_ack_latency;
+    std::chrono::milliseconds max_ack_latency;
+    std::chrono::milliseconds total_ack_latency;
+    // Time from losing the connection until connected again
+    std::uint64_t reconnects;
+    std::uint64_t reconnect_attempts;
+    std::chrono::milliseconds last_reconnect_time;
+    std::chrono::milliseconds max_reconnect_time;
+    std::chrono::milliseconds total_reconnect_time;
+    boost::optional<MqttSpool::Statistics> spool;
+  };
+
   virtual ~MqttWrapper() = default;
+  // Topics that are published to often can be shared, rather than copied
+  // along with every message.
   virtual stlab::future<void> Publish(
-      std::string topic_name, std::string message,
+      std::shared_ptr<const std::string> topic_name, std::string message,
       std::uint8_t qos = mqtt::qos::at_most_once, bool retain = false) = 0;
+  stlab::future<void> Publish(std::string topic_name, std::string message,
+                              std::uint8_t qos = mqtt::qos::at_most_once,
+                              bool retain = false) {
+    return Publish(std::make_shared<const std::string>(std::move(topic_name)),
+                   std::move(message), qos, retain);
+  }
   virtual stlab::future<void> Subscribe(
       std::set<std::tuple<std::string, std::uint8_t>> topics) = 0;
+  virtual Statistics GetStatistics() const = 0;
   boost::signals2::signal<void(std::string topic, std::string message,
                                std::uint8_t qos, bool retain)>
       on_publish_;
@@ -31,10 +85,17 @@ class MqttWrapper {
   };
 
   static boost::optional<Parameters> ParseUrl(const std::string& url);
+  // Delay before the given attempt to reconnect, counting from 0, with
+  // jitter in [0, 1) picking the time within the limit for that attempt.
+  static std::chrono::milliseconds ReconnectDelay(const Options& options,
+                                                  unsigned int attempt,
+                                                  double jitter);
   static std::shared_ptr<MqttWrapper> FromUrl(
-      boost::asio::io_service& io_service, std::string url, std::string instance_id);
+      boost::asio::io_service& io_service, std::string url, std::string instance_id,
+      Options options);
   static std::shared_ptr<MqttWrapper> FromParameters(
-      boost::asio::io_service& io_service, Parameters params, std::string instance_id);
+      boost::asio::io_service& io_service, Parameters params, std::string instance_id,
+      Options options);
 };
 
 std::ostream& operator<<(std::ostream& s,
@@ -1,7 +1,10 @@
 #ifndef _MQTT_WRAPPER_IMPL_H_
 #define _MQTT_WRAPPER_IMPL_H_
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <mqtt_client_cpp.hpp>
-#include <queue>
+#include <random>
 #include <set>
 #include <stlab/concurrency/serial_queue.hpp>
 #include <stlab/concurrency/utility.hpp>
@@ -15,14 +18,21 @@ class MqttWrapperImpl
     : public MqttWrapper,
       public std::enable_shared_from_this<MqttWrapperImpl<C>> {
  public:
-  MqttWrapperImpl(boost::asio::io_service& io_service,
+  MqttWrapperImpl(boost::asio::io_service& io_service, Options options,
                   std::shared_ptr<C> client)
       : mutex_queue_(AsioExecutor(io_service)),
         mutex_queue_executor_(mutex_queue_.executor()),
         io_service_(io_service),
+        options_(options),
         client_(client),
-        reconnect_timer_(io_service) {
-    client_->set_clean_session(true);
+        state_(ConnectionState::Connecting),
+        publish_sequence_(0),
+        statistics_{0, 0, 0, 0, {}, {}, {}, 0, 0, {}, {}, {}, boost::none},
+        reconnect_timer_(io_service),
+        reconnect_attempts_(0),
+        random_(std::random_device()()),
+        spool_sync_timer_(io_service) {
+    client_->set_clean_session(options_.clean_session);
   }
   void PostConstructor() {
     std::shared_ptr<MqttWrapperImpl<C>> self_ptr(this->shared_from_this());
@@ -49,9 +59,14 @@ class MqttWrapperImpl
     client_->connect(WeakExecutorBind(executor_ptr,
                                       &MqttWrapperImpl<C>::FinishHandler,
                                       self_ptr, std::placeholders::_1));
+    if (options_.spool) {
+      StartSpoolSyncTimer();
+    }
   }
-  stlab::future<void> Publish(std::string topic_name, std::string message,
-                              std::uint8_t qos, bool retain) override {
+  using MqttWrapper::Publish;
+  stlab::future<void> Publish(std::shared_ptr<const std::string> topic_name,
+                              std::string message, std::uint8_t qos,
+                              bool retain) override {
     auto _this = this->shared_from_this();
     auto package = stlab::package<void(std::exception_ptr)>(
         AsioExecutor(io_service_), [](std::exception_ptr ex) {
@@ -59,9 +74,12 @@ class MqttWrapperImpl
             std::rethrow_exception(ex);
           }
         });
-    PublishQueueItem item{topic_name, message, qos, retain, package.first};
+    PublishQueueItem item{std::move(topic_name), std::move(message), qos,
+                          retain, package.first};
     return mutex_queue_(
-        [_this](PublishQueueItem item) { _this->SafePublish(item); },
+        [_this](PublishQueueItem item) {
+          _this->SafePublish(std::move(item));
+        },
         std::move(item));
     return package.second;
   }
@@ -74,35 +92,114 @@ class MqttWrapperImpl
     return mutex_queue_([_this](auto x) { _this->SafeSubscribe(x); },
                         std::move(topics));
   }
+  Statistics GetStatistics() const override {
+    Statistics statistics = statistics_;
+    if (options_.spool) {
+      statistics.spool = options_.spool->GetStatistics();
+    }
+    return statistics;
+  }
 
  private:
   stlab::serial_queue_t mutex_queue_;
   stlab::executor_t mutex_queue_executor_;
   boost::asio::io_service& io_service_;
+  const Options options_;
   std::shared_ptr<C> client_;
   enum class ConnectionState { Disconnected, Connecting, Connected };
   ConnectionState state_;
   struct PublishQueueItem {
-    std::string topic_name;
+    std::shared_ptr<const std::string> topic_name;
     std::string message;
     std::uint8_t qos;
     bool retain;
     std::function<void(std::exception_ptr)> callback;
+    // Set when sent
+    std::uint64_t sequence;
+    std::chrono::steady_clock::time_point sent;
   };
-  std::queue<PublishQueueItem> publish_queue_;
+  // Not sent yet, in order
+  std::deque<PublishQueueItem> publish_queue_;
   std::map<std::uint16_t, PublishQueueItem> publish_inprogress_;
+  std::uint64_t publish_sequence_;
+  Statistics statistics_;
   std::set<std::tuple<std::string, std::uint8_t>> subscriptions_;
   boost::asio::deadline_timer reconnect_timer_;
+  // Since the last time the connection stayed up long enough
+  unsigned int reconnect_attempts_;
+  std::mt19937 random_;
+  std::chrono::steady_clock::time_point connected_since_;
+  boost::optional<std::chrono::steady_clock::time_point> disconnected_since_;
+  boost::asio::deadline_timer spool_sync_timer_;
 
   void SafePublish(PublishQueueItem item) {
-    if (state_ != ConnectionState::Connected) {
-      publish_queue_.push(std::move(item));
-      return;
+    // Once anything is spooled, later publishes have to be spooled as well to
+    // stay in order. What's spooled is as good as sent to the caller, and so
+    // is what the policy for the topic drops.
+    if (options_.spool && (state_ != ConnectionState::Connected ||
+                           !options_.spool->Empty())) {
+      std::exception_ptr error;
+      try {
+        options_.spool->Append(*item.topic_name, item.message, item.qos,
+                               item.retain);
+      } catch (const std::exception&) {
+        error = std::current_exception();
+      }
+      item.callback(error);
+    } else {
+      publish_queue_.push_back(std::move(item));
+    }
+    FlushQueue();
+  }
+
+  bool WindowFull() const {
+    return options_.max_in_flight > 0 &&
+           publish_inprogress_.size() >= options_.max_in_flight;
+  }
+
+  // Sends queued publishes back to back, for as long as the window allows, so
+  // a backlog after reconnecting goes out in batches rather than all at once.
+  // QoS 0 publishes don't take up room, but don't overtake earlier ones.
+  void FlushQueue() {
+    while (state_ == ConnectionState::Connected && !publish_queue_.empty()) {
+      if (publish_queue_.front().qos != mqtt::qos::at_most_once &&
+          WindowFull()) {
+        break;
+      }
+      PublishQueueItem item = std::move(publish_queue_.front());
+      publish_queue_.pop_front();
+      Send(std::move(item));
     }
+    // The spool only holds publishes made after those in memory.
+    while (options_.spool && state_ == ConnectionState::Connected &&
+           publish_queue_.empty() && !WindowFull()) {
+      boost::optional<MqttSpool::Record> record = options_.spool->Next();
+      if (!record) {
+        break;
+      }
+      // Only once the server has it can the spool let go of it; until then
+      // it is sent again after a restart, even when requeued in memory.
+      std::shared_ptr<MqttSpool> spool = options_.spool;
+      MqttSpool::Position position = record->position;
+      Send(PublishQueueItem{
+          std::make_shared<const std::string>(std::move(record->topic)),
+          std::move(record->message), record->qos, record->retain,
+          [spool, position](std::exception_ptr error) {
+            if (!error) {
+              spool->Acknowledge(position);
+            }
+          },
+          0, {}});
+    }
+    statistics_.queued = publish_queue_.size();
+    statistics_.in_flight = publish_inprogress_.size();
+  }
+
+  void Send(PublishQueueItem item) {
     if (item.qos == mqtt::qos::at_most_once) {
       auto callback = item.callback;
       client_->acquired_async_publish(
-          0, item.topic_name, item.message, item.qos, item.retain,
+          0, *item.topic_name, item.message, item.qos, item.retain,
           [callback](const boost::system::error_code& error) {
             if (error) {
               callback(std::make_exception_ptr(error));
@@ -114,9 +211,13 @@ class MqttWrapperImpl
     }
     auto packet_id = client_->acquire_unique_packet_id();
     auto _this = this->shared_from_this();
-    publish_inprogress_[packet_id] = item;
+    item.sequence = publish_sequence_++;
+    item.sent = std::chrono::steady_clock::now();
+    const PublishQueueItem& inprogress =
+        (publish_inprogress_[packet_id] = std::move(item));
     client_->acquired_async_publish(
-        packet_id, item.topic_name, item.message, item.qos, item.retain,
+        packet_id, *inprogress.topic_name, inprogress.message, inprogress.qos,
+        inprogress.retain,
         [packet_id, _this](const boost::system::error_code& error) {
           _this
               ->mutex_queue_(
@@ -146,41 +247,103 @@ class MqttWrapperImpl
           << mqtt::connect_return_code_to_str(connack_return_code);
       return;
     }
-    LOG("MqttWrapper", debug) << "Connected, clean=" << sp;
+    LOG("MqttWrapper", debug) << "Connected, session present=" << sp;
     state_ = ConnectionState::Connected;
-    if (!subscriptions_.empty()) {
+    connected_since_ = std::chrono::steady_clock::now();
+    if (disconnected_since_) {
+      auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
+          connected_since_ - *disconnected_since_);
+      disconnected_since_ = boost::none;
+      LOG("MqttWrapper", info) << "Reconnected after " << time.count() << "ms";
+      statistics_.reconnects++;
+      statistics_.last_reconnect_time = time;
+      statistics_.max_reconnect_time =
+          std::max(statistics_.max_reconnect_time, time);
+      statistics_.total_reconnect_time += time;
+    }
+    bool session_kept = sp && !options_.clean_session;
+    if (!session_kept) {
+      // The server has no record of what was in flight.
+      RequeueInFlight();
+    }
+    if (!subscriptions_.empty() && !session_kept) {
       LOG("MqttWrapper", debug) << "Sending async subscribe after connect";
       client_->async_subscribe(
           std::vector<std::tuple<std::string, std::uint8_t>>(
               subscriptions_.begin(), subscriptions_.end()));
     }
-    std::queue<PublishQueueItem> queue_copy;
-    std::swap(queue_copy, publish_queue_);
-    while (!queue_copy.empty()) {
-      auto item = queue_copy.front();
-      queue_copy.pop();
-      SafePublish(item);
+    FlushQueue();
+  }
+
+  // Without a session the broker forgets unacknowledged publishes, so they go
+  // in front of the queue again, in the order they were first sent.
+  void RequeueInFlight() {
+    if (publish_inprogress_.empty()) {
+      return;
+    }
+    std::vector<PublishQueueItem> items;
+    for (auto& entry : publish_inprogress_) {
+      items.push_back(std::move(entry.second));
     }
+    publish_inprogress_.clear();
+    std::sort(items.begin(), items.end(),
+              [](const PublishQueueItem& a, const PublishQueueItem& b) {
+                return a.sequence < b.sequence;
+              });
+    LOG("MqttWrapper", debug) << "Requeueing " << items.size()
+                              << " unacknowledged publishes";
+    publish_queue_.insert(publish_queue_.begin(),
+                          std::make_move_iterator(items.begin()),
+                          std::make_move_iterator(items.end()));
+    statistics_.requeued += items.size();
+    statistics_.queued = publish_queue_.size();
+    statistics_.in_flight = 0;
+  }
+
+  void Acknowledged(const PublishQueueItem& item) {
+    auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - item.sent);
+    statistics_.acknowledged++;
+    statistics_.last_ack_latency = latency;
+    statistics_.max_ack_latency =
+        std::max(statistics_.max_ack_latency, latency);
+    statistics_.total_ack_latency += latency;
   }
 
   void ErrorHandler(const boost::system::error_code& error) {
-    std::weak_ptr<MqttWrapperImpl<C>> weak_this(this->shared_from_this());
     LOG("MqttWrapper", debug) << "ErrorHandler: " << error;
-    state_ = ConnectionState::Disconnected;
-    StartReconnectTimer();
+    Disconnected();
   }
 
   void FinishHandler(const boost::system::error_code& error) {
     LOG("MqttWrapper", debug) << "FinishHandler: " << error;
+    Disconnected();
+  }
+
+  void Disconnected() {
+    if (state_ == ConnectionState::Connected) {
+      auto now = std::chrono::steady_clock::now();
+      disconnected_since_ = now;
+      if (now - connected_since_ >= options_.reconnect_max_delay) {
+        reconnect_attempts_ = 0;
+      }
+    }
     state_ = ConnectionState::Disconnected;
+    if (options_.clean_session) {
+      RequeueInFlight();
+    }
     StartReconnectTimer();
   }
 
   void StartReconnectTimer() {
     boost::system::error_code ignore;
     reconnect_timer_.cancel(ignore);
-    LOG("MqttWrapper", debug) << "Starting reconnect timer...";
-    reconnect_timer_.expires_from_now(boost::posix_time::seconds(5));
+    std::chrono::milliseconds delay = ReconnectDelay(
+        options_, reconnect_attempts_,
+        std::uniform_real_distribution<double>(0.0, 1.0)(random_));
+    LOG("MqttWrapper", debug) << "Reconnecting in " << delay.count() << "ms";
+    reconnect_timer_.expires_from_now(
+        boost::posix_time::milliseconds(delay.count()));
     std::shared_ptr<MqttWrapperImpl<C>> self_ptr(this->shared_from_this());
     std::shared_ptr<stlab::executor_t> executor_ptr(self_ptr,
                                                     &mutex_queue_executor_);
@@ -203,6 +366,8 @@ class MqttWrapperImpl
       return;
     }
     LOG("MqttWrapper", info) << "Reconnecting to MQTT server...";
+    reconnect_attempts_++;
+    statistics_.reconnect_attempts++;
     std::shared_ptr<MqttWrapperImpl<C>> self_ptr(this->shared_from_this());
     std::shared_ptr<stlab::executor_t> executor_ptr(self_ptr,
                                                     &mutex_queue_executor_);
@@ -211,6 +376,25 @@ class MqttWrapperImpl
                                       self_ptr, std::placeholders::_1));
   }
 
+  void StartSpoolSyncTimer() {
+    spool_sync_timer_.expires_from_now(
+        boost::posix_time::milliseconds(options_.spool_sync_interval.count()));
+    std::shared_ptr<MqttWrapperImpl<C>> self_ptr(this->shared_from_this());
+    std::shared_ptr<stlab::executor_t> executor_ptr(self_ptr,
+                                                    &mutex_queue_executor_);
+    spool_sync_timer_.async_wait(
+        WeakExecutorBind(executor_ptr, &MqttWrapperImpl<C>::OnSpoolSyncTimer,
+                         self_ptr, std::placeholders::_1));
+  }
+
+  void OnSpoolSyncTimer(const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      return;
+    }
+    options_.spool->Sync();
+    StartSpoolSyncTimer();
+  }
+
   void AsyncPublishCallback(std::uint16_t packet_id,
                             const boost::system::error_code& error) {
     if (error) {
@@ -220,9 +404,10 @@ class MqttWrapperImpl
             << "AsyncPublishCallback: Packet ID " << packet_id << " not found";
         return;
       }
-      auto item = found->second;
+      auto item = std::move(found->second);
       publish_inprogress_.erase(found);
       item.callback(std::make_exception_ptr(error));
+      FlushQueue();
       return;
     }
   }
@@ -243,8 +428,9 @@ class MqttWrapperImpl
       return;
     }
     publish_inprogress_.erase(found);
+    Acknowledged(item);
     item.callback(nullptr);
-    return;
+    FlushQueue();
   }
 
   void PublishCompletedHandler(std::uint16_t packet_id) {
@@ -263,8 +449,9 @@ class MqttWrapperImpl
       return;
     }
     publish_inprogress_.erase(found);
+    Acknowledged(item);
     item.callback(nullptr);
-    return;
+    FlushQueue();
   }
 
   void PublishHandler(std::uint8_t fixed_header,
@@ -277,12 +464,13 @@ class MqttWrapperImpl
 
 template <typename F, typename... Args>
 static std::shared_ptr<MqttWrapper> CreateMqttWrapperImpl(
-    F f, boost::asio::io_service& io_service, Args... args) {
+    F f, boost::asio::io_service& io_service, MqttWrapper::Options options,
+    Args... args) {
   typedef typename std::result_of<F(boost::asio::io_service&, Args...)>::type
       ReturnType;
   typedef typename ReturnType::element_type ClientType;
   auto wrapper = std::make_shared<MqttWrapperImpl<ClientType>>(
-      io_service, f(io_service, args...));
+      io_service, options, f(io_service, args...));
   wrapper->PostConstructor();
   return wrapper;
 }
@@ -0,0 +1,70 @@
+#include "topic_cache.h"
+#include <boost/format.hpp>
+
+namespace {
+// Attribute ids come from devices, so don't let a misbehaving one grow a
+// command's sub-topics without bounds.
+const std::size_t kMaxAttributeTopics = 256;
+}  // namespace
+
+TopicCache::TopicCache(std::string mqtt_prefix, std::size_t max_topics)
+    : mqtt_prefix_(std::move(mqtt_prefix)), max_topics_(max_topics) {}
+
+std::size_t TopicCache::KeyHash::operator()(const Key& key) const {
+  std::hash<uint64_t> hash;
+  return hash(key.first) ^ (hash(key.second) * 0x9E3779B97F4A7C15ULL);
+}
+
+TopicCache::CommandTopics& TopicCache::Command(
+    znp::IEEEAddress address, uint8_t endpoint, zcl::ZclDirection direction,
+    const clusterdb::ClusterInfo& cluster_info,
+    const clusterdb::CommandInfo& command_info, std::uint64_t generation) {
+  Key key(address, (uint64_t)cluster_info.id | ((uint64_t)endpoint << 16) |
+                       ((uint64_t)command_info.id << 24) |
+                       ((uint64_t)command_info.is_global << 32) |
+                       ((uint64_t)direction << 33));
+  auto found = commands_.find(key);
+  if (found != commands_.end() && found->second.generation == generation) {
+    return found->second;
+  }
+  if (found == commands_.end() && commands_.size() >= max_topics_) {
+    commands_.clear();
+  }
+  CommandTopics& command = commands_[key];
+  command.attributes.clear();
+  command.generation = generation;
+  command.topic = std::make_shared<const std::string>(boost::str(
+      boost::format("%s%016X/%d/in/%s/%s") % mqtt_prefix_ % address %
+      (unsigned int)endpoint % cluster_info.name % command_info.name));
+  return command;
+}
+
+TopicCache::Topic TopicCache::AttributeTopic(
+    CommandTopics& command, const std::string& key,
+    const std::function<std::string()>& subtopic) {
+  auto found = command.attributes.find(key);
+  if (found != command.attributes.end()) {
+    return found->second;
+  }
+  Topic topic =
+      std::make_shared<const std::string>(*command.topic + "/" + subtopic());
+  if (command.attributes.size() < kMaxAttributeTopics) {
+    command.attributes.emplace(key, topic);
+  }
+  return topic;
+}
+
+const TopicCache::Topic& TopicCache::LinkQualityTopic(
+    znp::IEEEAddress address) {
+  Topic& topic = link_quality_[address];
+  if (!topic) {
+    topic = std::make_shared<const std::string>(boost::str(
+        boost::format("%s%016X/linkquality") % mqtt_prefix_ % address));
+  }
+  return topic;
+}
+
+void TopicCache::Clear() {
+  commands_.clear();
+  link_quality_.clear();
+}
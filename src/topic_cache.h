@@ -0,0 +1,61 @@
+#ifndef _TOPIC_CACHE_H_
+#define _TOPIC_CACHE_H_
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "clusterdb/cluster_info.h"
+#include "znp/znp.h"
+
+/**
+ * Topics of outbound publishes, formatted once and then shared with the MQTT
+ * queue rather than copied. Devices keep reporting on the same few topics, so
+ * nearly every lookup is a hit.
+ *
+ * Names come from the cluster database, so this is to be cleared when it is
+ * reloaded. Command topics are also built again when asked for with a
+ * different generation of the database, in case messages still being handled
+ * with the old one put them back in between. When more than max_topics command
+ * topics are known, everything is dropped and built again as needed.
+ */
+class TopicCache {
+ public:
+  typedef std::shared_ptr<const std::string> Topic;
+  struct CommandTopics {
+    Topic topic;  // {prefix}{ieee}/{endpoint}/in/{cluster}/{command}
+    std::uint64_t generation;  // Of the cluster database it was named from
+    // Sub-topics per attribute, see AttributeTopic
+    std::unordered_map<std::string, Topic> attributes;
+  };
+
+  TopicCache(std::string mqtt_prefix, std::size_t max_topics = 4096);
+
+  // Valid until the next call to Command or Clear.
+  CommandTopics& Command(znp::IEEEAddress address, uint8_t endpoint,
+                         zcl::ZclDirection direction,
+                         const clusterdb::ClusterInfo& cluster_info,
+                         const clusterdb::CommandInfo& command_info,
+                         std::uint64_t generation);
+  // {command topic}/{subtopic}, keyed by the attribute id as it appears in the
+  // decoded command. subtopic is only called if it's not known yet.
+  Topic AttributeTopic(CommandTopics& command, const std::string& key,
+                       const std::function<std::string()>& subtopic);
+  // {prefix}{ieee}/linkquality
+  const Topic& LinkQualityTopic(znp::IEEEAddress address);
+
+  void Clear();
+
+ private:
+  typedef std::pair<uint64_t, uint64_t> Key;
+  struct KeyHash {
+    std::size_t operator()(const Key& key) const;
+  };
+
+  const std::string mqtt_prefix_;
+  const std::size_t max_topics_;
+  std::unordered_map<Key, CommandTopics, KeyHash> commands_;
+  std::unordered_map<znp::IEEEAddress, Topic> link_quality_;
+};
+#endif  // _TOPIC_CACHE_H_
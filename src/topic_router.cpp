@@ -0,0 +1,175 @@
+#include "topic_router.h"
+#include <stdexcept>
+
+namespace {
+bool ParseHex(boost::string_ref text, uint64_t& value) {
+  if (text.empty() || text.size() > 16) {
+    return false;
+  }
+  value = 0;
+  for (char c : text) {
+    unsigned int digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return false;
+    }
+    value = (value << 4) | digit;
+  }
+  return true;
+}
+
+bool ParseDecimal(boost::string_ref text, uint64_t& value) {
+  if (text.empty() || text.size() > 20) {
+    return false;
+  }
+  value = 0;
+  for (char c : text) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    uint64_t next = value * 10 + (c - '0');
+    if (next / 10 != value) {
+      return false;
+    }
+    value = next;
+  }
+  return true;
+}
+}  // namespace
+
+constexpr std::size_t TopicRouter::kMaxCaptures;
+
+TopicRouter::TopicRouter() : nodes_(1) {}
+
+void TopicRouter::Add(const std::string& pattern, Handler handler) {
+  std::size_t node = 0;
+  std::size_t captures = 0;
+  std::size_t start = 0;
+  while (true) {
+    std::size_t end = pattern.find('/', start);
+    std::string level = pattern.substr(start, end - start);
+    if (level.empty()) {
+      throw std::runtime_error("Empty level in topic pattern '" + pattern +
+                               "'");
+    }
+    Level type = Level::Literal;
+    if (level == "{hex}") {
+      type = Level::Hex;
+    } else if (level == "{dec}") {
+      type = Level::Decimal;
+    } else if (level == "{name}") {
+      type = Level::Name;
+    }
+    if (type != Level::Literal) {
+      level.clear();
+      if (++captures > kMaxCaptures) {
+        throw std::runtime_error("Too many captures in topic pattern '" +
+                                 pattern + "'");
+      }
+    }
+    node = Child(node, type, level);
+    if (end == std::string::npos) {
+      break;
+    }
+    start = end + 1;
+  }
+  if (nodes_[node].handler) {
+    throw std::runtime_error("Duplicate topic pattern '" + pattern + "'");
+  }
+  nodes_[node].handler = std::move(handler);
+}
+
+std::size_t TopicRouter::Child(std::size_t parent, Level level,
+                               const std::string& literal) {
+  for (std::size_t child : nodes_[parent].children) {
+    if (nodes_[child].level == level && nodes_[child].literal == literal) {
+      return child;
+    }
+  }
+  std::size_t child = nodes_.size();
+  nodes_.push_back(Node{level, literal, {}, nullptr});
+  auto& children = nodes_[parent].children;
+  auto position = children.end();
+  if (level == Level::Literal) {
+    position = children.begin();
+    while (position != children.end() &&
+           nodes_[*position].level == Level::Literal) {
+      ++position;
+    }
+  }
+  children.insert(position, child);
+  return child;
+}
+
+bool TopicRouter::Route(boost::string_ref topic,
+                        const std::string& message) const {
+  Match match;
+  const Handler* handler = Find(topic, match);
+  if (!handler) {
+    return false;
+  }
+  (*handler)(match, message);
+  return true;
+}
+
+const TopicRouter::Handler* TopicRouter::Find(boost::string_ref topic,
+                                              Match& match) const {
+  match.size = 0;
+  const Node* node = Find(0, topic, match);
+  return node ? &node->handler : nullptr;
+}
+
+const TopicRouter::Node* TopicRouter::Find(std::size_t node,
+                                           boost::string_ref rest,
+                                           Match& match) const {
+  std::size_t separator = rest.find('/');
+  boost::string_ref level = rest.substr(0, separator);
+  bool last = (separator == boost::string_ref::npos);
+  for (std::size_t index : nodes_[node].children) {
+    const Node& child = nodes_[index];
+    uint64_t number = 0;
+    switch (child.level) {
+      case Level::Literal:
+        if (level != boost::string_ref(child.literal)) {
+          continue;
+        }
+        break;
+      case Level::Hex:
+        if (!ParseHex(level, number)) {
+          continue;
+        }
+        break;
+      case Level::Decimal:
+        if (!ParseDecimal(level, number)) {
+          continue;
+        }
+        break;
+      case Level::Name:
+        if (level.empty()) {
+          continue;
+        }
+        break;
+    }
+    std::size_t captured = match.size;
+    if (child.level != Level::Literal) {
+      match.text[match.size] = level;
+      match.number[match.size] = number;
+      match.size++;
+    }
+    if (last) {
+      if (child.handler) {
+        return &child;
+      }
+    } else if (const Node* found =
+                   Find(index, rest.substr(separator + 1), match)) {
+      return found;
+    }
+    match.size = captured;
+  }
+  return nullptr;
+}
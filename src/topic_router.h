@@ -0,0 +1,60 @@
+#ifndef _TOPIC_ROUTER_H_
+#define _TOPIC_ROUTER_H_
+#include <array>
+#include <boost/utility/string_ref.hpp>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Dispatches MQTT topics to handlers, by matching them level by level against
+ * a trie of patterns. A pattern is a '/'-separated list of levels, each either
+ * a literal, or one of the captures:
+ * - {hex}: hexadecimal number of at most 64 bits, e.g. an IEEE address
+ * - {dec}: decimal number of at most 64 bits, e.g. an endpoint or group id
+ * - {name}: any non-empty level, e.g. a cluster or command name
+ *
+ * At each level literals are tried before captures, and captures in the order
+ * their patterns were added. Matching a topic allocates nothing.
+ */
+class TopicRouter {
+ public:
+  static constexpr std::size_t kMaxCaptures = 8;
+
+  struct Match {
+    std::size_t size;
+    // Text of each capture, pointing into the topic being routed.
+    std::array<boost::string_ref, kMaxCaptures> text;
+    // Value of each {hex} or {dec} capture, 0 for {name}.
+    std::array<uint64_t, kMaxCaptures> number;
+  };
+  typedef std::function<void(const Match& match, const std::string& message)>
+      Handler;
+
+  TopicRouter();
+
+  // Throws if the pattern is malformed, or has been added before.
+  void Add(const std::string& pattern, Handler handler);
+  // Calls the handler of the matching pattern, returns false if none matched.
+  bool Route(boost::string_ref topic, const std::string& message) const;
+  // Only finds the handler, for when a topic is not to be dispatched yet.
+  const Handler* Find(boost::string_ref topic, Match& match) const;
+
+ private:
+  enum class Level : uint8_t { Literal, Hex, Decimal, Name };
+  struct Node {
+    Level level;
+    std::string literal;
+    std::vector<std::size_t> children;  // Literals first
+    Handler handler;
+  };
+
+  std::size_t Child(std::size_t parent, Level level,
+                    const std::string& literal);
+  const Node* Find(std::size_t node, boost::string_ref rest,
+                   Match& match) const;
+
+  std::vector<Node> nodes_;  // nodes_[0] is the root
+};
+#endif  // _TOPIC_ROUTER_H_
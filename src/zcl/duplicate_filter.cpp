@@ -0,0 +1,85 @@
+#include "zcl/duplicate_filter.h"
+#include <algorithm>
+
+namespace zcl {
+DuplicateFilter::DuplicateFilter(std::size_t capacity, Clock::duration window)
+    : capacity_(std::max<std::size_t>(capacity, 1)),
+      window_(window),
+      entries_(capacity_),
+      begin_(0),
+      size_(0),
+      passed_(0),
+      suppressed_(0) {
+  keys_.reserve(capacity_);
+}
+
+bool DuplicateFilter::IsDuplicate(znp::ShortAddress source_address,
+                                  uint8_t source_endpoint,
+                                  ZclClusterId cluster_id,
+                                  ZclFrameType frame_type,
+                                  ZclDirection direction,
+                                  ZclCommandId command_id,
+                                  uint8_t trans_seq_number,
+                                  Clock::time_point now) {
+  Expire(now);
+  Key key = MakeKey(source_address, source_endpoint, cluster_id, frame_type,
+                    direction, command_id, trans_seq_number);
+  if (keys_.count(key) > 0) {
+    suppressed_++;
+    return true;
+  }
+  Add(key, now);
+  passed_++;
+  return false;
+}
+
+void DuplicateFilter::Remember(znp::ShortAddress source_address,
+                               uint8_t source_endpoint,
+                               ZclClusterId cluster_id,
+                               ZclFrameType frame_type,
+                               ZclDirection direction, ZclCommandId command_id,
+                               uint8_t trans_seq_number,
+                               Clock::time_point now) {
+  Expire(now);
+  Key key = MakeKey(source_address, source_endpoint, cluster_id, frame_type,
+                    direction, command_id, trans_seq_number);
+  if (keys_.count(key) == 0) {
+    Add(key, now);
+  }
+  passed_++;
+}
+
+DuplicateFilter::Statistics DuplicateFilter::GetStatistics() const {
+  return Statistics{size_, passed_, suppressed_};
+}
+
+DuplicateFilter::Key DuplicateFilter::MakeKey(
+    znp::ShortAddress source_address, uint8_t source_endpoint,
+    ZclClusterId cluster_id, ZclFrameType frame_type, ZclDirection direction,
+    ZclCommandId command_id, uint8_t trans_seq_number) {
+  // Frame type & direction as in the frame control field
+  uint8_t frame_control = (uint8_t)frame_type | ((uint8_t)direction << 3);
+  return (((Key)source_address) << 48) | (((Key)source_endpoint) << 40) |
+         (((Key)cluster_id) << 24) | (((Key)frame_control) << 16) |
+         (((Key)command_id) << 8) | trans_seq_number;
+}
+
+void DuplicateFilter::Add(Key key, Clock::time_point now) {
+  if (size_ == capacity_) {
+    keys_.erase(entries_[begin_].key);
+    begin_ = (begin_ + 1) % capacity_;
+    size_--;
+  }
+  entries_[(begin_ + size_) % capacity_] = Entry{key, now};
+  size_++;
+  keys_.insert(key);
+}
+
+void DuplicateFilter::Expire(Clock::time_point now) {
+  while (size_ > 0 && now - entries_[begin_].seen >= window_) {
+    keys_.erase(entries_[begin_].key);
+    begin_ = (begin_ + 1) % capacity_;
+    size_--;
+  }
+}
+}  // namespace zcl
@@ -0,0 +1,74 @@
+#ifndef _ZCL_DUPLICATE_FILTER_H_
+#define _ZCL_DUPLICATE_FILTER_H_
+#include <chrono>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+#include "zcl/zcl.h"
+#include "znp/znp.h"
+
+namespace zcl {
+/**
+ * Recognizes retransmitted ZCL frames by (source address, source endpoint,
+ * cluster, frame type, direction, command, transaction sequence number).
+ * Sequence numbers alone don't tell frames apart: responses carry the number
+ * of the request they answer, which a device may also have used for a report
+ * of its own.
+ *
+ * Only the most recent frames are remembered, in a ring of fixed capacity, and
+ * entries older than the window are ignored. Expiry is checked against the
+ * time passed in, so no timers are needed per entry.
+ */
+class DuplicateFilter {
+ public:
+  typedef std::chrono::steady_clock Clock;
+  struct Statistics {
+    std::size_t entries;
+    std::uint64_t passed;
+    std::uint64_t suppressed;
+  };
+
+  DuplicateFilter(std::size_t capacity = 256,
+                  Clock::duration window = std::chrono::seconds(10));
+
+  // Returns true if the frame was seen within the window, otherwise
+  // remembers it and returns false.
+  bool IsDuplicate(znp::ShortAddress source_address, uint8_t source_endpoint,
+                   ZclClusterId cluster_id, ZclFrameType frame_type,
+                   ZclDirection direction, ZclCommandId command_id,
+                   uint8_t trans_seq_number,
+                   Clock::time_point now = Clock::now());
+  // Remembers a frame known not to be a duplicate, so retransmissions of it
+  // are recognized.
+  void Remember(znp::ShortAddress source_address, uint8_t source_endpoint,
+                ZclClusterId cluster_id, ZclFrameType frame_type,
+                ZclDirection direction, ZclCommandId command_id,
+                uint8_t trans_seq_number, Clock::time_point now = Clock::now());
+
+  Statistics GetStatistics() const;
+
+ private:
+  typedef uint64_t Key;
+  struct Entry {
+    Key key;
+    Clock::time_point seen;
+  };
+  static Key MakeKey(znp::ShortAddress source_address, uint8_t source_endpoint,
+                     ZclClusterId cluster_id, ZclFrameType frame_type,
+                     ZclDirection direction, ZclCommandId command_id,
+                     uint8_t trans_seq_number);
+  void Expire(Clock::time_point now);
+  void Add(Key key, Clock::time_point now);
+
+  const std::size_t capacity_;
+  const Clock::duration window_;
+  // Ring buffer in order of arrival, oldest at begin_.
+  std::vector<Entry> entries_;
+  std::size_t begin_;
+  std::size_t size_;
+  std::unordered_set<Key> keys_;
+  std::uint64_t passed_;
+  std::uint64_t suppressed_;
+};
+}  // namespace zcl
+#endif  // _ZCL_DUPLICATE_FILTER_H_
@@ -15,8 +15,8 @@ struct VariantEncodeHelper {
                       znp::EncodeTarget::iterator& begin,
                       znp::EncodeTarget::iterator end) = 0;
   virtual void Decode(zcl::ZclVariant& variant,
-                      znp::EncodeTarget::const_iterator& begin,
-                      znp::EncodeTarget::const_iterator end) = 0;
+                      znp::ByteSpan::const_iterator& begin,
+                      znp::ByteSpan::const_iterator end) = 0;
 };
 
 // Implementation, templated, with some default error messages.
@@ -35,8 +35,8 @@ struct VariantEncodeHelperImpl : VariantEncodeHelper {
         enum_to_string(DT)));
   }
   void Decode(zcl::ZclVariant& variant,
-              znp::EncodeTarget::const_iterator& begin,
-              znp::EncodeTarget::const_iterator end) override {
+              znp::ByteSpan::const_iterator& begin,
+              znp::ByteSpan::const_iterator end) override {
     throw std::runtime_error(boost::str(
         boost::format("Encoding/decoding for datatype %s not yet implemented") %
         enum_to_string(DT)));
@@ -51,8 +51,8 @@ struct VariantEncodeHelperImpl<DataType::nodata> : VariantEncodeHelper {
               znp::EncodeTarget::iterator& begin,
               znp::EncodeTarget::iterator end) override {}
   void Decode(zcl::ZclVariant& variant,
-              znp::EncodeTarget::const_iterator& begin,
-              znp::EncodeTarget::const_iterator end) override {
+              znp::ByteSpan::const_iterator& begin,
+              znp::ByteSpan::const_iterator end) override {
     variant = ZclVariant::Create<DataType::nodata>();
   }
 };
@@ -76,8 +76,8 @@ struct VariantEncodeHelperImpl<DataType::_bool> : VariantEncodeHelper {
     }
   }
   void Decode(zcl::ZclVariant& variant,
-              znp::EncodeTarget::const_iterator& begin,
-              znp::EncodeTarget::const_iterator end) override {
+              znp::ByteSpan::const_iterator& begin,
+              znp::ByteSpan::const_iterator end) override {
     uint8_t value;
     znp::EncodeHelper<uint8_t>::Decode(value, begin, end);
     if (value == 0xFF) {
@@ -113,8 +113,8 @@ struct DefaultVariantEncodeHelperImpl : VariantEncodeHelper {
     return znp::EncodeHelper<ValueType>::Encode(*value, begin, end);
   }
   void Decode(zcl::ZclVariant& variant,
-              znp::EncodeTarget::const_iterator& begin,
-              znp::EncodeTarget::const_iterator end) override {
+              znp::ByteSpan::const_iterator& begin,
+              znp::ByteSpan::const_iterator end) override {
     ValueType value;
     znp::EncodeHelper<ValueType>::Decode(value, begin, end);
     variant = ZclVariant::Create<DT>(value);
@@ -203,8 +203,8 @@ struct VectorVariantEncodeHelperImpl : VariantEncodeHelper {
     }
   }
   void Decode(zcl::ZclVariant& variant,
-              znp::EncodeTarget::const_iterator& begin,
-              znp::EncodeTarget::const_iterator end) override {
+              znp::ByteSpan::const_iterator& begin,
+              znp::ByteSpan::const_iterator end) override {
     LT length;
     znp::EncodeHelper<LT>::Decode(length, begin, end);
     if (length == (LT)-1) {
@@ -262,8 +262,8 @@ struct IntVariantEncodeHelperImpl : VariantEncodeHelper {
       *(begin++) = (uint8_t)((unsigned_value >> shift) & 0xFF);
     }
   }
-  void Decode(ZclVariant& variant, znp::EncodeTarget::const_iterator& begin,
-              znp::EncodeTarget::const_iterator end) override {
+  void Decode(ZclVariant& variant, znp::ByteSpan::const_iterator& begin,
+              znp::ByteSpan::const_iterator end) override {
     UnsignedType unsigned_value = 0;
     for (std::size_t shift = 0; shift < N; shift += 8) {
       if (begin == end) {
@@ -352,8 +352,8 @@ struct FloatVariantEncodeHelperImpl : VariantEncodeHelper {
     }
     throw std::runtime_error("Variant did not contain expected value");
   }
-  void Decode(ZclVariant& variant, znp::EncodeTarget::const_iterator& begin,
-              znp::EncodeTarget::const_iterator end) override {
+  void Decode(ZclVariant& variant, znp::ByteSpan::const_iterator& begin,
+              znp::ByteSpan::const_iterator end) override {
     ValueType value;
     ContainedEncoder::Decode(value, begin, end);
     variant = ZclVariant::Create<DT>(value);
@@ -405,8 +405,8 @@ void EncodeHelper<zcl::ZclVariant>::Encode(const zcl::ZclVariant& variant,
 }
 
 void EncodeHelper<zcl::ZclVariant>::Decode(zcl::ZclVariant& variant,
-                                           EncodeTarget::const_iterator& begin,
-                                           EncodeTarget::const_iterator end) {
+                                           ByteSpan::const_iterator& begin,
+                                           ByteSpan::const_iterator end) {
   zcl::DataType datatype;
   EncodeHelper<zcl::DataType>::Decode(datatype, begin, end);
   auto& map = zcl::EncoderMap();
@@ -416,4 +416,13 @@ void EncodeHelper<zcl::ZclVariant>::Decode(zcl::ZclVariant& variant,
   }
   found->second->Decode(variant, begin, end);
 }
+
+void EncodeHelper<zcl::ZclVariant>::Decode(zcl::ZclVariant& variant,
+                                           EncodeTarget::const_iterator& begin,
+                                           EncodeTarget::const_iterator end) {
+  ByteSpan::const_iterator span_begin = begin == end ? nullptr : &*begin;
+  ByteSpan::const_iterator span_current = span_begin;
+  Decode(variant, span_current, span_begin + (end - begin));
+  begin += span_current - span_begin;
+}
 }  // namespace znp
@@ -40,9 +40,8 @@ class EncodeHelper<zcl::ZclFrame> {
     std::copy(value.payload.begin(), value.payload.end(), begin);
     begin = end;
   }
-  static inline void Decode(zcl::ZclFrame& value,
-                            EncodeTarget::const_iterator& begin,
-                            EncodeTarget::const_iterator end) {
+  template <typename I>
+  static inline void Decode(zcl::ZclFrame& value, I& begin, I end) {
     uint8_t frame_control;
     EncodeHelper<uint8_t>::Decode(frame_control, begin, end);
     value.frame_type =
@@ -72,6 +71,8 @@ class EncodeHelper<zcl::ZclVariant> {
   static std::size_t GetSize(const zcl::ZclVariant& variant);
   static void Encode(const zcl::ZclVariant& variant,
                      EncodeTarget::iterator& begin, EncodeTarget::iterator end);
+  static void Decode(zcl::ZclVariant& variant, ByteSpan::const_iterator& begin,
+                     ByteSpan::const_iterator end);
   static void Decode(zcl::ZclVariant& variant,
                      EncodeTarget::const_iterator& begin,
                      EncodeTarget::const_iterator end);
@@ -1,11 +1,65 @@
 #include "zcl/zcl_endpoint.h"
 #include <boost/log/utility/manipulators/dump.hpp>
+#include <sstream>
+#include <stlab/concurrency/immediate_executor.hpp>
 #include "logging.h"
 #include "zcl/encoding.h"
 
 namespace zcl {
+namespace {
+const ZclCommandId kDefaultResponse = (ZclCommandId)0x0B;
+// Of requests that are safe to repeat
+const unsigned int kDefaultRetries = 2;
+
+// Response to global commands that have one, apart from the Default Response.
+boost::optional<ZclCommandId> GlobalResponseTo(ZclCommandId command_id) {
+  switch ((uint8_t)command_id) {
+    case 0x00:  // Read Attributes
+      return (ZclCommandId)0x01;
+    case 0x02:  // Write Attributes
+    case 0x03:  // Write Attributes Undivided
+      return (ZclCommandId)0x04;
+    case 0x06:  // Configure Reporting
+      return (ZclCommandId)0x07;
+    case 0x08:  // Read Reporting Configuration
+      return (ZclCommandId)0x09;
+    case 0x0C:  // Discover Attributes
+      return (ZclCommandId)0x0D;
+    case 0x11:  // Discover Commands Received
+      return (ZclCommandId)0x12;
+    case 0x13:  // Discover Commands Generated
+      return (ZclCommandId)0x14;
+    case 0x15:  // Discover Attributes Extended
+      return (ZclCommandId)0x16;
+    default:
+      return boost::none;
+  }
+}
+
+// Whether executing the command twice does no harm.
+bool IsReadOnly(bool is_global_command, ZclCommandId command_id) {
+  if (!is_global_command) {
+    return false;
+  }
+  switch ((uint8_t)command_id) {
+    case 0x00:  // Read Attributes
+    case 0x08:  // Read Reporting Configuration
+    case 0x0C:  // Discover Attributes
+    case 0x11:  // Discover Commands Received
+    case 0x13:  // Discover Commands Generated
+    case 0x15:  // Discover Attributes Extended
+      return true;
+    default:
+      return false;
+  }
+}
+}  // namespace
+
 ZclEndpoint::ZclEndpoint(std::shared_ptr<znp::ZnpApi> znp_api, uint8_t endpoint)
-    : znp_api_(znp_api), endpoint_(endpoint) {}
+    : znp_api_(znp_api),
+      endpoint_(endpoint),
+      next_trans_seq_num_(0),
+      next_attempt_(0) {}
 
 stlab::future<std::shared_ptr<ZclEndpoint>> ZclEndpoint::Create(
     std::shared_ptr<znp::ZnpApi> znp_api, uint8_t endpoint, uint16_t profile_id,
@@ -41,24 +95,38 @@ void ZclEndpoint::OnIncomingMsg(const znp::IncomingMsg& message) {
   if (message.DstEndpoint != endpoint_) {
     return;
   }
-  if (last_msg_[message.SrcAddr] == message.Data) {
+  auto frame = znp::Decode<ZclFrame>(message.Data);
+  // The first response to an outstanding request can't be a duplicate, but
+  // is remembered so retransmissions of it are.
+  if (FindRequest(message, frame) != pending_requests_.end()) {
+    duplicate_filter_.Remember(message.SrcAddr, message.SrcEndpoint,
+                               (ZclClusterId)message.ClusterId,
+                               frame.frame_type, frame.direction,
+                               frame.command_identifier,
+                               frame.transaction_sequence_number);
+  } else if (duplicate_filter_.IsDuplicate(
+                 message.SrcAddr, message.SrcEndpoint,
+                 (ZclClusterId)message.ClusterId, frame.frame_type,
+                 frame.direction, frame.command_identifier,
+                 frame.transaction_sequence_number)) {
     LOG("ZclEndpoint", debug)
         << "Ignoring duplicate message from " << (unsigned int)message.SrcAddr;
     return;
   }
-  last_msg_[message.SrcAddr] = message.Data;
-  auto frame = znp::Decode<ZclFrame>(message.Data);
   if (frame.frame_type == ZclFrameType::Global) {
-    on_command_(message.SrcAddr, message.SrcEndpoint,
+    on_command_(message.SrcAddr, message.SrcEndpoint, message.LinkQuality,
                 (ZclClusterId)message.ClusterId, true, frame.direction,
                 frame.command_identifier, frame.payload);
   } else if (frame.frame_type == ZclFrameType::Local) {
-    on_command_(message.SrcAddr, message.SrcEndpoint,
+    on_command_(message.SrcAddr, message.SrcEndpoint, message.LinkQuality,
                 (ZclClusterId)message.ClusterId, false, frame.direction,
                 frame.command_identifier, frame.payload);
   } else {
     LOG("ZclEndpoint", debug) << "Unknown command type";
   }
+  // Responses are passed on to on_command_ like any other command first, so
+  // its handlers have seen it by the time the request completes.
+  CompleteRequest(message, frame);
 }
 
 stlab::future<void> ZclEndpoint::SendCommand(znp::ShortAddress address,
@@ -68,21 +136,227 @@ stlab::future<void> ZclEndpoint::SendCommand(znp::ShortAddress address,
 											 ZclDirection direction,
                                              ZclCommandId command_id,
                                              std::vector<uint8_t> payload) {
+  auto frame = MakeFrame(is_global_command, direction, command_id,
+                         std::move(payload));
+  return znp_api_->AfDataRequest(address, endpoint, endpoint_,
+                                 (uint16_t)cluster_id, 0, 30,
+                                 znp::Encode(frame));
+}
+
+stlab::future<void> ZclEndpoint::SendCommandExt(
+    znp::IEEEAddress address, uint8_t endpoint, ZclClusterId cluster_id,
+    bool is_global_command, ZclDirection direction, ZclCommandId command_id,
+    std::vector<uint8_t> payload) {
+  auto frame = MakeFrame(is_global_command, direction, command_id,
+                         std::move(payload));
+  return znp_api_->AfDataRequestExt(znp::AddrMode::IEEEAddress, address,
+                                    endpoint, 0, endpoint_,
+                                    (uint16_t)cluster_id, 0, 30,
+                                    znp::Encode(frame));
+}
+
+stlab::future<void> ZclEndpoint::SendGroupCommand(
+    uint16_t group_id, ZclClusterId cluster_id, bool is_global_command,
+    ZclDirection direction, ZclCommandId command_id,
+    std::vector<uint8_t> payload) {
+  auto frame = MakeFrame(is_global_command, direction, command_id,
+                         std::move(payload));
+  // Every member answering with a default response would only flood the
+  // network.
+  frame.disable_default_response = true;
+  // Destination endpoint is ignored for groupcasts.
+  return znp_api_->AfDataRequestExt(znp::AddrMode::Group, group_id, 0xFF, 0,
+                                    endpoint_, (uint16_t)cluster_id, 0, 30,
+                                    znp::Encode(frame));
+}
+
+stlab::future<ZclEndpoint::Response> ZclEndpoint::Request(
+    znp::IEEEAddress address, znp::ShortAddress short_address,
+    uint8_t endpoint, ZclClusterId cluster_id,
+    bool is_global_command, ZclDirection direction, ZclCommandId command_id,
+    std::vector<uint8_t> payload, std::chrono::milliseconds timeout,
+    boost::optional<unsigned int> retries) {
+  auto package = stlab::package<Response(std::exception_ptr, Response)>(
+      stlab::immediate_executor, [](std::exception_ptr exc, Response response) {
+        if (exc != nullptr) {
+          std::rethrow_exception(exc);
+        }
+        return response;
+      });
+  if (pending_requests_.size() >= 0x100) {
+    package.first(std::make_exception_ptr(std::runtime_error(
+                      "No free transaction sequence numbers")),
+                  Response());
+    return package.second;
+  }
+  auto frame =
+      MakeFrame(is_global_command, direction, command_id, std::move(payload));
+  uint8_t trans_seq_number = frame.transaction_sequence_number;
+  pending_requests_[trans_seq_number] = PendingRequest{
+      address,
+      short_address,
+      endpoint,
+      cluster_id,
+      is_global_command,
+      direction,
+      command_id,
+      znp::Encode(frame),
+      timeout,
+      retries.value_or(IsReadOnly(is_global_command, command_id)
+                           ? kDefaultRetries
+                           : 0),
+      0,
+      std::make_shared<boost::asio::deadline_timer>(znp_api_->GetIoService()),
+      package.first};
+  SendRequest(trans_seq_number);
+  return package.second;
+}
+
+void ZclEndpoint::SendRequest(uint8_t trans_seq_number) {
+  auto& request = pending_requests_.at(trans_seq_number);
+  std::weak_ptr<ZclEndpoint> weak_this(shared_from_this());
+  std::size_t attempt = request.attempt = next_attempt_++;
+  request.timer->expires_from_now(
+      boost::posix_time::milliseconds(request.timeout.count()));
+  request.timer->async_wait([weak_this, trans_seq_number,
+                             attempt](const boost::system::error_code& ec) {
+    auto _this = weak_this.lock();
+    if (!ec && _this) {
+      _this->OnAttemptFailed(
+          trans_seq_number, attempt,
+          std::make_exception_ptr(std::runtime_error("Timeout")));
+    }
+  });
+  znp_api_
+      ->AfDataRequestExt(znp::AddrMode::IEEEAddress, request.address,
+                         request.endpoint, 0, endpoint_,
+                         (uint16_t)request.cluster_id, 0, 30, request.frame)
+      .recover([weak_this, trans_seq_number, attempt](stlab::future<void> f) {
+        try {
+          f.get_try();
+        } catch (...) {
+          if (auto _this = weak_this.lock()) {
+            _this->OnAttemptFailed(trans_seq_number, attempt,
+                                   std::current_exception());
+          }
+        }
+      })
+      .detach();
+}
+
+/**
+ * Called when an attempt times out or couldn't be sent. Ignored if the
+ * request has been answered or retried since.
+ */
+void ZclEndpoint::OnAttemptFailed(uint8_t trans_seq_number,
+                                  std::size_t attempt,
+                                  std::exception_ptr exc) {
+  auto found = pending_requests_.find(trans_seq_number);
+  if (found == pending_requests_.end() || found->second.attempt != attempt) {
+    return;
+  }
+  if (found->second.retries_left > 0) {
+    LOG("ZclEndpoint", debug) << "No response to transaction "
+                              << (unsigned int)trans_seq_number
+                              << ", retrying";
+    found->second.retries_left--;
+    SendRequest(trans_seq_number);
+    return;
+  }
+  FailRequest(trans_seq_number, exc);
+}
+
+std::map<uint8_t, ZclEndpoint::PendingRequest>::iterator
+ZclEndpoint::FindRequest(const znp::IncomingMsg& message,
+                         const ZclFrame& frame) {
+  auto found = pending_requests_.find(frame.transaction_sequence_number);
+  if (found == pending_requests_.end()) {
+    return found;
+  }
+  const PendingRequest& request = found->second;
+  // Sequence numbers are only 8 bits and per sender, so other devices reuse
+  // them all the time. Requests are unicast, and so are their responses.
+  if (request.short_address != message.SrcAddr || message.WasBroadcast ||
+      message.GroupId != 0 ||
+      request.cluster_id != (ZclClusterId)message.ClusterId) {
+    return pending_requests_.end();
+  }
+  bool is_global = (frame.frame_type == ZclFrameType::Global);
+  bool matches = false;
+  if (is_global && frame.command_identifier == kDefaultResponse) {
+    // Default Response starts with the command it's responding to.
+    matches = frame.payload.size() >= 1 &&
+              (ZclCommandId)frame.payload[0] == request.command_id;
+  } else if (request.is_global_command) {
+    matches = is_global &&
+              GlobalResponseTo(request.command_id) == frame.command_identifier;
+  } else {
+    matches = !is_global && frame.direction != request.direction;
+  }
+  return matches ? found : pending_requests_.end();
+}
+
+bool ZclEndpoint::CompleteRequest(const znp::IncomingMsg& message,
+                                  const ZclFrame& frame) {
+  auto found = FindRequest(message, frame);
+  if (found == pending_requests_.end()) {
+    return false;
+  }
+  bool is_global = (frame.frame_type == ZclFrameType::Global);
+  auto promise = std::move(found->second.promise);
+  found->second.timer->cancel();
+  pending_requests_.erase(found);
+  promise(nullptr, Response{message.SrcAddr, message.SrcEndpoint,
+                            message.LinkQuality,
+                            (ZclClusterId)message.ClusterId, is_global,
+                            frame.direction, frame.command_identifier,
+                            frame.payload});
+  return true;
+}
+
+void ZclEndpoint::FailRequest(uint8_t trans_seq_number,
+                              std::exception_ptr exc) {
+  auto found = pending_requests_.find(trans_seq_number);
+  if (found == pending_requests_.end()) {
+    return;
+  }
+  auto promise = std::move(found->second.promise);
+  found->second.timer->cancel();
+  pending_requests_.erase(found);
+  promise(exc, Response());
+}
+
+ZclFrame ZclEndpoint::MakeFrame(bool is_global_command, ZclDirection direction,
+                                ZclCommandId command_id,
+                                std::vector<uint8_t> payload) {
   ZclFrame frame;
   frame.frame_type =
       is_global_command ? ZclFrameType::Global : ZclFrameType::Local;
   frame.direction = direction;
   frame.disable_default_response = false;
   frame.reserved = 0;
-  frame.transaction_sequence_number = NextTransSeqNumFor(address);
+  frame.transaction_sequence_number = NextTransSeqNum();
   frame.command_identifier = command_id;
   frame.payload = std::move(payload);
-  return znp_api_->AfDataRequest(address, endpoint, endpoint_,
-                                 (uint16_t)cluster_id, 0, 0, 30,
-                                 znp::Encode(frame));
+  return frame;
 }
 
-uint8_t ZclEndpoint::NextTransSeqNumFor(znp::ShortAddress address) {
-  return send_trans_seq_nums_[address]++;
+DuplicateFilter::Statistics ZclEndpoint::GetDuplicateStatistics() const {
+  return duplicate_filter_.GetStatistics();
+}
+
+/**
+ * Sequence numbers are shared by all destinations, so that they're enough to
+ * tell responses to outstanding requests apart. Numbers still in use by a
+ * request are skipped.
+ */
+uint8_t ZclEndpoint::NextTransSeqNum() {
+  for (std::size_t i = 0; i < 0x100; i++) {
+    uint8_t trans_seq_number = next_trans_seq_num_++;
+    if (pending_requests_.count(trans_seq_number) == 0) {
+      return trans_seq_number;
+    }
+  }
+  return next_trans_seq_num_++;
 }
 }  // namespace zcl
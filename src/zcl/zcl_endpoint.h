@@ -1,5 +1,8 @@
 #ifndef _ZCL_ZCL_ENDPOINT_H_
 #define _ZCL_ZCL_ENDPOINT_H_
+#include <boost/asio/deadline_timer.hpp>
+#include <chrono>
+#include "zcl/duplicate_filter.h"
 #include "zcl/zcl.h"
 #include "znp/znp_api.h"
 
@@ -18,6 +21,16 @@ class ZclEndpoint : public std::enable_shared_from_this<ZclEndpoint> {
     uint8_t trans_seq_number;
     std::vector<std::tuple<zcl::ZclAttributeId, ZclVariant>> attributes;
   };
+  struct Response {
+    znp::ShortAddress source_address;
+    uint8_t source_endpoint;
+    uint8_t link_quality;
+    ZclClusterId cluster_id;
+    bool is_global_command;
+    ZclDirection direction;
+    ZclCommandId command_id;
+    std::vector<uint8_t> payload;
+  };
 
   static stlab::future<std::shared_ptr<ZclEndpoint>> Create(
       std::shared_ptr<znp::ZnpApi> znp_api, uint8_t endpoint,
@@ -31,11 +44,45 @@ class ZclEndpoint : public std::enable_shared_from_this<ZclEndpoint> {
                                   ZclDirection direction,
                                   ZclCommandId command_id,
                                   std::vector<uint8_t> payload);
+  // Sends by IEEE address, leaving the short address lookup to the ZNP.
+  stlab::future<void> SendCommandExt(znp::IEEEAddress address,
+                                     uint8_t endpoint, ZclClusterId cluster_id,
+                                     bool is_global_command,
+                                     ZclDirection direction,
+                                     ZclCommandId command_id,
+                                     std::vector<uint8_t> payload);
+  // Sends a single groupcast to all members of the group.
+  stlab::future<void> SendGroupCommand(uint16_t group_id,
+                                       ZclClusterId cluster_id,
+                                       bool is_global_command,
+                                       ZclDirection direction,
+                                       ZclCommandId command_id,
+                                       std::vector<uint8_t> payload);
+
+  // Sends a command to a single device, and resolves with the response to
+  // it, matched by transaction sequence number and the device's current
+  // short address. That is the corresponding response for global commands
+  // with one, any command in the opposite direction for cluster specific
+  // commands, or a Default Response. The command is retransmitted up to
+  // retries times when no response arrives in time. If only the response got
+  // lost, the device executes it again, so by default only global commands
+  // that merely read are retransmitted. There is no group equivalent, as one
+  // reply can't stand for all members.
+  stlab::future<Response> Request(
+      znp::IEEEAddress address, znp::ShortAddress short_address,
+      uint8_t endpoint, ZclClusterId cluster_id,
+      bool is_global_command, ZclDirection direction, ZclCommandId command_id,
+      std::vector<uint8_t> payload,
+      std::chrono::milliseconds timeout = std::chrono::seconds(5),
+      boost::optional<unsigned int> retries = boost::none);
+
+  DuplicateFilter::Statistics GetDuplicateStatistics() const;
 
   boost::signals2::signal<void(
       znp::ShortAddress source_address, uint8_t source_endpoint,
-      ZclClusterId cluster_id, bool is_global_command, ZclDirection direction,
-      ZclCommandId command_id, std::vector<uint8_t> payload)>
+      uint8_t link_quality, ZclClusterId cluster_id, bool is_global_command,
+      ZclDirection direction, ZclCommandId command_id,
+      std::vector<uint8_t> payload)>
       on_command_;
 
  private:
@@ -44,13 +91,43 @@ class ZclEndpoint : public std::enable_shared_from_this<ZclEndpoint> {
   void OnIncomingMsg(const znp::IncomingMsg& message);
   void OnIncomingReportAttributes(const znp::IncomingMsg& message,
                                   const ZclFrame& frame);
-  uint8_t NextTransSeqNumFor(znp::ShortAddress address);
+  struct PendingRequest {
+    znp::IEEEAddress address;
+    // Where the response has to come from
+    znp::ShortAddress short_address;
+    uint8_t endpoint;
+    ZclClusterId cluster_id;
+    bool is_global_command;
+    ZclDirection direction;
+    ZclCommandId command_id;
+    std::vector<uint8_t> frame;
+    std::chrono::milliseconds timeout;
+    unsigned int retries_left;
+    // Unique over all requests, to recognize callbacks for earlier attempts.
+    std::size_t attempt;
+    std::shared_ptr<boost::asio::deadline_timer> timer;
+    stlab::packaged_task<std::exception_ptr, Response> promise;
+  };
+  ZclFrame MakeFrame(bool is_global_command, ZclDirection direction,
+                     ZclCommandId command_id, std::vector<uint8_t> payload);
+  uint8_t NextTransSeqNum();
+  void SendRequest(uint8_t trans_seq_number);
+  void OnAttemptFailed(uint8_t trans_seq_number, std::size_t attempt,
+                       std::exception_ptr exc);
+  // The outstanding request the frame is a response to, if any.
+  std::map<uint8_t, PendingRequest>::iterator FindRequest(
+      const znp::IncomingMsg& message, const ZclFrame& frame);
+  bool CompleteRequest(const znp::IncomingMsg& message, const ZclFrame& frame);
+  void FailRequest(uint8_t trans_seq_number, std::exception_ptr exc);
 
   std::shared_ptr<znp::ZnpApi> znp_api_;
   const uint8_t endpoint_;
   std::vector<boost::signals2::connection> listeners_;
-  std::map<znp::ShortAddress, uint8_t> send_trans_seq_nums_;
-  std::map<znp::ShortAddress, std::vector<uint8_t>> last_msg_;
+  uint8_t next_trans_seq_num_;
+  std::size_t next_attempt_;
+  // Outstanding requests by transaction sequence number
+  std::map<uint8_t, PendingRequest> pending_requests_;
+  DuplicateFilter duplicate_filter_;
 };
 }  // namespace zcl
 #endif  // _ZCL_ZCL_ENDPOINT_H_
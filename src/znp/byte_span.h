@@ -0,0 +1,45 @@
+#ifndef _ZNP_BYTE_SPAN_H_
+#define _ZNP_BYTE_SPAN_H_
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace znp {
+/**
+ * Non-owning view on a range of bytes, used to pass frames around without
+ * copying them. The referenced memory is only guaranteed to be valid for the
+ * duration of the call it was passed to; use ToVector() to keep the data.
+ */
+class ByteSpan {
+ public:
+  typedef const uint8_t* const_iterator;
+  typedef const_iterator iterator;
+
+  ByteSpan() : data_(nullptr), size_(0) {}
+  ByteSpan(const uint8_t* data, std::size_t size) : data_(data), size_(size) {}
+  ByteSpan(const std::vector<uint8_t>& data)
+      : data_(data.data()), size_(data.size()) {}
+
+  const uint8_t* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+  const uint8_t& operator[](std::size_t index) const { return data_[index]; }
+
+  ByteSpan subspan(std::size_t offset) const {
+    if (offset > size_) {
+      throw std::out_of_range("ByteSpan offset out of range");
+    }
+    return ByteSpan(data_ + offset, size_ - offset);
+  }
+  std::vector<uint8_t> ToVector() const {
+    return std::vector<uint8_t>(begin(), end());
+  }
+
+ private:
+  const uint8_t* data_;
+  std::size_t size_;
+};
+}  // namespace znp
+#endif  // _ZNP_BYTE_SPAN_H_
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <tuple>
 #include <type_traits>
+#include "znp/byte_span.h"
 #include "znp/znp.h"
 
 namespace znp {
@@ -30,8 +31,8 @@ class EncodeHelper<T, std::enable_if_t<std::is_integral<T>::value &&
       *(begin++) = (uint8_t)((value >> shift) & 0xFF);
     }
   }
-  static inline void Decode(T& value, EncodeTarget::const_iterator& begin,
-                            EncodeTarget::const_iterator end) {
+  template <typename I>
+  static inline void Decode(T& value, I& begin, I end) {
     std::size_t bytes = GetSize(0);
     value = 0;
     for (std::size_t shift = 0; shift < bytes * 8; shift += 8) {
@@ -56,8 +57,8 @@ class EncodeHelper<T, std::enable_if_t<std::is_integral<T>::value &&
                             EncodeTarget::iterator end) {
     EncodeHelper<UT>::Encode((UT)value, begin, end);
   }
-  static inline void Decode(T& value, EncodeTarget::const_iterator& begin,
-                            EncodeTarget::const_iterator end) {
+  template <typename I>
+  static inline void Decode(T& value, I& begin, I end) {
     UT unsigned_value = 0;
     EncodeHelper<UT>::Decode(unsigned_value, begin, end);
     value = (T)unsigned_value;
@@ -80,9 +81,8 @@ class EncodeHelper<std::array<T, length>> {
       EncodeHelper<T>::Encode(item, begin, end);
     }
   }
-  static inline void Decode(std::array<T, length>& data,
-                            EncodeTarget::const_iterator& begin,
-                            EncodeTarget::const_iterator end) {
+  template <typename I>
+  static inline void Decode(std::array<T, length>& data, I& begin, I end) {
     for (auto& item : data) {
       EncodeHelper<T>::Decode(item, begin, end);
     }
@@ -106,8 +106,8 @@ class EncodeTupleHelper {
                                                          begin, end);
     EncodeTupleHelper<T, pos - 1>::Encode(value, begin, end);
   }
-  static void Decode(T& value, EncodeTarget::const_iterator& begin,
-                     EncodeTarget::const_iterator end) {
+  template <typename I>
+  static void Decode(T& value, I& begin, I end) {
     EncodeHelper<std::tuple_element_t<index, T>>::Decode(std::get<index>(value),
                                                          begin, end);
     EncodeTupleHelper<T, pos - 1>::Decode(value, begin, end);
@@ -128,8 +128,8 @@ class EncodeTupleHelper<T, 0> {
     EncodeHelper<std::tuple_element_t<index, T>>::Encode(std::get<index>(value),
                                                          begin, end);
   }
-  static void Decode(T& value, EncodeTarget::const_iterator& begin,
-                     EncodeTarget::const_iterator end) {
+  template <typename I>
+  static void Decode(T& value, I& begin, I end) {
     EncodeHelper<std::tuple_element_t<index, T>>::Decode(std::get<index>(value),
                                                          begin, end);
   }
@@ -150,13 +150,12 @@ class EncodeHelper<std::tuple<T...>> {
                       std::tuple_size<std::tuple<T...>>::value -
                           1>::Encode(value, begin, end);
   };
-  static void Decode(std::tuple<T...>& value,
-                     EncodeTarget::const_iterator& begin,
-                     EncodeTarget::const_iterator end) {
+  template <typename I>
+  static void Decode(std::tuple<T...>& value, I& begin, I end) {
     EncodeTupleHelper<std::tuple<T...>,
                       std::tuple_size<std::tuple<T...>>::value -
                           1>::Decode(value, begin, end);
-  };
+  }
 };
 
 template <typename T>
@@ -171,8 +170,8 @@ class EncodeHelper<T, std::enable_if_t<std::is_enum<T>::value>> {
     EncodeHelper<std::underlying_type_t<T>>::Encode(
         (std::underlying_type_t<T>)value, begin, end);
   }
-  static inline void Decode(T& value, EncodeTarget::const_iterator& begin,
-                            EncodeTarget::const_iterator end) {
+  template <typename I>
+  static inline void Decode(T& value, I& begin, I end) {
     std::underlying_type_t<T> temp;
     EncodeHelper<std::underlying_type_t<T>>::Decode(temp, begin, end);
     value = (T)temp;
@@ -204,9 +203,8 @@ class EncodeHelper<std::vector<T>> {
       EncodeHelper<T>::Encode(item, begin, end);
     }
   }
-  static inline void Decode(std::vector<T>& value,
-                            EncodeTarget::const_iterator& begin,
-                            EncodeTarget::const_iterator end) {
+  template <typename I>
+  static inline void Decode(std::vector<T>& value, I& begin, I end) {
     if (begin == end) {
       throw std::runtime_error("Expected vector length");
     }
@@ -224,11 +222,11 @@ struct FusionGetSizeHelper {
     return current + EncodeHelper<T>(t);
   }
 };
+template <typename I>
 struct FusionDecodeHelper {
-  EncodeTarget::const_iterator end;
+  I end;
   template <typename T>
-  EncodeTarget::const_iterator operator()(EncodeTarget::const_iterator begin,
-                                          T& value) {
+  I operator()(I begin, T& value) {
     EncodeHelper<T>::Decode(value, begin, end);
     return begin;
   }
@@ -240,9 +238,9 @@ class EncodeHelper<
   static inline std::size_t GetSize(const T& value) {
     return boost::fusion::accumulate(value, 0, FusionGetSizeHelper{});
   }
-  static inline void Decode(T& value, EncodeTarget::const_iterator& begin,
-                            EncodeTarget::const_iterator end) {
-    begin = boost::fusion::accumulate(value, begin, FusionDecodeHelper{end});
+  template <typename I>
+  static inline void Decode(T& value, I& begin, I end) {
+    begin = boost::fusion::accumulate(value, begin, FusionDecodeHelper<I>{end});
   }
 };
 
@@ -254,8 +252,8 @@ class EncodeHelper<bool> {
                             EncodeTarget::iterator end) {
     EncodeHelper<uint8_t>::Encode(value ? 1 : 0, begin, end);
   }
-  static inline void Decode(bool& value, EncodeTarget::const_iterator& begin,
-                            EncodeTarget::const_iterator end) {
+  template <typename I>
+  static inline void Decode(bool& value, I& begin, I end) {
     uint8_t int_value;
     EncodeHelper<uint8_t>::Decode(int_value, begin, end);
     value = int_value > 0;
@@ -283,9 +281,8 @@ class EncodeHelper<
       numvalue >>= 8;
     }
   }
-  static inline void Decode(std::bitset<N>& value,
-                            EncodeTarget::const_iterator& begin,
-                            EncodeTarget::const_iterator end) {
+  template <typename I>
+  static inline void Decode(std::bitset<N>& value, I& begin, I end) {
     unsigned long long numvalue = 0;
     for (std::size_t i = 0; i < N; i += 8) {
       if (begin == end) {
@@ -369,8 +366,8 @@ struct FloatEncodeHelper {
                  (exponent << MAN) | mantissa;
     EncodeHelper<IT>::Encode(encoded, begin, end);
   }
-  static void Decode(FT& value, znp::EncodeTarget::const_iterator& begin,
-                     znp::EncodeTarget::const_iterator end) {
+  template <typename I>
+  static void Decode(FT& value, I& begin, I end) {
     IT raw_value;
     EncodeHelper<IT>::Decode(raw_value, begin, end);
     bool is_negative = ((raw_value >> (MAN + EXP)) != 0);
@@ -442,9 +439,8 @@ class EncodeHelper<BindTarget> {
     }
     throw std::runtime_error("Unsupported BindTarget");
   }
-  static inline void Decode(BindTarget& value,
-                            EncodeTarget::const_iterator& begin,
-                            EncodeTarget::const_iterator end) {
+  template <typename I>
+  static inline void Decode(BindTarget& value, I& begin, I end) {
     AddrMode mode;
     EncodeHelper<AddrMode>::Decode(mode, begin, end);
     switch (mode) {
@@ -493,16 +489,16 @@ std::vector<uint8_t> Encode(const T& data) {
 inline std::vector<uint8_t> Encode() { return std::vector<uint8_t>(); }
 
 template <typename T>
-T DecodePartial(const std::vector<uint8_t>& data) {
+T DecodePartial(ByteSpan data) {
   T retval;
-  EncodeTarget::const_iterator current = data.begin();
+  ByteSpan::const_iterator current = data.begin();
   EncodeHelper<T>::Decode(retval, current, data.end());
   return retval;
 }
 template <typename T>
-T Decode(const std::vector<uint8_t>& data) {
+T Decode(ByteSpan data) {
   T retval;
-  EncodeTarget::const_iterator current = data.begin();
+  ByteSpan::const_iterator current = data.begin();
   EncodeHelper<T>::Decode(retval, current, data.end());
   if (current != data.end()) {
     throw std::runtime_error("Decoding failure: Not all bytes parsed");
@@ -511,9 +507,9 @@ T Decode(const std::vector<uint8_t>& data) {
 }
 
 template <>
-inline void DecodePartial<void>(const std::vector<uint8_t>& data) {}
+inline void DecodePartial<void>(ByteSpan data) {}
 template <>
-inline void Decode<void>(const std::vector<uint8_t>& data) {
+inline void Decode<void>(ByteSpan data) {
   if (data.size() != 0) {
     throw std::runtime_error("Decoding failure: Expected empty data");
   }
@@ -524,11 +520,11 @@ std::vector<uint8_t> EncodeT(const T&... args) {
   return Encode<std::tuple<T...>>(std::tuple<T...>(args...));
 }
 template <typename... T>
-std::tuple<T...> DecodeT(const std::vector<uint8_t>& data) {
+std::tuple<T...> DecodeT(ByteSpan data) {
   return Decode<std::tuple<T...>>(data);
 }
 template <typename... T>
-std::tuple<T...> DecodePartialT(const std::vector<uint8_t>& data) {
+std::tuple<T...> DecodePartialT(ByteSpan data) {
   return DecodePartial<std::tuple<T...>>(data);
 }
 
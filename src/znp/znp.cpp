@@ -389,8 +389,8 @@ ZnpCommand::ZnpCommand(SapiCommand command)
 ZnpCommand::ZnpCommand(UtilCommand command)
     : value_(ZnpSubsystem::UTIL, (uint8_t)command) {}
 
-ZnpSubsystem ZnpCommand::Subsystem() { return value_.first; }
-uint8_t ZnpCommand::RawCommand() { return value_.second; }
+ZnpSubsystem ZnpCommand::Subsystem() const { return value_.first; }
+uint8_t ZnpCommand::RawCommand() const { return value_.second; }
 bool operator==(const ZnpCommand& a, const ZnpCommand& b) {
   return a.value_ == b.value_;
 }
@@ -226,8 +226,8 @@ class ZnpCommand {
   ZnpCommand(SapiCommand command);
   ZnpCommand(UtilCommand command);
 
-  ZnpSubsystem Subsystem();
-  uint8_t RawCommand();
+  ZnpSubsystem Subsystem() const;
+  uint8_t RawCommand() const;
 
   friend bool operator==(const ZnpCommand& a, const ZnpCommand& b);
   friend bool operator!=(const ZnpCommand& a, const ZnpCommand& b);
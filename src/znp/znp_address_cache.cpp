@@ -0,0 +1,249 @@
+#include "znp/znp_address_cache.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stlab/concurrency/immediate_executor.hpp>
+#include "logging.h"
+
+namespace znp {
+namespace {
+// Returned by the ZNP address manager when the address is unknown.
+const IEEEAddress kInvalidIEEEAddress = 0;
+const ShortAddress kInvalidShortAddress = 0xFFFE;
+// Sleepy end devices may take a few polls to answer.
+const std::chrono::seconds kDeviceLookupTimeout(15);
+
+// Only returns once the data is on disk, so a rename after it can't end up
+// pointing at an empty file after a power loss.
+bool WriteFileSynced(const std::string& filename, const std::string& data) {
+  int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+  std::size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      break;
+    }
+    written += result;
+  }
+  bool synced = written == data.size() && ::fsync(fd) == 0;
+  return ::close(fd) == 0 && synced;
+}
+
+// Makes a rename into the directory of filename durable.
+void SyncDirectoryOf(const std::string& filename) {
+  std::size_t slash = filename.rfind('/');
+  std::string directory =
+      slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+  int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+}  // namespace
+
+AddressCache::AddressCache(std::shared_ptr<ZnpApi> api, std::string filename)
+    : api_(std::move(api)),
+      filename_(std::move(filename)),
+      hits_(0),
+      misses_(0),
+      dirty_(false) {
+  Load();
+  connections_.emplace_back(api_->zdo_on_end_device_announce_.connect(
+      [this](ShortAddress source_address, ShortAddress network_address,
+             IEEEAddress ieee_address, uint8_t capabilities) {
+        Update(network_address, ieee_address);
+      }));
+  connections_.emplace_back(api_->zdo_on_trustcenter_device_.connect(
+      [this](ShortAddress network_address, IEEEAddress ieee_address,
+             ShortAddress parent_address) {
+        Update(network_address, ieee_address);
+      }));
+}
+
+AddressCache::~AddressCache() { Save(); }
+
+stlab::future<IEEEAddress> AddressCache::GetIEEEAddress(ShortAddress address) {
+  auto found = ieee_by_short_.find(address);
+  if (found != ieee_by_short_.end()) {
+    hits_++;
+    return stlab::make_ready_future(found->second, stlab::immediate_executor);
+  }
+  misses_++;
+  // A burst of frames from an unknown device shares the first lookup.
+  auto pending = pending_ieee_lookups_.find(address);
+  if (pending != pending_ieee_lookups_.end()) {
+    return pending->second;
+  }
+  LOG("AddressCache", debug) << "Cache miss for short address "
+                             << boost::format("0x%04X") % address;
+  auto api = api_;
+  std::weak_ptr<AddressCache> weak_this(shared_from_this());
+  auto lookup =
+      api_->UtilAddrmgrNwkAddrLookup(address)
+          .then([](IEEEAddress ieee_address) {
+            if (ieee_address == kInvalidIEEEAddress) {
+              throw std::runtime_error("Address unknown to address manager");
+            }
+            return ieee_address;
+          })
+          .recover([api, address](stlab::future<IEEEAddress> f) {
+            try {
+              return stlab::make_ready_future(*f.get_try(),
+                                              stlab::immediate_executor);
+            } catch (const std::exception& ex) {
+              LOG("AddressCache", debug)
+                  << "Address manager lookup failed (" << ex.what()
+                  << "), asking device";
+              return api
+                  ->ZdoIEEEAddress(
+                      address, boost::none,
+                      std::chrono::milliseconds(kDeviceLookupTimeout))
+                  .then([](const ZdoIEEEAddressResponse& response) {
+                    return response.IEEEAddr;
+                  });
+            }
+          })
+          .recover([weak_this, address](stlab::future<IEEEAddress> f) {
+            auto self = weak_this.lock();
+            if (self) {
+              self->pending_ieee_lookups_.erase(address);
+            }
+            IEEEAddress ieee_address = *f.get_try();
+            if (self) {
+              self->Update(address, ieee_address);
+            }
+            return ieee_address;
+          });
+  if (!lookup.is_ready()) {
+    pending_ieee_lookups_.emplace(address, lookup);
+  }
+  return lookup;
+}
+
+stlab::future<ShortAddress> AddressCache::GetShortAddress(
+    IEEEAddress address) {
+  auto found = short_by_ieee_.find(address);
+  if (found != short_by_ieee_.end()) {
+    hits_++;
+    return stlab::make_ready_future(found->second, stlab::immediate_executor);
+  }
+  misses_++;
+  auto pending = pending_short_lookups_.find(address);
+  if (pending != pending_short_lookups_.end()) {
+    return pending->second;
+  }
+  LOG("AddressCache", debug) << "Cache miss for IEEE address "
+                             << boost::format("%016X") % address;
+  std::weak_ptr<AddressCache> weak_this(shared_from_this());
+  auto lookup = api_->UtilAddrmgrExtAddrLookup(address).recover(
+      [weak_this, address](stlab::future<ShortAddress> f) {
+        auto self = weak_this.lock();
+        if (self) {
+          self->pending_short_lookups_.erase(address);
+        }
+        ShortAddress short_address = *f.get_try();
+        if (short_address >= kInvalidShortAddress) {
+          throw std::runtime_error("Address unknown to address manager");
+        }
+        if (self) {
+          self->Update(short_address, address);
+        }
+        return short_address;
+      });
+  if (!lookup.is_ready()) {
+    pending_short_lookups_.emplace(address, lookup);
+  }
+  return lookup;
+}
+
+void AddressCache::Update(ShortAddress short_address,
+                          IEEEAddress ieee_address) {
+  auto found_short = short_by_ieee_.find(ieee_address);
+  if (found_short != short_by_ieee_.end()) {
+    if (found_short->second == short_address) {
+      return;
+    }
+    LOG("AddressCache", info) << boost::format("%016X") % ieee_address
+                              << " moved from short address "
+                              << boost::format("0x%04X") % found_short->second
+                              << " to "
+                              << boost::format("0x%04X") % short_address;
+    ieee_by_short_.erase(found_short->second);
+  }
+  auto found_ieee = ieee_by_short_.find(short_address);
+  if (found_ieee != ieee_by_short_.end()) {
+    // Short address was reassigned to a different device.
+    short_by_ieee_.erase(found_ieee->second);
+  }
+  ieee_by_short_[short_address] = ieee_address;
+  short_by_ieee_[ieee_address] = short_address;
+  dirty_ = true;
+}
+
+AddressCache::Statistics AddressCache::GetStatistics() const {
+  return Statistics{ieee_by_short_.size(), hits_, misses_};
+}
+
+void AddressCache::Load() {
+  if (filename_.empty()) {
+    return;
+  }
+  std::ifstream file(filename_);
+  if (!file) {
+    LOG("AddressCache", info) << "No address cache found at " << filename_;
+    return;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream stream(line);
+    IEEEAddress ieee_address;
+    ShortAddress short_address;
+    if (!(stream >> std::hex >> ieee_address >> short_address)) {
+      LOG("AddressCache", warning) << "Ignoring malformed line '" << line
+                                   << "' in " << filename_;
+      continue;
+    }
+    short_by_ieee_[ieee_address] = short_address;
+    ieee_by_short_[short_address] = ieee_address;
+  }
+  LOG("AddressCache", info) << "Loaded " << ieee_by_short_.size()
+                            << " addresses from " << filename_;
+}
+
+void AddressCache::Save() {
+  if (filename_.empty() || !dirty_) {
+    return;
+  }
+  // Write to a temporary file first and move it in place, so a crash halfway
+  // through never leaves a truncated cache behind.
+  std::string temp_filename = filename_ + ".tmp";
+  std::ostringstream data;
+  for (const auto& entry : short_by_ieee_) {
+    data << boost::format("%016X %04X\n") % entry.first % entry.second;
+  }
+  if (!WriteFileSynced(temp_filename, data.str())) {
+    LOG("AddressCache", warning) << "Unable to write " << temp_filename;
+    return;
+  }
+  if (std::rename(temp_filename.c_str(), filename_.c_str()) != 0) {
+    LOG("AddressCache", warning) << "Unable to move " << temp_filename
+                                 << " to " << filename_;
+    return;
+  }
+  SyncDirectoryOf(filename_);
+  dirty_ = false;
+}
+}  // namespace znp
@@ -0,0 +1,62 @@
+#ifndef _ZNP_ADDRESS_CACHE_H_
+#define _ZNP_ADDRESS_CACHE_H_
+#include <boost/signals2/connection.hpp>
+#include <map>
+#include <memory>
+#include <stlab/concurrency/future.hpp>
+#include <string>
+#include <vector>
+#include "znp/znp.h"
+#include "znp/znp_api.h"
+
+namespace znp {
+/**
+ * Bidirectional cache of short (network) to IEEE address mappings, so that
+ * translating addresses of known devices doesn't need a round trip to the ZNP.
+ *
+ * The cache is kept up to date from device announcements and trust center
+ * notifications, where a device rejoining with a new short address replaces
+ * its old mapping. On a miss the ZNP address manager is asked, falling back to
+ * a ZDO IEEE address request to the device itself. Misses for an address
+ * that is already being looked up share that lookup.
+ *
+ * If a filename is given, the cache is loaded from it on creation. Save()
+ * writes it back if it changed, which is to be called periodically, so a burst
+ * of announcements doesn't rewrite the file for every one of them.
+ */
+class AddressCache : public std::enable_shared_from_this<AddressCache> {
+ public:
+  struct Statistics {
+    std::size_t entries;
+    std::uint64_t hits;
+    std::uint64_t misses;
+  };
+
+  AddressCache(std::shared_ptr<ZnpApi> api, std::string filename = "");
+  ~AddressCache();
+
+  stlab::future<IEEEAddress> GetIEEEAddress(ShortAddress address);
+  stlab::future<ShortAddress> GetShortAddress(IEEEAddress address);
+  // Adds or replaces the mapping, removing any stale entries for either
+  // address.
+  void Update(ShortAddress short_address, IEEEAddress ieee_address);
+
+  Statistics GetStatistics() const;
+  void Save();
+
+ private:
+  void Load();
+
+  std::shared_ptr<ZnpApi> api_;
+  std::string filename_;
+  std::map<ShortAddress, IEEEAddress> ieee_by_short_;
+  std::map<IEEEAddress, ShortAddress> short_by_ieee_;
+  std::map<ShortAddress, stlab::future<IEEEAddress>> pending_ieee_lookups_;
+  std::map<IEEEAddress, stlab::future<ShortAddress>> pending_short_lookups_;
+  std::uint64_t hits_;
+  std::uint64_t misses_;
+  bool dirty_;
+  std::vector<boost::signals2::scoped_connection> connections_;
+};
+}  // namespace znp
+#endif  // _ZNP_ADDRESS_CACHE_H_
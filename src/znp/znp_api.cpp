@@ -1,4 +1,5 @@
 #include "znp/znp_api.h"
+#include <algorithm>
 #include <boost/asio/deadline_timer.hpp>
 #include <sstream>
 #include <stlab/concurrency/immediate_executor.hpp>
@@ -7,13 +8,26 @@
 #include "znp/encoding.h"
 
 namespace znp {
+namespace {
+const uint8_t kAfAddrBroadcast = 0x0F;
+}  // namespace
+
 ZnpApi::ZnpApi(boost::asio::io_service& io_service,
                std::shared_ptr<ZnpRawInterface> interface)
     : io_service_(io_service),
       raw_(std::move(interface)),
       on_frame_connection_(raw_->on_frame_.connect(
           std::bind(&ZnpApi::OnFrame, this, std::placeholders::_1,
-                    std::placeholders::_2, std::placeholders::_3))) {
+                    std::placeholders::_2, std::placeholders::_3))),
+      next_handler_id_(0),
+      dispatch_depth_(0),
+      sreq_in_flight_(false),
+      sreq_priority_(SReqPriority::Normal),
+      sreq_timeout_(5000),
+      sreq_statistics_{},
+      data_request_window_(4),
+      data_confirm_timeout_(10000),
+      next_trans_id_(0) {
   AddSimpleEventHandler(ZnpCommandType::AREQ, SysCommand::RESET_IND,
                         sys_on_reset_, false);
   AddSimpleEventHandler(ZnpCommandType::AREQ, ZdoCommand::STATE_CHANGE_IND,
@@ -28,6 +42,33 @@ ZnpApi::ZnpApi(boost::asio::io_service& io_service,
   // decoding.
   AddSimpleEventHandler(ZnpCommandType::AREQ, AfCommand::INCOMING_MSG,
                         af_on_incoming_msg_, true);
+  AddHandler(ZnpCommandType::AREQ, {AfCommand::DATA_CONFIRM},
+             [this](const ZnpCommandType& type, const ZnpCommand& command,
+                    ByteSpan data) -> FrameHandlerAction {
+               ZnpStatus status;
+               DataRequestKey key;
+               try {
+                 std::tie(status, std::get<0>(key), std::get<1>(key)) =
+                     znp::DecodeT<ZnpStatus, uint8_t, uint8_t>(data);
+               } catch (const std::exception& exc) {
+                 LOG("ZnpApi", warning)
+                     << "Unable to parse AF_DATA_CONFIRM: " << exc.what();
+                 return {false, false};
+               }
+               std::exception_ptr exc;
+               if (status != ZnpStatus::Success) {
+                 std::stringstream ss;
+                 ss << "AF_DATA_CONFIRM status " << (unsigned int)status;
+                 exc = std::make_exception_ptr(std::runtime_error(ss.str()));
+               }
+               if (!OnDataRequestDone(key, exc)) {
+                 LOG("ZnpApi", debug)
+                     << "Unexpected AF_DATA_CONFIRM for endpoint "
+                     << (unsigned int)std::get<0>(key) << ", TransId "
+                     << (unsigned int)std::get<1>(key);
+               }
+               return {false, false};
+             });
 }
 
 stlab::future<ResetInfo> ZnpApi::SysReset(bool soft_reset) {
@@ -57,8 +98,7 @@ stlab::future<void> ZnpApi::SysOsalNvItemInitRaw(
 stlab::future<std::vector<uint8_t>> ZnpApi::SysOsalNvReadRaw(NvItemId Id,
                                                              uint8_t Offset) {
   return RawSReq(SysCommand::OSAL_NV_READ, znp::EncodeT(Id, Offset))
-      .then(&ZnpApi::CheckStatus)
-      .then(&znp::Decode<std::vector<uint8_t>>);
+      .then(&ZnpApi::DecodeWithStatus<std::vector<uint8_t>>);
 }
 
 stlab::future<void> ZnpApi::SysOsalNvWriteRaw(NvItemId Id, uint8_t Offset,
@@ -91,30 +131,122 @@ stlab::future<void> ZnpApi::AfRegister(uint8_t endpoint, uint16_t profile_id,
 stlab::future<void> ZnpApi::AfDataRequest(ShortAddress DstAddr,
                                           uint8_t DstEndpoint,
                                           uint8_t SrcEndpoint,
-                                          uint16_t ClusterId, uint8_t TransId,
-                                          uint8_t Options, uint8_t Radius,
+                                          uint16_t ClusterId, uint8_t Options,
+                                          uint8_t Radius,
                                           std::vector<uint8_t> Data) {
-  return WaitAfter(
-             RawSReq(AfCommand::DATA_REQUEST,
-                     znp::EncodeT(DstAddr, DstEndpoint, SrcEndpoint, ClusterId,
-                                  TransId, Options, Radius, Data))
-                 .then(CheckOnlyStatus),
-             ZnpCommandType::AREQ, AfCommand::DATA_CONFIRM)
-      .then(&CheckStatus)
-      .then(&znp::DecodeT<uint8_t, uint8_t>)
-      .then([DstEndpoint,
-             TransId](const std::tuple<uint8_t, uint8_t>& response) {
-        // TODO: I would love some better management of request/response, e.g.
-        // matching the endpoint and transid instead of only the DATA_CONFIRM
-        // message.
-        if (std::make_tuple(DstEndpoint, TransId) != response) {
-          LOG("ZnpApi", warning)
-              << "AF_DATA_REQUEST & AF_DATA_CONFIRM synchronization mismatch!";
-          throw std::runtime_error(
-              "AF_DATA_REQUEST & AF_DATA_CONFIRM synchronization mismatch!");
+  return QueueDataRequest(
+      AfCommand::DATA_REQUEST, SrcEndpoint,
+      [DstAddr, DstEndpoint, SrcEndpoint, ClusterId, Options, Radius,
+       Data{std::move(Data)}](uint8_t TransId) {
+        return znp::EncodeT(DstAddr, DstEndpoint, SrcEndpoint, ClusterId,
+                            TransId, Options, Radius, Data);
+      });
+}
+
+stlab::future<void> ZnpApi::AfDataRequestExt(
+    AddrMode DstAddrMode, uint64_t DstAddr, uint8_t DstEndpoint,
+    uint16_t DstPanId, uint8_t SrcEndpoint, uint16_t ClusterId, uint8_t Options,
+    uint8_t Radius, std::vector<uint8_t> Data) {
+  return QueueDataRequest(
+      AfCommand::DATA_REQUEST_EXT, SrcEndpoint,
+      [DstAddrMode, DstAddr, DstEndpoint, DstPanId, SrcEndpoint, ClusterId,
+       Options, Radius, Data{std::move(Data)}](uint8_t TransId) {
+        // AddrMode::Broadcast is the ZDO value, AF_DATA_REQUEST_EXT uses
+        // afAddrBroadcast instead.
+        uint8_t mode = DstAddrMode == AddrMode::Broadcast
+                           ? kAfAddrBroadcast
+                           : (uint8_t)DstAddrMode;
+        // Unlike AF_DATA_REQUEST, the address is always 8 bytes, and the data
+        // has a 16-bit length.
+        auto payload = znp::EncodeT(mode, DstAddr, DstEndpoint, DstPanId,
+                                    SrcEndpoint, ClusterId, TransId, Options,
+                                    Radius, (uint16_t)Data.size());
+        payload.insert(payload.end(), Data.begin(), Data.end());
+        return payload;
+      });
+}
+
+stlab::future<void> ZnpApi::QueueDataRequest(
+    ZnpCommand command, uint8_t SrcEndpoint,
+    std::function<std::vector<uint8_t>(uint8_t)> encode) {
+  auto package = stlab::package<void(std::exception_ptr)>(
+      stlab::immediate_executor, [](std::exception_ptr exc) {
+        if (exc != nullptr) {
+          std::rethrow_exception(exc);
         }
       });
-  ;
+  data_request_queue_.push_back(PendingDataRequest{
+      command, SrcEndpoint, std::move(encode), package.first});
+  SendNextDataRequests();
+  return package.second;
+}
+
+void ZnpApi::SetAfDataRequestWindow(std::size_t window) {
+  // At most 256 TransIds per endpoint, and at least one request should be
+  // allowed through.
+  window = std::max<std::size_t>(window, 1);
+  data_request_window_ = std::min<std::size_t>(window, 256);
+  SendNextDataRequests();
+}
+
+void ZnpApi::SetAfDataConfirmTimeout(std::chrono::milliseconds timeout) {
+  data_confirm_timeout_ = timeout;
+}
+
+void ZnpApi::SendNextDataRequests() {
+  while (data_requests_in_flight_.size() < data_request_window_ &&
+         !data_request_queue_.empty()) {
+    PendingDataRequest request(std::move(data_request_queue_.front()));
+    data_request_queue_.pop_front();
+    // Skip TransIds that are still waiting for their confirmation, the window
+    // guarantees there's a free one.
+    DataRequestKey key(request.SrcEndpoint, next_trans_id_++);
+    while (data_requests_in_flight_.count(key) > 0) {
+      std::get<1>(key) = next_trans_id_++;
+    }
+    auto timer = std::make_shared<boost::asio::deadline_timer>(io_service_);
+    data_requests_in_flight_[key] =
+        DataRequestInFlight{std::move(request.promise), timer};
+    timer->expires_from_now(
+        boost::posix_time::milliseconds(data_confirm_timeout_.count()));
+    timer->async_wait([this, key, timer](const boost::system::error_code& ec) {
+      auto found = data_requests_in_flight_.find(key);
+      // The TransId may have been reused by a newer request in the mean time.
+      if (ec || found == data_requests_in_flight_.end() ||
+          found->second.timer != timer) {
+        return;
+      }
+      LOG("ZnpApi", warning) << "Timeout waiting for AF_DATA_CONFIRM";
+      OnDataRequestDone(key, std::make_exception_ptr(std::runtime_error(
+                                 "Timeout waiting for AF_DATA_CONFIRM")));
+    });
+    // On success the request is completed by the AF_DATA_CONFIRM handler. If
+    // the request was refused, no confirmation will follow.
+    RawSReq(request.command, request.encode(std::get<1>(key)))
+        .then(CheckOnlyStatus)
+        .recover([this, key](stlab::future<void> f) {
+          try {
+            f.get_try();
+          } catch (...) {
+            OnDataRequestDone(key, std::current_exception());
+          }
+        })
+        .detach();
+  }
+}
+
+bool ZnpApi::OnDataRequestDone(const DataRequestKey& key,
+                               std::exception_ptr exc) {
+  auto found = data_requests_in_flight_.find(key);
+  if (found == data_requests_in_flight_.end()) {
+    return false;
+  }
+  auto promise = std::move(found->second.promise);
+  found->second.timer->cancel();
+  data_requests_in_flight_.erase(found);
+  SendNextDataRequests();
+  promise(exc);
+  return true;
 }
 
 stlab::future<StartupFromAppResponse> ZnpApi::ZdoStartupFromApp(
@@ -170,15 +302,51 @@ stlab::future<uint16_t> ZnpApi::ZdoMgmtPermitJoin(AddrMode addr_mode,
 }
 
 stlab::future<ZdoIEEEAddressResponse> ZnpApi::ZdoIEEEAddress(
-    ShortAddress address, boost::optional<uint8_t> children_index) {
-  return WaitAfter(RawSReq(ZdoCommand::IEEE_ADDR_REQ,
-                           znp::EncodeT<ShortAddress, bool, uint8_t>(
-                               address, !!children_index,
-                               children_index ? *children_index : 0))
-                       .then(&ZnpApi::CheckOnlyStatus),
-                   ZnpCommandType::AREQ, ZdoCommand::IEEE_ADDR_RSP)
-      .then(&ZnpApi::CheckStatus)
-      .then(&znp::Decode<ZdoIEEEAddressResponse>);
+    ShortAddress address, boost::optional<uint8_t> children_index,
+    std::chrono::milliseconds timeout) {
+  // TODO: Fix lifetime issues here, as in WaitAfter!
+  auto f =
+      RawSReq(ZdoCommand::IEEE_ADDR_REQ,
+              znp::EncodeT<ShortAddress, bool, uint8_t>(
+                  address, !!children_index,
+                  children_index ? *children_index : 0))
+          .then(&ZnpApi::CheckOnlyStatus)
+          .then([this, address, timeout]() {
+            auto package = stlab::package<std::vector<uint8_t>(
+                std::exception_ptr, std::vector<uint8_t>)>(
+                stlab::immediate_executor,
+                [](std::exception_ptr exc, std::vector<uint8_t> retval) {
+                  if (exc != nullptr) {
+                    std::rethrow_exception(exc);
+                  }
+                  return retval;
+                });
+            AddHandlerWithTimeout(
+                boost::posix_time::milliseconds(timeout.count()),
+                ZnpCommandType::AREQ, {ZdoCommand::IEEE_ADDR_RSP},
+                [promise{package.first}, address](
+                    const ZnpCommandType& recvd_type,
+                    const ZnpCommand& recvd_command,
+                    ByteSpan data) -> FrameHandlerAction {
+                  // Status & IEEEAddr come before the NwkAddr the response
+                  // is about, which is there whatever the status.
+                  if (data.size() < 11 ||
+                      (ShortAddress)(data[9] | (data[10] << 8)) != address) {
+                    return {false, false};
+                  }
+                  promise(nullptr, data.ToVector());
+                  return {true, true};
+                },
+                [promise{package.first}]() {
+                  promise(std::make_exception_ptr(std::runtime_error(
+                              "Timeout waiting for IEEE_ADDR_RSP")),
+                          std::vector<uint8_t>());
+                });
+            return package.second;
+          })
+          .then(&ZnpApi::DecodeWithStatus<ZdoIEEEAddressResponse>);
+  f.detach();
+  return f;
 }
 
 stlab::future<void> ZnpApi::ZdoRemoveLinkKey(IEEEAddress IEEEAddr) {
@@ -188,8 +356,8 @@ stlab::future<void> ZnpApi::ZdoRemoveLinkKey(IEEEAddress IEEEAddr) {
 stlab::future<std::tuple<IEEEAddress, std::array<uint8_t, 16>>>
 ZnpApi::ZdoGetLinkKey(IEEEAddress IEEEAddr) {
   return RawSReq(ZdoCommand::GET_LINK_KEY, znp::Encode(IEEEAddr))
-      .then(&ZnpApi::CheckStatus)
-      .then(&znp::Decode<std::tuple<IEEEAddress, std::array<uint8_t, 16>>>);
+      .then(&ZnpApi::DecodeWithStatus<
+            std::tuple<IEEEAddress, std::array<uint8_t, 16>>>);
 }
 
 stlab::future<void> ZnpApi::ZdoBind(ShortAddress DstAddr,
@@ -224,8 +392,8 @@ ZnpApi::ZdoMgmtBindReq(ShortAddress DstAddr, uint8_t StartIndex) {
                        .then(&ZnpApi::CheckOnlyStatus),
                    ZnpCommandType::AREQ, ZdoCommand::MGMT_BIND_RSP, 15,
                    znp::Encode(DstAddr))
-      .then(&ZnpApi::CheckStatus)
-      .then(&znp::DecodeT<uint8_t, uint8_t, std::vector<BindTableEntry>>);
+      .then(&ZnpApi::DecodeWithStatus<
+            std::tuple<uint8_t, uint8_t, std::vector<BindTableEntry>>>);
 }
 
 stlab::future<void> ZnpApi::ZdoExtRemoveGroup(uint8_t Endpoint,
@@ -252,12 +420,12 @@ stlab::future<std::vector<uint16_t>> ZnpApi::ZdoExtFindAllGroupsEndpoint(
 stlab::future<std::string> ZnpApi::ZdoExtFindGroup(uint8_t Endpoint,
                                                    uint16_t GroupID) {
   return RawSReq(ZdoCommand::EXT_FIND_GROUP, znp::EncodeT(Endpoint, GroupID))
-      .then(&ZnpApi::CheckStatus)
-      .then([GroupID](const std::vector<uint8_t>& result) -> std::string {
+      .then([GroupID](const std::vector<uint8_t>& response) -> std::string {
         uint16_t ReceiveGroupId;
         std::vector<uint8_t> GroupName;
         std::tie(ReceiveGroupId, GroupName) =
-            znp::DecodePartialT<uint16_t, std::vector<uint8_t>>(result);
+            znp::DecodePartialT<uint16_t, std::vector<uint8_t>>(
+                CheckStatus(response));
         if (ReceiveGroupId != GroupID) {
           throw std::runtime_error(
               "Received GroupID did not match requested GroupID");
@@ -285,8 +453,8 @@ stlab::future<uint8_t> ZnpApi::ZdoExtCountAllGroups() {
 stlab::future<std::vector<uint8_t>> ZnpApi::SapiReadConfigurationRaw(
     ConfigurationOption option) {
   return RawSReq(SapiCommand::READ_CONFIGURATION, znp::Encode(option))
-      .then(&CheckStatus)
-      .then(&znp::Decode<std::tuple<ConfigurationOption, std::vector<uint8_t>>>)
+      .then(&DecodeWithStatus<
+            std::tuple<ConfigurationOption, std::vector<uint8_t>>>)
       .then([option](const std::tuple<ConfigurationOption,
                                       std::vector<uint8_t>>& retval) {
         if (option != std::get<0>(retval)) {
@@ -330,19 +498,39 @@ stlab::future<ShortAddress> ZnpApi::UtilAddrmgrExtAddrLookup(
 }
 
 void ZnpApi::OnFrame(ZnpCommandType type, ZnpCommand command,
-                     const std::vector<uint8_t>& payload) {
-  for (auto it = handlers_.begin(); it != handlers_.end();) {
-    auto action = (*it)(type, command, payload);
-    if (action.remove_me) {
-      it = handlers_.erase(it);
-    } else {
-      it++;
+                     ByteSpan payload) {
+  bool handled = false;
+  auto found = handlers_.find(MakeHandlerKey(type, command));
+  if (found != handlers_.end()) {
+    // Handlers removed while dispatching are only deactivated, so the iterator
+    // stays valid. They're erased once the outermost dispatch is done.
+    dispatch_depth_++;
+    for (auto& entry : found->second) {
+      if (!entry.active || payload.size() < entry.data_prefix.size() ||
+          !std::equal(entry.data_prefix.begin(), entry.data_prefix.end(),
+                      payload.begin())) {
+        continue;
+      }
+      auto action = entry.handler(type, command, payload);
+      if (action.remove_me) {
+        RemoveHandler(entry.id);
+      }
+      if (action.stop_processing) {
+        handled = true;
+        break;
+      }
     }
-    if (action.stop_processing) {
-      return;
+    dispatch_depth_--;
+    if (dispatch_depth_ == 0) {
+      for (const auto& registration : deferred_removals_) {
+        handlers_[registration.first].erase(registration.second);
+      }
+      deferred_removals_.clear();
     }
   }
-  LOG("ZnpApi", debug) << "Unhandled frame " << type << " " << command;
+  if (!handled) {
+    LOG("ZnpApi", debug) << "Unhandled frame " << type << " " << command;
+  }
 }
 
 stlab::future<DeviceState> ZnpApi::WaitForState(
@@ -406,30 +594,20 @@ stlab::future<std::vector<uint8_t>> ZnpApi::WaitFor(
         }
         return retval;
       });
+  std::size_t prefix_size = data_prefix.size();
   AddHandlerWithTimeout(
-      timeout_in_seconds,
-      [promise{package.first}, type, command,
-       data_prefix{std::move(data_prefix)}](
+      boost::posix_time::seconds(timeout_in_seconds), type, {command},
+      [promise{package.first}, prefix_size](
           const ZnpCommandType& recvd_type, const ZnpCommand& recvd_command,
-          const std::vector<uint8_t>& data) -> FrameHandlerAction {
-        if (recvd_type == type && recvd_command == command &&
-            data.size() >= data_prefix.size() &&
-            memcmp(&data[0], &data_prefix[0], data_prefix.size()) == 0) {
-          if (data_prefix.size() == 0) {
-            promise(nullptr, data);
-          } else {
-            promise(nullptr,
-                    std::vector<uint8_t>(data.cbegin() + data_prefix.size(),
-                                         data.cend()));
-          }
-          return {true, true};
-        }
-        return {false, false};
+          ByteSpan data) -> FrameHandlerAction {
+        promise(nullptr, data.subspan(prefix_size).ToVector());
+        return {true, true};
       },
       [promise{package.first}]() {
         promise(std::make_exception_ptr(std::runtime_error("Timeout")),
                 std::vector<uint8_t>());
-      });
+      },
+      std::move(data_prefix));
   return package.second;
 }
 
@@ -463,20 +641,45 @@ stlab::future<std::vector<uint8_t>> ZnpApi::RawSReq(
         }
         return data;
       });
-  handlers_.push_back([package, possible_responses](
-                          const ZnpCommandType& type,
-                          const ZnpCommand& recvd_command,
-                          const std::vector<uint8_t>& data)
-                          -> FrameHandlerAction {
-    // Normal response
-    if (type == ZnpCommandType::SRSP &&
-        possible_responses.find(recvd_command) != possible_responses.end()) {
-      package.first(nullptr, data);
-      return {true, true};
+  sreq_queues_[(std::size_t)sreq_priority_].push_back(
+      PendingSReq{command, std::move(possible_responses), payload,
+                  package.first, std::chrono::steady_clock::now()});
+  SendNextSReq();
+  return package.second;
+}
+
+void ZnpApi::SendNextSReq() {
+  if (sreq_in_flight_) {
+    return;
+  }
+  for (auto& queue : sreq_queues_) {
+    if (queue.empty()) {
+      continue;
     }
-    // Possible RPC_Error response
-    if (type == ZnpCommandType::SRSP &&
-        recvd_command == ZnpCommand(ZnpSubsystem::RPC_Error, 0)) {
+    PendingSReq request(std::move(queue.front()));
+    queue.pop_front();
+    sreq_in_flight_ = true;
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - request.queued_at);
+    sreq_statistics_.last_wait = wait;
+    sreq_statistics_.max_wait = std::max(sreq_statistics_.max_wait, wait);
+    sreq_statistics_.total_wait += wait;
+
+    auto promise = request.promise;
+    const ZnpCommand rpc_error(ZnpSubsystem::RPC_Error, 0);
+    auto handler = [this, promise,
+                    possible_responses = request.possible_responses,
+                    rpc_error](const ZnpCommandType& type,
+                               const ZnpCommand& recvd_command,
+                               ByteSpan data) -> FrameHandlerAction {
+      // Normal response
+      if (recvd_command != rpc_error) {
+        sreq_statistics_.completed++;
+        OnSReqDone();
+        promise(nullptr, data.ToVector());
+        return {true, true};
+      }
+      // Possible RPC_Error response
       try {
         auto info = znp::DecodeT<uint8_t, uint8_t, uint8_t>(data);
         ZnpCommand err_command((ZnpSubsystem)(std::get<1>(info) & 0xF),
@@ -486,18 +689,113 @@ stlab::future<std::vector<uint8_t>> ZnpApi::RawSReq(
             possible_responses.find(err_command) != possible_responses.end()) {
           std::stringstream ss;
           ss << "RPC Error: " << (unsigned int)std::get<0>(info);
-          package.first(std::make_exception_ptr(std::runtime_error(ss.str())),
-                        std::vector<uint8_t>());
+          sreq_statistics_.completed++;
+          OnSReqDone();
+          promise(std::make_exception_ptr(std::runtime_error(ss.str())),
+                  std::vector<uint8_t>());
           return {true, true};
         }
       } catch (const std::exception& exc) {
         LOG("ZnpApi", debug) << "Unable to parse RPCError";
       }
+      return {false, false};
+    };
+    auto timeout_handler = [this, promise, command = request.command]() {
+      LOG("ZnpApi", warning) << "Timeout waiting for SRSP to " << command;
+      sreq_statistics_.timeouts++;
+      OnSReqDone();
+      promise(std::make_exception_ptr(std::runtime_error("SREQ timeout")),
+              std::vector<uint8_t>());
+    };
+    // Registered for both the normal responses and RPC_Error, whichever claims
+    // the frame first removes the handler for all of them.
+    std::set<ZnpCommand> commands(request.possible_responses);
+    commands.insert(rpc_error);
+    HandlerId id = AddHandlerWithTimeout(
+        boost::posix_time::milliseconds(sreq_timeout_.count()),
+        ZnpCommandType::SRSP, commands, std::move(handler),
+        std::move(timeout_handler));
+    try {
+      raw_->SendFrame(ZnpCommandType::SREQ, request.command, request.payload);
+    } catch (const std::exception& exc) {
+      RemoveHandler(id);
+      sreq_in_flight_ = false;
+      SendNextSReq();
+      promise(std::current_exception(), std::vector<uint8_t>());
     }
-    return {false, false};
-  });
-  raw_->SendFrame(ZnpCommandType::SREQ, command, payload);
-  return package.second;
+    return;
+  }
+}
+
+void ZnpApi::OnSReqDone() {
+  sreq_in_flight_ = false;
+  // Issue the next request before handing out the result, so requests
+  // issued from continuations don't jump the queue.
+  SendNextSReq();
+}
+
+void ZnpApi::SetSReqTimeout(std::chrono::milliseconds timeout) {
+  sreq_timeout_ = timeout;
+}
+
+ZnpApi::SReqStatistics ZnpApi::GetSReqStatistics() const {
+  SReqStatistics statistics(sreq_statistics_);
+  for (std::size_t i = 0; i < sreq_queues_.size(); i++) {
+    statistics.queue_depth[i] = sreq_queues_[i].size();
+  }
+  statistics.in_flight = sreq_in_flight_;
+  return statistics;
+}
+
+ZnpApi::PriorityScope::PriorityScope(ZnpApi& api, SReqPriority priority)
+    : api_(api), previous_(api.sreq_priority_) {
+  api_.sreq_priority_ = priority;
+}
+
+ZnpApi::PriorityScope::~PriorityScope() { api_.sreq_priority_ = previous_; }
+
+ZnpApi::HandlerKey ZnpApi::MakeHandlerKey(ZnpCommandType type,
+                                          const ZnpCommand& command) {
+  return (HandlerKey)((((unsigned int)type & 0xF) << 12) |
+                      (((unsigned int)command.Subsystem() & 0xF) << 8) |
+                      command.RawCommand());
+}
+
+/**
+ * Registers handler for frames of the given type and any of the given
+ * commands. The returned id can be used to remove it from all of them at once.
+ */
+ZnpApi::HandlerId ZnpApi::AddHandler(ZnpCommandType type,
+                                     const std::set<ZnpCommand>& commands,
+                                     FrameHandler handler,
+                                     std::vector<uint8_t> data_prefix) {
+  HandlerId id = next_handler_id_++;
+  auto& registrations = handler_registrations_[id];
+  for (const auto& command : commands) {
+    HandlerKey key = MakeHandlerKey(type, command);
+    auto& list = handlers_[key];
+    registrations.emplace_back(
+        key, list.insert(list.end(),
+                         HandlerEntry{id, data_prefix, handler, true}));
+  }
+  return id;
+}
+
+bool ZnpApi::RemoveHandler(HandlerId id) {
+  auto found = handler_registrations_.find(id);
+  if (found == handler_registrations_.end()) {
+    return false;
+  }
+  for (const auto& registration : found->second) {
+    if (dispatch_depth_ > 0) {
+      registration.second->active = false;
+      deferred_removals_.push_back(registration);
+    } else {
+      handlers_[registration.first].erase(registration.second);
+    }
+  }
+  handler_registrations_.erase(found);
+  return true;
 }
 
 /**
@@ -505,48 +803,38 @@ stlab::future<std::vector<uint8_t>> ZnpApi::RawSReq(
  * returns it should be removed. Timeout handler will be called when the timeout
  * expires, and the handler hasn't been removed yet.
  */
-void ZnpApi::AddHandlerWithTimeout(int timeout_in_seconds, FrameHandler handler,
-                                   TimeoutHandler timeout_handler) {
-  if (timeout_in_seconds <= 0) {
-    handlers_.push_back(handler);
-    return;
+ZnpApi::HandlerId ZnpApi::AddHandlerWithTimeout(
+    boost::posix_time::time_duration timeout, ZnpCommandType type,
+    const std::set<ZnpCommand>& commands, FrameHandler handler,
+    TimeoutHandler timeout_handler, std::vector<uint8_t> data_prefix) {
+  if (timeout <= boost::posix_time::time_duration()) {
+    return AddHandler(type, commands, std::move(handler),
+                      std::move(data_prefix));
   }
-  struct HandlerTimeoutInfo {
-    bool active;
-    boost::asio::deadline_timer timer;
-
-    HandlerTimeoutInfo(boost::asio::io_service& io_service)
-        : timer(io_service) {
-      active = true;
-    }
-  };
-  auto shared_info = std::make_shared<HandlerTimeoutInfo>(io_service_);
-  shared_info->timer.expires_from_now(
-      boost::posix_time::seconds(timeout_in_seconds));
-  shared_info->timer.async_wait(
-      [shared_info, timeout_handler](const boost::system::error_code& ec) {
-        if (!shared_info->active) {
-          return;
-        }
-        shared_info->active = false;
-        timeout_handler();
-      });
-  handlers_.push_back(
-      [shared_info, handler](
-          const ZnpCommandType& type, const ZnpCommand& cmd,
-          const std::vector<uint8_t>& data) -> FrameHandlerAction {
-        if (!shared_info->active) {
-          return {false, true};
-        }
+  auto timer = std::make_shared<boost::asio::deadline_timer>(io_service_);
+  HandlerId id = AddHandler(
+      type, commands,
+      [timer, handler](const ZnpCommandType& type, const ZnpCommand& cmd,
+                       ByteSpan data) -> FrameHandlerAction {
         FrameHandlerAction action = handler(type, cmd, data);
         if (action.remove_me) {
-          shared_info->active = false;
+          timer->cancel();
         }
         return action;
+      },
+      std::move(data_prefix));
+  timer->expires_from_now(timeout);
+  timer->async_wait(
+      [this, id, timer, timeout_handler](const boost::system::error_code& ec) {
+        if (!RemoveHandler(id)) {
+          return;
+        }
+        timeout_handler();
       });
+  return id;
 }
 
-std::vector<uint8_t> ZnpApi::CheckStatus(const std::vector<uint8_t>& response) {
+ByteSpan ZnpApi::CheckStatus(ByteSpan response) {
   if (response.size() < 1) {
     throw std::runtime_error("Empty response received");
   }
@@ -554,10 +842,10 @@ std::vector<uint8_t> ZnpApi::CheckStatus(const std::vector<uint8_t>& response) {
     // TODO: Parse and throw proper error!
     throw std::runtime_error("ZNP Status was not success");
   }
-  return std::vector<uint8_t>(response.begin() + 1, response.end());
+  return response.subspan(1);
 }
 
-void ZnpApi::CheckOnlyStatus(const std::vector<uint8_t>& response) {
+void ZnpApi::CheckOnlyStatus(ByteSpan response) {
   if (CheckStatus(response).size() != 0) {
     throw std::runtime_error("Empty response after status expected");
   }
@@ -1,11 +1,17 @@
 #ifndef _ZNP_API_H_
 #define _ZNP_API_H_
+#include <array>
 #include <bitset>
+#include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/signals2/signal.hpp>
+#include <chrono>
+#include <deque>
 #include <map>
 #include <queue>
 #include <set>
+#include <unordered_map>
 #include <stlab/concurrency/future.hpp>
 #include <vector>
 #include "logging.h"
@@ -21,6 +27,38 @@ class ZnpApi {
          std::shared_ptr<ZnpRawInterface> interface);
   ~ZnpApi() = default;
 
+  boost::asio::io_service& GetIoService() const { return io_service_; }
+
+  // Z-Stack only handles one SREQ at a time, so they are queued and issued
+  // one by one. Queues are served in order of priority.
+  enum class SReqPriority { Interactive = 0, Normal = 1, Background = 2 };
+  static constexpr std::size_t kSReqPriorityCount = 3;
+  // SREQs issued while this object is alive are queued with the given
+  // priority. Note that this doesn't extend to requests issued from
+  // continuations that run later.
+  class PriorityScope {
+   public:
+    PriorityScope(ZnpApi& api, SReqPriority priority);
+    ~PriorityScope();
+
+   private:
+    ZnpApi& api_;
+    SReqPriority previous_;
+  };
+  struct SReqStatistics {
+    std::array<std::size_t, kSReqPriorityCount> queue_depth;
+    bool in_flight;
+    std::uint64_t completed;
+    std::uint64_t timeouts;
+    // Time spent in the queue before being sent
+    std::chrono::milliseconds last_wait;
+    std::chrono::milliseconds max_wait;
+    std::chrono::milliseconds total_wait;
+  };
+  // Time to wait for the SRSP, after which the request fails.
+  void SetSReqTimeout(std::chrono::milliseconds timeout);
+  SReqStatistics GetSReqStatistics() const;
+
   // SYS commands
   stlab::future<ResetInfo> SysReset(bool soft_reset);
   stlab::future<Capability> SysPing();
@@ -42,16 +80,36 @@ class ZnpApi {
                                  Latency latency,
                                  std::vector<uint16_t> input_clusters,
                                  std::vector<uint16_t> output_clusters);
+  // Resolves once the matching AF_DATA_CONFIRM is received. A TransId is
+  // allocated internally, so that several requests can be outstanding at once.
   stlab::future<void> AfDataRequest(ShortAddress DstAddr, uint8_t DstEndpoint,
                                     uint8_t SrcEndpoint, uint16_t ClusterId,
-                                    uint8_t TransId, uint8_t Options,
-                                    uint8_t Radius, std::vector<uint8_t> Data);
+                                    uint8_t Options, uint8_t Radius,
+                                    std::vector<uint8_t> Data);
+  // As AfDataRequest, but addressed by group, IEEE address or broadcast,
+  // without having to resolve the short address first. DstAddr holds the
+  // group id, short address or broadcast address (e.g. 0xFFFF) in the lower
+  // 16 bits for those modes. AddrMode::Broadcast goes out as 0x0F, the
+  // broadcast mode of AF_DATA_REQUEST_EXT.
+  stlab::future<void> AfDataRequestExt(AddrMode DstAddrMode, uint64_t DstAddr,
+                                       uint8_t DstEndpoint, uint16_t DstPanId,
+                                       uint8_t SrcEndpoint, uint16_t ClusterId,
+                                       uint8_t Options, uint8_t Radius,
+                                       std::vector<uint8_t> Data);
+  // Maximum number of data requests awaiting confirmation, further requests
+  // are queued until a confirmation comes in.
+  void SetAfDataRequestWindow(std::size_t window);
+  // Time to wait for AF_DATA_CONFIRM, after which the request fails.
+  void SetAfDataConfirmTimeout(std::chrono::milliseconds timeout);
   // AF events
   boost::signals2::signal<void(const IncomingMsg&)> af_on_incoming_msg_;
 
   // ZDO commands
+  // Only resolved by a response about the given address, fails if none came
+  // within the timeout.
   stlab::future<ZdoIEEEAddressResponse> ZdoIEEEAddress(
-      ShortAddress address, boost::optional<uint8_t> children_index);
+      ShortAddress address, boost::optional<uint8_t> children_index,
+      std::chrono::milliseconds timeout);
   stlab::future<void> ZdoRemoveLinkKey(IEEEAddress IEEEAddr);
   stlab::future<std::tuple<IEEEAddress, std::array<uint8_t, 16>>> ZdoGetLinkKey(
       IEEEAddress IEEEAddr);
@@ -139,16 +197,84 @@ class ZnpApi {
   struct FrameHandlerAction {
     bool
         stop_processing;  // If true, do not call handlers further down the list
-    bool remove_me;  // If true, remove this handler from the list, and do not
-                     // call again.
+    bool remove_me;  // If true, remove this handler from all commands it was
+                     // registered for, and do not call again.
   };
-  typedef std::function<FrameHandlerAction(
-      const ZnpCommandType&, const ZnpCommand&, const std::vector<uint8_t>&)>
+  // Frame data is only valid for the duration of the call.
+  typedef std::function<FrameHandlerAction(const ZnpCommandType&,
+                                           const ZnpCommand&, ByteSpan)>
       FrameHandler;
-  std::list<FrameHandler> handlers_;
+  typedef std::size_t HandlerId;
+  // (type, subsystem, command) packed in one integer, see MakeHandlerKey.
+  typedef uint16_t HandlerKey;
+  struct HandlerEntry {
+    HandlerId id;
+    // Only frames starting with these bytes are passed to the handler.
+    std::vector<uint8_t> data_prefix;
+    FrameHandler handler;
+    // Cleared when removed while frames are being dispatched.
+    bool active;
+  };
+  typedef std::list<HandlerEntry> HandlerList;
+  typedef std::pair<HandlerKey, HandlerList::iterator> HandlerRegistration;
+  // Handlers are only called for frames matching the key they were registered
+  // under, in order of registration.
+  std::unordered_map<HandlerKey, HandlerList> handlers_;
+  std::unordered_map<HandlerId, std::vector<HandlerRegistration>>
+      handler_registrations_;
+  HandlerId next_handler_id_;
+  unsigned int dispatch_depth_;
+  std::vector<HandlerRegistration> deferred_removals_;
+
+  struct PendingSReq {
+    ZnpCommand command;
+    std::set<ZnpCommand> possible_responses;
+    std::vector<uint8_t> payload;
+    stlab::packaged_task<std::exception_ptr, std::vector<uint8_t>> promise;
+    std::chrono::steady_clock::time_point queued_at;
+  };
+  std::array<std::deque<PendingSReq>, kSReqPriorityCount> sreq_queues_;
+  bool sreq_in_flight_;
+  SReqPriority sreq_priority_;
+  std::chrono::milliseconds sreq_timeout_;
+  SReqStatistics sreq_statistics_;
+  void SendNextSReq();
+  void OnSReqDone();
 
-  void OnFrame(ZnpCommandType type, ZnpCommand command,
-               const std::vector<uint8_t>& payload);
+  struct PendingDataRequest {
+    ZnpCommand command;
+    uint8_t SrcEndpoint;
+    // Builds the request payload for the TransId that was allocated.
+    std::function<std::vector<uint8_t>(uint8_t)> encode;
+    stlab::packaged_task<std::exception_ptr> promise;
+  };
+  struct DataRequestInFlight {
+    stlab::packaged_task<std::exception_ptr> promise;
+    std::shared_ptr<boost::asio::deadline_timer> timer;
+  };
+  // (SrcEndpoint, TransId), as reported in AF_DATA_CONFIRM.
+  typedef std::tuple<uint8_t, uint8_t> DataRequestKey;
+  std::deque<PendingDataRequest> data_request_queue_;
+  std::map<DataRequestKey, DataRequestInFlight> data_requests_in_flight_;
+  std::size_t data_request_window_;
+  std::chrono::milliseconds data_confirm_timeout_;
+  uint8_t next_trans_id_;
+  stlab::future<void> QueueDataRequest(
+      ZnpCommand command, uint8_t SrcEndpoint,
+      std::function<std::vector<uint8_t>(uint8_t)> encode);
+  void SendNextDataRequests();
+  bool OnDataRequestDone(const DataRequestKey& key, std::exception_ptr exc);
+
+  static HandlerKey MakeHandlerKey(ZnpCommandType type,
+                                   const ZnpCommand& command);
+  HandlerId AddHandler(
+      ZnpCommandType type, const std::set<ZnpCommand>& commands,
+      FrameHandler handler,
+      std::vector<uint8_t> data_prefix = std::vector<uint8_t>());
+  // Returns false if the handler was already removed.
+  bool RemoveHandler(HandlerId id);
+
+  void OnFrame(ZnpCommandType type, ZnpCommand command, ByteSpan payload);
   stlab::future<std::vector<uint8_t>> WaitFor(
       ZnpCommandType type, ZnpCommand command, int timeout_in_seconds = 0,
       std::vector<uint8_t> data_prefix = std::vector<uint8_t>());
@@ -161,41 +287,47 @@ class ZnpApi {
   stlab::future<std::vector<uint8_t>> RawSReq(
       ZnpCommand command, std::set<ZnpCommand> possible_responses,
       const std::vector<uint8_t>& payload);
-  static std::vector<uint8_t> CheckStatus(const std::vector<uint8_t>& response);
-  static void CheckOnlyStatus(const std::vector<uint8_t>& response);
+  static ByteSpan CheckStatus(ByteSpan response);
+  static void CheckOnlyStatus(ByteSpan response);
+  // Checks the status byte, and decodes the rest of the response in-place.
+  template <typename T>
+  static T DecodeWithStatus(const std::vector<uint8_t>& response) {
+    return znp::Decode<T>(CheckStatus(response));
+  }
   typedef std::function<void()> TimeoutHandler;
-  void AddHandlerWithTimeout(int timeout_in_seconds, FrameHandler handler,
-                             TimeoutHandler timeout_handler);
+  HandlerId AddHandlerWithTimeout(
+      boost::posix_time::time_duration timeout, ZnpCommandType type,
+      const std::set<ZnpCommand>& commands, FrameHandler handler,
+      TimeoutHandler timeout_handler,
+      std::vector<uint8_t> data_prefix = std::vector<uint8_t>());
 
   template <typename... Args>
   void AddSimpleEventHandler(ZnpCommandType type, ZnpCommand command,
                              boost::signals2::signal<void(Args...)>& signal,
                              bool allow_partial) {
-    handlers_.push_back([&signal, type, command, allow_partial](
-                            const ZnpCommandType& recvd_type,
-                            const ZnpCommand& recvd_command,
-                            const std::vector<uint8_t>& data)
-                            -> FrameHandlerAction {
-      if (recvd_type != type || recvd_command != command) {
-        return {false, false};
-      }
-      typedef std::tuple<std::remove_const_t<std::remove_reference_t<Args>>...>
-          ArgTuple;
-      ArgTuple arguments;
-      try {
-        if (allow_partial) {
-          arguments = znp::DecodePartial<ArgTuple>(data);
-        } else {
-          arguments = znp::Decode<ArgTuple>(data);
-        }
-      } catch (const std::exception& exc) {
-        LOG("ZnpApi", warning)
-            << "Exception while decoding event: " << exc.what();
-        return {false, false};
-      }
-      polyfill::apply(signal, arguments);
-      return {true, false};
-    });
+    AddHandler(
+        type, {command},
+        [&signal, allow_partial](const ZnpCommandType& recvd_type,
+                                 const ZnpCommand& recvd_command,
+                                 ByteSpan data) -> FrameHandlerAction {
+          typedef std::tuple<
+              std::remove_const_t<std::remove_reference_t<Args>>...>
+              ArgTuple;
+          ArgTuple arguments;
+          try {
+            if (allow_partial) {
+              arguments = znp::DecodePartial<ArgTuple>(data);
+            } else {
+              arguments = znp::Decode<ArgTuple>(data);
+            }
+          } catch (const std::exception& exc) {
+            LOG("ZnpApi", warning)
+                << "Exception while decoding event: " << exc.what();
+            return {false, false};
+          }
+          polyfill::apply(signal, arguments);
+          return {true, false};
+        });
   }
 };
 }  // namespace znp
@@ -0,0 +1,78 @@
+#include "znp/znp_frame_parser.h"
+#include <algorithm>
+#include <cstring>
+#include "logging.h"
+
+namespace znp {
+constexpr std::size_t ZnpFrameParser::kMaxFrameSize;
+
+ZnpFrameParser::ZnpFrameParser(std::size_t capacity)
+    : buffer_(std::max(capacity, 2 * kMaxFrameSize)),
+      begin_(0),
+      end_(0),
+      crc_errors_(0),
+      dropped_bytes_(0) {}
+
+boost::asio::mutable_buffers_1 ZnpFrameParser::Prepare() {
+  if (begin_ == end_) {
+    begin_ = end_ = 0;
+  } else if (buffer_.size() - end_ < kMaxFrameSize) {
+    std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+  }
+  return boost::asio::buffer(buffer_.data() + end_, buffer_.size() - end_);
+}
+
+void ZnpFrameParser::Commit(std::size_t bytes_transferred) {
+  end_ = std::min(end_ + bytes_transferred, buffer_.size());
+}
+
+std::size_t ZnpFrameParser::Parse(const FrameHandler& handler) {
+  std::size_t frames = 0;
+  while (begin_ < end_) {
+    const uint8_t* frame = buffer_.data() + begin_;
+    std::size_t available = end_ - begin_;
+    if (frame[0] != 0xFE) {
+      const void* sof = std::memchr(frame, 0xFE, available);
+      std::size_t skip =
+          sof ? (static_cast<const uint8_t*>(sof) - frame) : available;
+      LOG("ZnpPort", trace) << "No SOF marker, dropping " << skip << " bytes";
+      dropped_bytes_ += skip;
+      begin_ += skip;
+      continue;
+    }
+    if (available < 2) {
+      break;
+    }
+    std::size_t payload_size = frame[1];
+    std::size_t frame_size = 1 + 1 + 2 + payload_size + 1;
+    if (available < frame_size) {
+      break;
+    }
+    uint8_t crc = 0;
+    for (std::size_t i = 1; i < frame_size - 1; i++) {
+      crc ^= frame[i];
+    }
+    if (crc != frame[frame_size - 1]) {
+      LOG("ZnpPort", warning) << "CRC does not match, dropping frame";
+      crc_errors_++;
+      dropped_bytes_++;
+      begin_++;
+      continue;
+    }
+    ZnpCommandType type = (ZnpCommandType)(frame[2] >> 4);
+    ZnpSubsystem subsystem = (ZnpSubsystem)(frame[2] & 0xF);
+    uint8_t command = frame[3];
+    begin_ += frame_size;
+    frames++;
+    handler(type, ZnpCommand(subsystem, command),
+            ByteSpan(frame + 4, payload_size));
+  }
+  return frames;
+}
+
+std::size_t ZnpFrameParser::BufferedBytes() const { return end_ - begin_; }
+std::size_t ZnpFrameParser::CrcErrors() const { return crc_errors_; }
+std::size_t ZnpFrameParser::DroppedBytes() const { return dropped_bytes_; }
+}  // namespace znp
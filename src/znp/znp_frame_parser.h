@@ -0,0 +1,55 @@
+#ifndef _ZNP_FRAME_PARSER_H_
+#define _ZNP_FRAME_PARSER_H_
+#include <boost/asio/buffer.hpp>
+#include <functional>
+#include <vector>
+#include "znp/byte_span.h"
+#include "znp/znp.h"
+
+namespace znp {
+/**
+ * Incremental parser for the ZNP serial framing (SOF, length, command,
+ * payload, FCS).
+ *
+ * Raw bytes are read straight into a reusable receive buffer (Prepare /
+ * Commit, like asio's streambuf), after which Parse extracts every complete
+ * frame currently held in one pass. Garbage before a start-of-frame marker is
+ * skipped, and a frame failing the checksum only drops its SOF byte so the
+ * parser can resynchronise on a marker inside the bad frame.
+ *
+ * Unparsed data is moved back to the start of the buffer when there's no
+ * longer room for a full frame behind it, so every frame is contiguous in
+ * memory and can be handed out without copying.
+ */
+class ZnpFrameParser {
+ public:
+  // The payload points into the receive buffer, and is only valid until the
+  // handler returns.
+  typedef std::function<void(ZnpCommandType, ZnpCommand, ByteSpan)>
+      FrameHandler;
+
+  // SOF + Length + Command (2 bytes) + max. payload + FCS
+  static constexpr std::size_t kMaxFrameSize = 1 + 1 + 2 + 255 + 1;
+
+  ZnpFrameParser(std::size_t capacity = 1024);
+
+  // Writable region directly behind the unparsed data.
+  boost::asio::mutable_buffers_1 Prepare();
+  // Marks the first bytes_transferred bytes of the prepared region as data.
+  void Commit(std::size_t bytes_transferred);
+  // Calls handler for every complete frame, returns the number of frames.
+  std::size_t Parse(const FrameHandler& handler);
+
+  std::size_t BufferedBytes() const;
+  std::size_t CrcErrors() const;
+  std::size_t DroppedBytes() const;
+
+ private:
+  std::vector<uint8_t> buffer_;
+  std::size_t begin_;
+  std::size_t end_;
+  std::size_t crc_errors_;
+  std::size_t dropped_bytes_;
+};
+}  // namespace znp
+#endif  // _ZNP_FRAME_PARSER_H_
@@ -5,8 +5,16 @@
 #include "logging.h"
 
 namespace znp {
-ZnpPort::ZnpPort(boost::asio::io_service& io_service, const std::string& port)
-    : port_(io_service, port), send_in_progress_(false), send_queue_() {
+namespace {
+const std::size_t kMaxFreeBuffers = 32;
+}
+
+ZnpPort::ZnpPort(boost::asio::io_service& io_service, const std::string& port,
+                 std::size_t max_write_size)
+    : port_(io_service, port),
+      max_write_size_(max_write_size),
+      send_queue_(),
+      send_in_progress_(0) {
   port_.set_option(boost::asio::serial_port_base::baud_rate(115200));
   port_.set_option(boost::asio::serial_port_base::character_size(8));
   port_.set_option(boost::asio::serial_port_base::stop_bits(
@@ -24,8 +32,13 @@ void ZnpPort::SendFrame(ZnpCommandType type, ZnpCommand command,
     throw std::runtime_error(
         "ZNP Command Payload size should not exceed 255 bytes");
   }
+  std::vector<uint8_t> buffer;
+  if (!free_buffers_.empty()) {
+    buffer = std::move(free_buffers_.back());
+    free_buffers_.pop_back();
+  }
   // SOF + Length (1 byte) + Command (2 byte) + payload + Checksum
-  std::vector<uint8_t> buffer(1 + 1 + 2 + payload.size() + 1);
+  buffer.resize(1 + 1 + 2 + payload.size() + 1);
   buffer[0] = 0xFE;
   buffer[1] = payload.size();
   buffer[2] =
@@ -38,25 +51,31 @@ void ZnpPort::SendFrame(ZnpCommandType type, ZnpCommand command,
     crc ^= buffer[i];
   }
   buffer[buffer.size() - 1] = crc;
-  send_queue_.emplace(std::move(buffer));
+  send_queue_.emplace_back(std::move(buffer));
   TrySend();
   on_sent_(type, command, payload);
 }
 
 void ZnpPort::TrySend() {
-  if (send_in_progress_) {
+  if (send_in_progress_ > 0) {
     return;
   }
   if (send_queue_.empty()) {
     return;
   }
-  send_in_progress_ = true;
-  std::vector<uint8_t>& first_in_queue(send_queue_.front());
-  std::array<boost::asio::const_buffer, 1> buffers;
-  buffers[0] =
-      boost::asio::const_buffer(first_in_queue.data(), first_in_queue.size());
+  // Gather everything queued so far in one write, up to max_write_size_.
+  send_buffers_.clear();
+  std::size_t write_size = 0;
+  for (const auto& frame : send_queue_) {
+    if (send_in_progress_ > 0 && write_size + frame.size() > max_write_size_) {
+      break;
+    }
+    send_buffers_.emplace_back(frame.data(), frame.size());
+    write_size += frame.size();
+    send_in_progress_++;
+  }
   boost::asio::async_write(
-      port_, buffers,
+      port_, send_buffers_,
       std::bind(&ZnpPort::SendHandler, this, std::placeholders::_1,
                 std::placeholders::_2));
 }
@@ -68,81 +87,37 @@ void ZnpPort::SendHandler(const boost::system::error_code& error,
     on_error_(error);
     return;
   }
-  if (!send_queue_.empty()) {
-    send_queue_.pop();
+  for (; send_in_progress_ > 0 && !send_queue_.empty(); send_in_progress_--) {
+    if (free_buffers_.size() < kMaxFreeBuffers) {
+      free_buffers_.emplace_back(std::move(send_queue_.front()));
+    }
+    send_queue_.pop_front();
   }
-  send_in_progress_ = false;
+  send_in_progress_ = 0;
   TrySend();
 }
 
 void ZnpPort::StartReceive() {
-  auto target = std::make_shared<uint8_t>(0);
-  boost::asio::async_read(
-      port_, boost::asio::buffer(target.get(), sizeof(uint8_t)),
-      std::bind(&ZnpPort::StartOfFrameHandler, this, target,
-                std::placeholders::_1, std::placeholders::_2));
-}
-
-void ZnpPort::StartOfFrameHandler(std::shared_ptr<uint8_t> marker,
-                                  const boost::system::error_code& error,
-                                  std::size_t bytes_transferred) {
-  if (error) {
-    LOG("ZnpPort", critical)
-        << "IO Error while reading SOF: " << error.message();
-    on_error_(error);
-    return;
-  }
-  if (*marker != 0xFE) {
-    LOG("ZnpPort", trace) << "No SOF marker, dropping data";
-    StartReceive();
-    return;
-  }
-  boost::asio::async_read(
-      port_, boost::asio::buffer(marker.get(), sizeof(uint8_t)),
-      std::bind(&ZnpPort::FrameLengthHandler, this, marker,
-                std::placeholders::_1, std::placeholders::_2));
-}
-
-void ZnpPort::FrameLengthHandler(std::shared_ptr<uint8_t> length,
-                                 const boost::system::error_code& error,
-                                 std::size_t bytes_transferred) {
-  if (error) {
-    LOG("ZnpPort", critical)
-        << "IO Error while reading length: " << error.message();
-    on_error_(error);
-    return;
-  }
-  auto buffer =
-      std::make_shared<std::vector<uint8_t>>(2 + ((std::size_t)*length) + 1);
-  boost::asio::async_read(
-      port_, boost::asio::buffer(buffer->data(), buffer->size()),
-      std::bind(&ZnpPort::FrameHandler, this, buffer, std::placeholders::_1,
+  port_.async_read_some(
+      receive_parser_.Prepare(),
+      std::bind(&ZnpPort::ReceiveHandler, this, std::placeholders::_1,
                 std::placeholders::_2));
 }
 
-void ZnpPort::FrameHandler(std::shared_ptr<std::vector<uint8_t>> frame,
-                           const boost::system::error_code& error,
-                           std::size_t bytes_transferred) {
+void ZnpPort::ReceiveHandler(const boost::system::error_code& error,
+                             std::size_t bytes_transferred) {
   if (error) {
-    LOG("ZnpPort", critical)
-        << "IO Error while reading frame: " << error.message();
+    LOG("ZnpPort", critical) << "IO Error while reading: " << error.message();
     on_error_(error);
     return;
   }
+  receive_parser_.Commit(bytes_transferred);
+  // Parse before issuing the next read, as that may write into the buffer
+  // right away.
+  receive_parser_.Parse(
+      [this](ZnpCommandType type, ZnpCommand command, ByteSpan payload) {
+        on_frame_(type, command, payload);
+      });
   StartReceive();
-  uint8_t crc = 0;
-  crc ^= frame->size() - 3;  // Length byte
-  for (std::size_t i = 0; i < frame->size() - 1; i++) {
-    crc ^= (*frame)[i];
-  }
-  if (crc != (*frame)[frame->size() - 1]) {
-    LOG("ZnpPort", warning) << "CRC does not match, dropping frame";
-    return;
-  }
-  ZnpCommandType type = (ZnpCommandType)((*frame)[0] >> 4);
-  ZnpSubsystem subsystem = (ZnpSubsystem)((*frame)[0] & 0xF);
-  unsigned int command = (*frame)[1];
-  on_frame_(type, ZnpCommand(subsystem, command),
-            std::vector<uint8_t>(frame->begin() + 2, frame->end() - 1));
 }
 }  // namespace znp
@@ -2,15 +2,19 @@
 #define _ZNP_PORT_H_
 #include <boost/asio.hpp>
 #include <boost/signals2/signal.hpp>
-#include <queue>
+#include <deque>
 #include <stlab/concurrency/future.hpp>
 #include <vector>
+#include "znp/znp_frame_parser.h"
 #include "znp/znp_raw_interface.h"
 
 namespace znp {
 class ZnpPort : public ZnpRawInterface {
  public:
-  ZnpPort(boost::asio::io_service& io_service, const std::string& port);
+  // max_write_size caps the number of bytes coalesced into a single write,
+  // a single frame is always written as a whole.
+  ZnpPort(boost::asio::io_service& io_service, const std::string& port,
+          std::size_t max_write_size = 1024);
   ~ZnpPort() = default;
   void SendFrame(ZnpCommandType type, ZnpCommand command,
                  const std::vector<uint8_t>& payload) override;
@@ -23,22 +27,21 @@ class ZnpPort : public ZnpRawInterface {
 
  private:
   boost::asio::serial_port port_;
-  bool send_in_progress_;
-  std::queue<std::vector<uint8_t>> send_queue_;
+  std::size_t max_write_size_;
+  std::deque<std::vector<uint8_t>> send_queue_;
+  // Number of frames at the front of send_queue_ currently being written.
+  std::size_t send_in_progress_;
+  std::vector<boost::asio::const_buffer> send_buffers_;
+  // Frame buffers of completed writes, reused by SendFrame.
+  std::vector<std::vector<uint8_t>> free_buffers_;
+  ZnpFrameParser receive_parser_;
 
   void TrySend();
   void SendHandler(const boost::system::error_code& error,
                    std::size_t bytes_transferred);
   void StartReceive();
-  void StartOfFrameHandler(std::shared_ptr<uint8_t> marker,
-                           const boost::system::error_code& error,
-                           std::size_t bytes_transferred);
-  void FrameLengthHandler(std::shared_ptr<uint8_t> length,
-                          const boost::system::error_code& error,
-                          std::size_t bytes_transferred);
-  void FrameHandler(std::shared_ptr<std::vector<uint8_t>> frame,
-                    const boost::system::error_code& error,
-                    std::size_t bytes_transferred);
+  void ReceiveHandler(const boost::system::error_code& error,
+                      std::size_t bytes_transferred);
 };
 }  // namespace znp
 #endif  // _ZNP_PORT_H_
@@ -2,6 +2,7 @@
 #define _ZNP_RAW_INTERFACE_H_
 #include <boost/signals2/signal.hpp>
 #include <vector>
+#include "znp/byte_span.h"
 #include "znp/znp.h"
 
 namespace znp {
@@ -13,8 +14,9 @@ class ZnpRawInterface {
   virtual void SendFrame(ZnpCommandType cmdtype, ZnpCommand command,
                          const std::vector<uint8_t>& payload) = 0;
 
-  boost::signals2::signal<void(ZnpCommandType, ZnpCommand,
-                               const std::vector<uint8_t>&)>
+  // The payload only references the receive buffer, and is only valid for the
+  // duration of the signal.
+  boost::signals2::signal<void(ZnpCommandType, ZnpCommand, ByteSpan)>
       on_frame_;
 };
 }  // namespace znp
@@ -0,0 +1,148 @@
+#include <attribute_store.h>
+#include <sys/stat.h>
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+namespace {
+AttributeStore::Key MakeKey(znp::IEEEAddress address, uint8_t endpoint,
+                            uint16_t cluster_id, uint16_t attribute_id) {
+  return {address, endpoint, (zcl::ZclClusterId)cluster_id,
+          (zcl::ZclAttributeId)attribute_id};
+}
+
+void RemoveSnapshot(const std::string& filename) {
+  std::remove(filename.c_str());
+  std::remove((filename + ".journal").c_str());
+}
+
+std::string GetValue(const AttributeStore& store,
+                     const AttributeStore::Key& key) {
+  auto entry = store.Get(key);
+  return entry ? entry->value : "";
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(AttributeStoreUpdate) {
+  AttributeStore store;
+  auto now = AttributeStore::Clock::now();
+  auto on_off = MakeKey(0x00158d000152d7b2, 1, 0x0006, 0x0000);
+  BOOST_TEST(!store.Get(on_off, AttributeStore::Clock::duration::max(), now));
+
+  store.Update(on_off, "false", 100, now);
+  // Same attribute on other devices, endpoints & clusters
+  store.Update(MakeKey(0x00158d000152d7b3, 1, 0x0006, 0x0000), "true", 10, now);
+  store.Update(MakeKey(0x00158d000152d7b2, 2, 0x0006, 0x0000), "true", 10, now);
+  store.Update(MakeKey(0x00158d000152d7b2, 1, 0x0000, 0x0000), "1", 10, now);
+  store.Update(on_off, "true", 120, now + std::chrono::seconds(5));
+  BOOST_TEST(store.Size() == 4);
+
+  auto entry = store.Get(on_off, AttributeStore::Clock::duration::max(), now);
+  BOOST_TEST_REQUIRE(!!entry);
+  BOOST_TEST(entry->value == "true");
+  BOOST_TEST(entry->link_quality == 120);
+  BOOST_TEST((entry->updated == now + std::chrono::seconds(5)));
+}
+
+BOOST_AUTO_TEST_CASE(AttributeStoreMaxAge) {
+  AttributeStore store;
+  auto now = AttributeStore::Clock::now();
+  auto key = MakeKey(0x00158d000152d7b2, 1, 0x0402, 0x0000);
+  store.Update(key, "2150", 100, now);
+  BOOST_TEST(!!store.Get(key, std::chrono::seconds(60),
+                         now + std::chrono::seconds(60)));
+  BOOST_TEST(!store.Get(key, std::chrono::seconds(60),
+                        now + std::chrono::seconds(61)));
+}
+
+BOOST_AUTO_TEST_CASE(AttributeStorePersistence) {
+  const std::string filename = "attribute_store_test.snapshot";
+  RemoveSnapshot(filename);
+  auto temperature = MakeKey(0x00158d000152d7b2, 1, 0x0402, 0x0000);
+  auto humidity = MakeKey(0x00158d000152d7b2, 1, 0x0405, 0x0000);
+  {
+    AttributeStore store(filename);
+    BOOST_TEST(store.Size() == 0);
+    store.Update(temperature, "2150", 100);
+    store.Update(humidity, "4500", 90);
+    store.Save();
+    store.Update(temperature, "2160", 110);
+    store.Save();
+  }
+  {
+    // Changes were appended to the journal, nothing was lost.
+    AttributeStore store(filename);
+    BOOST_TEST(store.Size() == 2);
+    BOOST_TEST(GetValue(store, temperature) == "2160");
+    BOOST_TEST(GetValue(store, humidity) == "4500");
+    BOOST_TEST(store.Get(temperature)->link_quality == 110);
+    BOOST_TEST(!!store.Get(temperature, std::chrono::seconds(10)));
+  }
+  {
+    // A partially written record at the end of the journal is skipped.
+    std::ofstream journal(filename + ".journal",
+                          std::ios::binary | std::ios::app);
+    journal.write("\x01\x02\x03", 3);
+  }
+  {
+    AttributeStore store(filename);
+    BOOST_TEST(store.Size() == 2);
+    BOOST_TEST(GetValue(store, temperature) == "2160");
+    store.Update(humidity, "4600", 90);
+    store.Save();
+  }
+  {
+    // Enough changes to fold the journal into a new snapshot, repeatedly.
+    AttributeStore store(filename);
+    BOOST_TEST(GetValue(store, humidity) == "4600");
+    for (int i = 0; i < 2000; i++) {
+      store.Update(temperature, std::to_string(i), 100);
+      store.Save();
+    }
+  }
+  {
+    AttributeStore store(filename);
+    BOOST_TEST(GetValue(store, temperature) == "1999");
+    BOOST_TEST(GetValue(store, humidity) == "4600");
+  }
+  RemoveSnapshot(filename);
+}
+
+BOOST_AUTO_TEST_CASE(AttributeStoreFailedWrites) {
+  const std::string filename = "attribute_store_test.snapshot";
+  RemoveSnapshot(filename);
+  auto temperature = MakeKey(0x00158d000152d7b2, 1, 0x0402, 0x0000);
+  auto humidity = MakeKey(0x00158d000152d7b2, 1, 0x0405, 0x0000);
+  {
+    AttributeStore store(filename);
+    store.Update(temperature, "2150", 100);
+    store.Save();
+    // A write cut short, which the next one isn't appended behind.
+    {
+      std::ofstream journal(filename + ".journal",
+                            std::ios::binary | std::ios::app);
+      journal.write("\x01\x02\x03", 3);
+    }
+    store.Update(humidity, "4500", 90);
+    store.Save();
+  }
+  {
+    AttributeStore store(filename);
+    BOOST_TEST(GetValue(store, temperature) == "2150");
+    BOOST_TEST(GetValue(store, humidity) == "4500");
+  }
+  RemoveSnapshot(filename);
+  {
+    // The journal can't be opened, so a snapshot is written instead.
+    AttributeStore store(filename);
+    BOOST_TEST_REQUIRE(::mkdir((filename + ".journal").c_str(), 0755) == 0);
+    store.Update(temperature, "2160", 110);
+    store.Save();
+  }
+  {
+    AttributeStore store(filename);
+    BOOST_TEST(GetValue(store, temperature) == "2160");
+  }
+  RemoveSnapshot(filename);
+}
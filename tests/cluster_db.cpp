@@ -3,7 +3,11 @@
 #include <zcl/encoding.h>
 #include <boost/optional/optional_io.hpp>
 #include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <iterator>
 #include <iostream>
+#include <list>
+#include <map>
 #include <sstream>
 #include <tao/json.hpp>
 
@@ -139,3 +143,147 @@ BOOST_AUTO_TEST_CASE(DecodeOnOffAttribute) {
   BOOST_TEST(!!(parsed_until == data.cend()));
   BOOST_TEST(result == expected);
 }
+
+namespace {
+struct TestItem {
+  zcl::ZclClusterId id;
+  std::string name;
+};
+
+std::vector<TestItem> MakeTestItems(std::size_t count) {
+  std::vector<TestItem> items;
+  for (std::size_t i = 0; i < count; i++) {
+    // Spread like real cluster ids: a dense low range, some manufacturer ones.
+    unsigned int id = (i % 4 == 3) ? 0xFC00 + i : i;
+    items.push_back(TestItem{(zcl::ZclClusterId)id,
+                             "Cluster name " + std::to_string(id)});
+  }
+  return items;
+}
+
+// Mimics the previous SearchableList: a std::list indexed by two std::maps.
+struct LegacyList {
+  std::list<TestItem> items;
+  std::map<zcl::ZclClusterId, TestItem*> by_id;
+  std::map<std::string, TestItem*> by_name;
+
+  void Add(TestItem item) {
+    items.push_back(std::move(item));
+    by_id[items.back().id] = &items.back();
+    by_name[items.back().name] = &items.back();
+  }
+};
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(SearchableListLookups) {
+  SearchableList<TestItem> list;
+  auto items = MakeTestItems(300);
+  for (const auto& item : items) {
+    BOOST_TEST(list.Add(item));
+  }
+  BOOST_TEST(!list.Add(TestItem{items[5].id, "Unique"}));
+  BOOST_TEST(!list.Add(TestItem{(zcl::ZclClusterId)0xABCD, items[5].name}));
+  for (const auto& item : items) {
+    auto by_id = list.FindById(item.id);
+    BOOST_TEST_REQUIRE(!!by_id);
+    BOOST_TEST(by_id->name == item.name);
+    auto by_name = list.FindByName(item.name);
+    BOOST_TEST_REQUIRE(!!by_name);
+    BOOST_TEST((by_name->id == item.id));
+  }
+  BOOST_TEST(!list.FindById((zcl::ZclClusterId)0xABCD));
+  BOOST_TEST(!list.FindByName("Unique"));
+  // Lookup of part of a larger string, without copying it
+  std::string topic = "Cluster name 12/command";
+  BOOST_TEST(!!list.FindByName(boost::string_ref(topic).substr(0, 15)));
+
+  SearchableList<TestItem> empty;
+  BOOST_TEST(!empty.FindById((zcl::ZclClusterId)0));
+  BOOST_TEST(!empty.FindByName(""));
+}
+
+BOOST_AUTO_TEST_CASE(SearchableListBenchmark) {
+  const std::size_t lookup_count = 2000000;
+  auto items = MakeTestItems(120);
+  LegacyList legacy;
+  SearchableList<TestItem> list;
+  for (const auto& item : items) {
+    legacy.Add(item);
+    list.Add(item);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::size_t legacy_found = 0;
+  for (std::size_t i = 0; i < lookup_count; i++) {
+    const TestItem& item = items[(i * 7) % items.size()];
+    legacy_found += legacy.by_id.count(item.id);
+    legacy_found += legacy.by_name.count(item.name);
+  }
+  std::chrono::duration<double> legacy_time =
+      std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  std::size_t found = 0;
+  for (std::size_t i = 0; i < lookup_count; i++) {
+    const TestItem& item = items[(i * 7) % items.size()];
+    found += list.FindById(item.id) ? 1 : 0;
+    found += list.FindByName(item.name) ? 1 : 0;
+  }
+  std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+
+  BOOST_TEST(legacy_found == 2 * lookup_count);
+  BOOST_TEST(found == 2 * lookup_count);
+  BOOST_TEST_MESSAGE("Id & name lookups, std::map: "
+                     << (lookup_count / legacy_time.count()) << " pairs/s");
+  BOOST_TEST_MESSAGE("Id & name lookups, hash index: "
+                     << (lookup_count / time.count()) << " pairs/s");
+}
+
+namespace {
+void CheckSameCommands(const SearchableList<CommandInfo>& expected,
+                       const SearchableList<CommandInfo>& actual) {
+  BOOST_TEST(std::distance(expected.begin(), expected.end()) ==
+             std::distance(actual.begin(), actual.end()));
+  for (const auto& command : expected) {
+    auto found = actual.FindById(command.id);
+    BOOST_TEST_REQUIRE(!!found);
+    BOOST_TEST(found->name == command.name);
+    BOOST_TEST(found->is_global == command.is_global);
+    BOOST_TEST((found->data == command.data));
+  }
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(BuiltinTablesMatchClustersInfo) {
+  const tables::Tables* builtin = BuiltinTables();
+  if (!builtin) {
+    BOOST_TEST_MESSAGE("No built-in cluster tables in this build");
+    return;
+  }
+  auto name_mangler = [](std::string name) { return name; };
+  ClusterDb parsed;
+  BOOST_TEST_REQUIRE(parsed.ParseFromFile(CLUSTERS_INFO_FILE, name_mangler));
+  ClusterDb loaded;
+  BOOST_TEST_REQUIRE(loaded.LoadFromTables(*builtin, name_mangler));
+
+  CheckSameCommands(parsed.GlobalCommands(), loaded.GlobalCommands());
+  const auto& clusters = parsed.Clusters();
+  BOOST_TEST(std::distance(clusters.begin(), clusters.end()) ==
+             std::distance(loaded.Clusters().begin(), loaded.Clusters().end()));
+  for (const auto& cluster : clusters) {
+    auto found = loaded.ClusterById(cluster.id);
+    BOOST_TEST_REQUIRE(!!found);
+    BOOST_TEST(found->name == cluster.name);
+    for (const auto& attribute : cluster.attributes) {
+      auto found_attribute = found->attributes.FindById(attribute.id);
+      BOOST_TEST_REQUIRE(!!found_attribute);
+      BOOST_TEST(found_attribute->name == attribute.name);
+      BOOST_TEST((found_attribute->datatype == attribute.datatype));
+    }
+    CheckSameCommands(cluster.commands_serverToClient,
+                      found->commands_serverToClient);
+    CheckSameCommands(cluster.commands_clientToServer,
+                      found->commands_clientToServer);
+  }
+}
@@ -0,0 +1,68 @@
+#include <dynamic_encoding/decode_cache.h>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+const zcl::ZclClusterId kBasic = (zcl::ZclClusterId)0x0000;
+
+std::string Key(uint8_t command_id, std::vector<uint8_t> payload) {
+  return dynamic_encoding::DecodeCache::MakeKey(
+      1, kBasic, true, zcl::ZclDirection::ClientToServer,
+      (zcl::ZclCommandId)command_id, payload);
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(DecodeCacheHits) {
+  dynamic_encoding::DecodeCache cache(4096);
+  BOOST_TEST(cache.Get(Key(0x0A, {0x01, 0x02})) == nullptr);
+  cache.Put(Key(0x0A, {0x01, 0x02}),
+            dynamic_encoding::DecodeCache::Entry{"{\"a\":1}", {{5, 6}}, true});
+  const auto* entry = cache.Get(Key(0x0A, {0x01, 0x02}));
+  BOOST_TEST_REQUIRE(entry != nullptr);
+  BOOST_TEST(entry->text == "{\"a\":1}");
+  BOOST_TEST(entry->record_spans.size() == 1);
+  BOOST_TEST(entry->complete);
+  BOOST_TEST(entry->record_attribute_ids.empty());
+  // Same payload, different command or direction
+  BOOST_TEST(cache.Get(Key(0x01, {0x01, 0x02})) == nullptr);
+  BOOST_TEST(cache.Get(dynamic_encoding::DecodeCache::MakeKey(
+                 1, kBasic, true, zcl::ZclDirection::ServerToClient,
+                 (zcl::ZclCommandId)0x0A, {0x01, 0x02})) == nullptr);
+  // Same payload, decoded with a reloaded cluster database
+  BOOST_TEST(cache.Get(dynamic_encoding::DecodeCache::MakeKey(
+                 2, kBasic, true, zcl::ZclDirection::ClientToServer,
+                 (zcl::ZclCommandId)0x0A, {0x01, 0x02})) == nullptr);
+
+  auto statistics = cache.GetStatistics();
+  BOOST_TEST(statistics.entries == 1);
+  BOOST_TEST(statistics.hits == 1);
+  BOOST_TEST(statistics.misses == 4);
+  BOOST_TEST(statistics.evictions == 0);
+}
+
+BOOST_AUTO_TEST_CASE(DecodeCacheEviction) {
+  dynamic_encoding::DecodeCache cache(1024);
+  std::string text(200, 'x');
+  for (uint8_t i = 0; i < 3; i++) {
+    cache.Put(Key(0x0A, {i}), {text, {}, true});
+  }
+  // Keep the first entry in use, so the second is the least recently used.
+  BOOST_TEST(cache.Get(Key(0x0A, {0})) != nullptr);
+  cache.Put(Key(0x0A, {3}), {text, {}, true});
+  auto statistics = cache.GetStatistics();
+  BOOST_TEST(statistics.bytes <= 1024);
+  BOOST_TEST(statistics.evictions == 1);
+  BOOST_TEST(cache.Get(Key(0x0A, {0})) != nullptr);
+  BOOST_TEST(cache.Get(Key(0x0A, {1})) == nullptr);
+  BOOST_TEST(cache.Get(Key(0x0A, {3})) != nullptr);
+
+  // Too large to ever fit
+  cache.Put(Key(0x0A, {5}), {std::string(2048, 'x'), {}, true});
+  BOOST_TEST(cache.Get(Key(0x0A, {5})) == nullptr);
+
+  dynamic_encoding::DecodeCache disabled(0);
+  disabled.Put(Key(0x0A, {0}), {text, {}, true});
+  BOOST_TEST(disabled.GetStatistics().entries == 0);
+  BOOST_TEST(disabled.Get(Key(0x0A, {0})) == nullptr);
+  // A disabled cache doesn't count every lookup as a miss.
+  BOOST_TEST(disabled.GetStatistics().misses == 0);
+}
@@ -0,0 +1,93 @@
+#include <zcl/duplicate_filter.h>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+const zcl::ZclClusterId kOnOff = (zcl::ZclClusterId)0x0006;
+const zcl::ZclClusterId kBasic = (zcl::ZclClusterId)0x0000;
+const zcl::ZclCommandId kReportAttributes = (zcl::ZclCommandId)0x0A;
+const zcl::ZclCommandId kReadAttributesResponse = (zcl::ZclCommandId)0x01;
+
+// An attribute report, which is what most traffic is.
+bool IsDuplicateReport(zcl::DuplicateFilter& filter,
+                       znp::ShortAddress source_address,
+                       uint8_t source_endpoint, zcl::ZclClusterId cluster_id,
+                       uint8_t trans_seq_number,
+                       zcl::DuplicateFilter::Clock::time_point now) {
+  return filter.IsDuplicate(source_address, source_endpoint, cluster_id,
+                            zcl::ZclFrameType::Global,
+                            zcl::ZclDirection::ServerToClient,
+                            kReportAttributes, trans_seq_number, now);
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(DuplicateFilterRetransmit) {
+  zcl::DuplicateFilter filter(16, std::chrono::seconds(10));
+  auto now = zcl::DuplicateFilter::Clock::now();
+  BOOST_TEST(!IsDuplicateReport(filter, 0x1234, 1, kOnOff, 5, now));
+  // Unrelated traffic in between
+  BOOST_TEST(!IsDuplicateReport(filter, 0x5678, 1, kOnOff, 5, now));
+  BOOST_TEST(!IsDuplicateReport(filter, 0x1234, 2, kOnOff, 5, now));
+  BOOST_TEST(!IsDuplicateReport(filter, 0x1234, 1, kBasic, 5, now));
+  BOOST_TEST(IsDuplicateReport(filter, 0x1234, 1, kOnOff, 5,
+                               now + std::chrono::seconds(1)));
+  // Same contents, new sequence number
+  BOOST_TEST(!IsDuplicateReport(filter, 0x1234, 1, kOnOff, 6,
+                                now + std::chrono::seconds(1)));
+
+  auto statistics = filter.GetStatistics();
+  BOOST_TEST(statistics.entries == 5);
+  BOOST_TEST(statistics.passed == 5);
+  BOOST_TEST(statistics.suppressed == 1);
+}
+
+BOOST_AUTO_TEST_CASE(DuplicateFilterExpiry) {
+  zcl::DuplicateFilter filter(16, std::chrono::seconds(10));
+  auto now = zcl::DuplicateFilter::Clock::now();
+  BOOST_TEST(!IsDuplicateReport(filter, 0x1234, 1, kOnOff, 5, now));
+  BOOST_TEST(!IsDuplicateReport(filter, 0x1234, 1, kOnOff, 5,
+                                now + std::chrono::seconds(10)));
+  BOOST_TEST(filter.GetStatistics().entries == 1);
+}
+
+BOOST_AUTO_TEST_CASE(DuplicateFilterCapacity) {
+  zcl::DuplicateFilter filter(4, std::chrono::seconds(10));
+  auto now = zcl::DuplicateFilter::Clock::now();
+  for (uint8_t i = 0; i < 5; i++) {
+    BOOST_TEST(!IsDuplicateReport(filter, 0x1234, 1, kOnOff, i, now));
+  }
+  BOOST_TEST(filter.GetStatistics().entries == 4);
+  // Oldest entry was pushed out, the others are still remembered.
+  BOOST_TEST(!IsDuplicateReport(filter, 0x1234, 1, kOnOff, 0, now));
+  BOOST_TEST(IsDuplicateReport(filter, 0x1234, 1, kOnOff, 4, now));
+}
+
+BOOST_AUTO_TEST_CASE(DuplicateFilterCommands) {
+  zcl::DuplicateFilter filter(16, std::chrono::seconds(10));
+  auto now = zcl::DuplicateFilter::Clock::now();
+  BOOST_TEST(!IsDuplicateReport(filter, 0x1234, 1, kOnOff, 5, now));
+  // A response carries the sequence number of the request it answers, which
+  // the device may just have used itself.
+  BOOST_TEST(!filter.IsDuplicate(0x1234, 1, kOnOff, zcl::ZclFrameType::Global,
+                                 zcl::ZclDirection::ServerToClient,
+                                 kReadAttributesResponse, 5, now));
+  BOOST_TEST(!filter.IsDuplicate(0x1234, 1, kOnOff, zcl::ZclFrameType::Local,
+                                 zcl::ZclDirection::ServerToClient,
+                                 kReportAttributes, 5, now));
+  BOOST_TEST(!filter.IsDuplicate(0x1234, 1, kOnOff, zcl::ZclFrameType::Global,
+                                 zcl::ZclDirection::ClientToServer,
+                                 kReportAttributes, 5, now));
+  BOOST_TEST(IsDuplicateReport(filter, 0x1234, 1, kOnOff, 5, now));
+
+  // Remembered without counting as a duplicate itself.
+  filter.Remember(0x1234, 1, kBasic, zcl::ZclFrameType::Global,
+                  zcl::ZclDirection::ServerToClient, kReadAttributesResponse,
+                  6, now);
+  filter.Remember(0x1234, 1, kBasic, zcl::ZclFrameType::Global,
+                  zcl::ZclDirection::ServerToClient, kReadAttributesResponse,
+                  6, now);
+  BOOST_TEST(filter.IsDuplicate(0x1234, 1, kBasic, zcl::ZclFrameType::Global,
+                                zcl::ZclDirection::ServerToClient,
+                                kReadAttributesResponse, 6, now));
+  BOOST_TEST(filter.GetStatistics().entries == 5);
+  BOOST_TEST(filter.GetStatistics().suppressed == 2);
+}
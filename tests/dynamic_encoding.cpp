@@ -1,8 +1,10 @@
 #include <dynamic_encoding/decoding.h>
 #include <dynamic_encoding/encoding.h>
+#include <dynamic_encoding/streaming_encoding.h>
 #include <boost/format.hpp>
 #include <boost/log/utility/manipulators/dump.hpp>
 #include <boost/test/unit_test.hpp>
+#include <chrono>
 
 namespace {
 std::vector<std::tuple<std::vector<uint8_t>, dynamic_encoding::AnyType,
@@ -142,3 +144,244 @@ BOOST_AUTO_TEST_CASE(EncodeNoPayloadNull) {
                            encoded_data);
   BOOST_TEST(encoded_data.size() == 0);
 }
+
+BOOST_AUTO_TEST_CASE(DecodePlanExamples) {
+  dynamic_encoding::Context ctx;
+  for (const auto& example : examples) {
+    const auto& encoded_data = std::get<0>(example);
+    const auto& type = std::get<1>(example);
+    const auto& json = std::get<2>(example);
+    auto plan = dynamic_encoding::CompileDecodePlan(type);
+    auto parsed_until = encoded_data.cbegin();
+    auto rejson =
+        dynamic_encoding::Decode(ctx, plan, parsed_until, encoded_data.cend());
+    BOOST_TEST((parsed_until == encoded_data.cend()) == true);
+    BOOST_TEST(rejson == json);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(DecodePlanBenchmark) {
+  // "Report Attributes", as in clusters.info
+  dynamic_encoding::ObjectType record{
+      {{"Attribute identifier", zcl::DataType::attribId},
+       {"Attribute data", dynamic_encoding::VariantType{}}}};
+  dynamic_encoding::ObjectType report_attributes{
+      {{"reports", dynamic_encoding::ArrayType{0, record}}}};
+  std::vector<std::vector<uint8_t>> payloads{
+      // Temperature
+      {0x00, 0x00, 0x29, 0x66, 0x08},
+      // On/off & a manufacturer specific attribute
+      {0x00, 0x00, 0x10, 0x01, 0x00, 0xF0, 0x23, 0x78, 0x56, 0x34, 0x12},
+      // Xiaomi FF01: battery, temperature, humidity, ...
+      {0x01, 0xFF, 0x42, 0x1F, 0x01, 0x21, 0xD1, 0x0B, 0x04, 0x21, 0xA8,
+       0x13, 0x05, 0x21, 0x15, 0x00, 0x06, 0x24, 0x01, 0x00, 0x00, 0x00,
+       0x00, 0x64, 0x29, 0x66, 0x08, 0x65, 0x21, 0x1E, 0x19, 0x0A, 0x21,
+       0x00, 0x00},
+  };
+  const std::size_t iterations = 20000;
+  auto plan = dynamic_encoding::CompileDecodePlan(report_attributes);
+  dynamic_encoding::Context ctx;
+
+  for (const auto& payload : payloads) {
+    auto parsed_until = payload.cbegin();
+    auto visited = dynamic_encoding::Decode(ctx, report_attributes,
+                                            parsed_until, payload.cend());
+    BOOST_TEST((parsed_until == payload.cend()) == true);
+    parsed_until = payload.cbegin();
+    auto planned =
+        dynamic_encoding::Decode(ctx, plan, parsed_until, payload.cend());
+    BOOST_TEST((parsed_until == payload.cend()) == true);
+    BOOST_TEST(visited == planned);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; i++) {
+    for (const auto& payload : payloads) {
+      auto parsed_until = payload.cbegin();
+      dynamic_encoding::Decode(ctx, report_attributes, parsed_until,
+                               payload.cend());
+    }
+  }
+  std::chrono::duration<double> visitor_time =
+      std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; i++) {
+    for (const auto& payload : payloads) {
+      auto parsed_until = payload.cbegin();
+      dynamic_encoding::Decode(ctx, plan, parsed_until, payload.cend());
+    }
+  }
+  std::chrono::duration<double> plan_time =
+      std::chrono::steady_clock::now() - start;
+
+  // What publishing needs: JSON text
+  start = std::chrono::steady_clock::now();
+  std::size_t text_size = 0;
+  for (std::size_t i = 0; i < iterations; i++) {
+    for (const auto& payload : payloads) {
+      auto parsed_until = payload.cbegin();
+      text_size += tao::json::to_string(dynamic_encoding::Decode(
+                                            ctx, plan, parsed_until,
+                                            payload.cend()))
+                       .size();
+    }
+  }
+  std::chrono::duration<double> plan_to_string_time =
+      std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  std::string text;
+  for (std::size_t i = 0; i < iterations; i++) {
+    for (const auto& payload : payloads) {
+      auto parsed_until = payload.cbegin();
+      text.clear();
+      dynamic_encoding::DecodeToText(ctx, plan, parsed_until, payload.cend(),
+                                     text);
+      text_size -= text.size();
+    }
+  }
+  std::chrono::duration<double> text_time =
+      std::chrono::steady_clock::now() - start;
+  BOOST_TEST(text_size == 0);
+
+  std::size_t messages = iterations * payloads.size();
+  BOOST_TEST_MESSAGE("Report Attributes decoding, visitor: "
+                     << (messages / visitor_time.count()) << " messages/s");
+  BOOST_TEST_MESSAGE("Report Attributes decoding, plan: "
+                     << (messages / plan_time.count()) << " messages/s");
+  BOOST_TEST_MESSAGE("Report Attributes to JSON text, via tao::json::value: "
+                     << (messages / plan_to_string_time.count())
+                     << " messages/s");
+  BOOST_TEST_MESSAGE("Report Attributes to JSON text, direct: "
+                     << (messages / text_time.count()) << " messages/s");
+}
+
+BOOST_AUTO_TEST_CASE(DecodeToTextExamples) {
+  dynamic_encoding::Context ctx;
+  for (const auto& example : examples) {
+    const auto& encoded_data = std::get<0>(example);
+    const auto& type = std::get<1>(example);
+    const auto& json = std::get<2>(example);
+    auto plan = dynamic_encoding::CompileDecodePlan(type);
+    auto parsed_until = encoded_data.cbegin();
+    std::string text;
+    dynamic_encoding::DecodeToText(ctx, plan, parsed_until,
+                                   encoded_data.cend(), text);
+    BOOST_TEST((parsed_until == encoded_data.cend()) == true);
+    BOOST_TEST(tao::json::from_string(text) == json);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(DecodeToTextRecordSpans) {
+  dynamic_encoding::ObjectType record{
+      {{"Attribute identifier", zcl::DataType::attribId},
+       {"Attribute data", dynamic_encoding::VariantType{}}}};
+  auto plan = dynamic_encoding::CompileDecodePlan(dynamic_encoding::ObjectType{
+      {{"reports", dynamic_encoding::ArrayType{0, record}}}});
+  std::vector<uint8_t> payload{0x00, 0x00, 0x29, 0x66, 0x08,
+                               0x01, 0x00, 0x10, 0x01};
+  dynamic_encoding::Context ctx;
+  auto parsed_until = payload.cbegin();
+  std::string text;
+  std::vector<dynamic_encoding::TextSpan> spans;
+  dynamic_encoding::DecodeToText(ctx, plan, parsed_until, payload.cend(), text,
+                                 &spans);
+  BOOST_TEST(text ==
+             "{\"reports\":[{\"Attribute identifier\":0,\"Attribute data\":"
+             "{\"type\":\"int16\",\"value\":2150}},{\"Attribute "
+             "identifier\":1,\"Attribute data\":{\"type\":\"bool\","
+             "\"value\":true}}]}");
+  std::vector<std::string> span_texts;
+  for (const auto& span : spans) {
+    span_texts.push_back(text.substr(span.begin, span.end - span.begin));
+  }
+  BOOST_TEST(span_texts ==
+             std::vector<std::string>(
+                 {"0", "{\"type\":\"int16\",\"value\":2150}", "1",
+                  "{\"type\":\"bool\",\"value\":true}"}),
+             boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(DecodeToTextRecordValueSpans) {
+  // As in Read Attributes Response, with a status before every value.
+  dynamic_encoding::ObjectType record{
+      {{"Attribute identifier", zcl::DataType::attribId},
+       {"Attribute data",
+        dynamic_encoding::ErrorOrType{dynamic_encoding::VariantType{}}}}};
+  auto plan = dynamic_encoding::CompileDecodePlan(dynamic_encoding::ObjectType{
+      {{"records", dynamic_encoding::ArrayType{0, record}}}});
+  std::vector<uint8_t> payload{0x00, 0x00, 0x00, 0x10, 0x01,
+                               0x01, 0x00, 0x86};
+  dynamic_encoding::Context ctx;
+  auto parsed_until = payload.cbegin();
+  std::string text;
+  std::vector<dynamic_encoding::TextSpan> spans;
+  dynamic_encoding::DecodeToText(ctx, plan, parsed_until, payload.cend(), text,
+                                 &spans);
+  BOOST_TEST(text ==
+             "{\"records\":[{\"Attribute identifier\":0,\"Attribute data\":"
+             "{\"success\":{\"type\":\"bool\",\"value\":true}}},{\"Attribute "
+             "identifier\":1,\"Attribute data\":{\"error\":134}}]}");
+  std::vector<std::string> value_texts;
+  for (const auto& span : spans) {
+    value_texts.push_back(
+        text.substr(span.value_begin, span.value_end - span.value_begin));
+  }
+  // Failed reads have no value.
+  BOOST_TEST(value_texts ==
+             std::vector<std::string>(
+                 {"0", "{\"type\":\"bool\",\"value\":true}", "1", ""}),
+             boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(StreamingEncodeMatchesDom) {
+  dynamic_encoding::ObjectType type{{{"Level", zcl::DataType::uint8},
+                                     {"Transition time", zcl::DataType::uint16},
+                                     {"On", zcl::DataType::_bool},
+                                     {"Name", zcl::DataType::string},
+                                     {"Offset", zcl::DataType::int16}}};
+  auto index = dynamic_encoding::CompileEncodeIndex(type);
+  BOOST_TEST(index.streamable);
+  dynamic_encoding::Context ctx;
+  for (const std::string message :
+       {"{\"Level\":100,\"Transition time\":10,\"On\":true,\"Name\":\"a\","
+        "\"Offset\":-5}",
+        "{\"Offset\":-5,\"Name\":\"a\",\"On\":false,\"Transition "
+        "time\":10,\"Level\":100}",
+        "{\"Level\":1,\"Transition time\":0,\"Offset\":0}",
+        "{\"Level\":1,\"Transition time\":2,\"Offset\":3,\"Unknown\":{\"a\":"
+        "[1,{}]},\"Other\":[]}"}) {
+    std::vector<uint8_t> expected;
+    dynamic_encoding::Encode(ctx, type, tao::json::from_string(message),
+                             expected);
+    std::vector<uint8_t> encoded;
+    dynamic_encoding::EncodeFromString(ctx, index, message, encoded);
+    BOOST_TEST(encoded == expected);
+  }
+
+  std::vector<uint8_t> encoded;
+  dynamic_encoding::EncodeFromString(
+      ctx, dynamic_encoding::CompileEncodeIndex(dynamic_encoding::ObjectType{}),
+      "", encoded);
+  BOOST_TEST(encoded.size() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(StreamingEncodeErrors) {
+  dynamic_encoding::ObjectType type{{{"Level", zcl::DataType::uint8}}};
+  auto index = dynamic_encoding::CompileEncodeIndex(type);
+  dynamic_encoding::Context ctx;
+  for (const std::string message :
+       {"", "[]", "1", "{\"Level\":[1]}", "{\"Level\":256}",
+        "{\"Level\":1,\"Level\":2}", "{}"}) {
+    std::vector<uint8_t> encoded;
+    BOOST_CHECK_THROW(
+        dynamic_encoding::EncodeFromString(ctx, index, message, encoded),
+        std::exception);
+  }
+  BOOST_TEST(!dynamic_encoding::CompileEncodeIndex(
+                  dynamic_encoding::ObjectType{
+                      {{"Data", zcl::DataType::data8},
+                       {"Value", dynamic_encoding::VariantType{}}}})
+                  .streamable);
+}
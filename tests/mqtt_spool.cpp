@@ -0,0 +1,247 @@
+#include <mqtt_spool.h>
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+// Removes the spool's files before & after the test, declared before the spool
+// so the spool is gone by then.
+struct SpoolFiles {
+  explicit SpoolFiles(std::string filename) : filename(filename) { Remove(); }
+  ~SpoolFiles() { Remove(); }
+  void Remove() {
+    std::remove((filename + ".cursor").c_str());
+    for (int i = 1; i < 100; i++) {
+      std::remove((filename + "." + std::to_string(i)).c_str());
+    }
+  }
+  const std::string filename;
+};
+
+MqttSpool::Options MakeOptions(const std::string& filename) {
+  MqttSpool::Options options;
+  options.filename = filename;
+  return options;
+}
+
+std::vector<std::string> Drain(MqttSpool& spool,
+                               MqttSpool::Clock::time_point now,
+                               bool acknowledge = true) {
+  std::vector<std::string> messages;
+  while (auto record = spool.Next(now)) {
+    messages.push_back(record->topic + "=" + record->message);
+    if (acknowledge) {
+      spool.Acknowledge(record->position);
+    }
+  }
+  return messages;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(MqttSpoolInOrder) {
+  const std::string filename = "mqtt_spool_test.spool";
+  SpoolFiles files(filename);
+  auto now = MqttSpool::Clock::now();
+  MqttSpool spool(MakeOptions(filename));
+  BOOST_TEST(spool.Empty());
+  BOOST_TEST(spool.Append("a/b", "1", 1, true, now));
+  BOOST_TEST(spool.Append("a/c", "2", 0, false, now));
+  BOOST_TEST(!spool.Empty());
+
+  auto record = spool.Next(now);
+  BOOST_TEST_REQUIRE(!!record);
+  BOOST_TEST(record->topic == "a/b");
+  BOOST_TEST(record->message == "1");
+  BOOST_TEST(record->qos == 1);
+  BOOST_TEST(record->retain);
+  // Appending while draining
+  BOOST_TEST(spool.Append("a/d", "3", 0, false, now));
+  std::vector<std::string> expected{"a/c=2", "a/d=3"};
+  BOOST_TEST(Drain(spool, now) == expected, boost::test_tools::per_element());
+  BOOST_TEST(spool.Empty());
+  BOOST_TEST(spool.GetStatistics().spooled == 3);
+  BOOST_TEST(spool.GetStatistics().drained == 3);
+}
+
+BOOST_AUTO_TEST_CASE(MqttSpoolSurvivesRestart) {
+  const std::string filename = "mqtt_spool_test.spool";
+  SpoolFiles files(filename);
+  auto now = MqttSpool::Clock::now();
+  {
+    MqttSpool spool(MakeOptions(filename));
+    for (int i = 0; i < 4; i++) {
+      spool.Append("topic", std::to_string(i), 1, false, now);
+    }
+    auto record = spool.Next(now);
+    BOOST_TEST_REQUIRE(!!record);
+    spool.Acknowledge(record->position);
+    spool.Sync();
+  }
+  {
+    MqttSpool spool(MakeOptions(filename));
+    BOOST_TEST(spool.GetStatistics().records == 3);
+    BOOST_TEST(spool.Append("topic", "4", 1, false, now));
+    std::vector<std::string> expected{"topic=1", "topic=2", "topic=3",
+                                      "topic=4"};
+    BOOST_TEST(Drain(spool, now) == expected, boost::test_tools::per_element());
+  }
+  {
+    // Drained before it went away
+    MqttSpool spool(MakeOptions(filename));
+    BOOST_TEST(spool.Empty());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(MqttSpoolUnacknowledged) {
+  const std::string filename = "mqtt_spool_test.spool";
+  SpoolFiles files(filename);
+  auto now = MqttSpool::Clock::now();
+  auto options = MakeOptions(filename);
+  options.segment_bytes = 50;
+  {
+    MqttSpool spool(options);
+    for (int i = 0; i < 4; i++) {
+      spool.Append("topic", std::to_string(i), 1, false, now);
+    }
+    auto first = spool.Next(now);
+    auto second = spool.Next(now);
+    BOOST_TEST_REQUIRE(!!first);
+    BOOST_TEST_REQUIRE(!!second);
+    // Acknowledged out of order, the cursor stays at the first one.
+    spool.Acknowledge(second->position);
+    std::vector<std::string> expected{"topic=2", "topic=3"};
+    BOOST_TEST(Drain(spool, now, false) == expected,
+               boost::test_tools::per_element());
+    spool.Sync();
+  }
+  MqttSpool spool(options);
+  BOOST_TEST(spool.GetStatistics().records == 4);
+  std::vector<std::string> expected{"topic=0", "topic=1", "topic=2",
+                                    "topic=3"};
+  BOOST_TEST(Drain(spool, now) == expected, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(MqttSpoolWithoutCursor) {
+  const std::string filename = "mqtt_spool_test.spool";
+  SpoolFiles files(filename);
+  auto now = MqttSpool::Clock::now();
+  auto options = MakeOptions(filename);
+  options.segment_bytes = 50;
+  {
+    MqttSpool spool(options);
+    for (int i = 0; i < 4; i++) {
+      spool.Append("topic", std::to_string(i), 1, false, now);
+    }
+    // Drains the first two segments, so the rest starts at a later one.
+    Drain(spool, now);
+    BOOST_TEST(spool.Append("topic", "4", 1, false, now));
+  }
+  std::remove((filename + ".cursor").c_str());
+  BOOST_TEST(std::ifstream(filename + ".1").fail());
+  // Without knowing how far it got, all that's left is sent again.
+  MqttSpool spool(options);
+  BOOST_TEST(spool.GetStatistics().records == 2);
+  spool.Append("topic", "5", 1, false, now);
+  std::vector<std::string> expected{"topic=3", "topic=4", "topic=5"};
+  BOOST_TEST(Drain(spool, now) == expected, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(MqttSpoolTornRecord) {
+  const std::string filename = "mqtt_spool_test.spool";
+  SpoolFiles files(filename);
+  auto now = MqttSpool::Clock::now();
+  {
+    MqttSpool spool(MakeOptions(filename));
+    spool.Append("topic", "complete", 1, false, now);
+    spool.Append("topic", "torn", 1, false, now);
+  }
+  // Cut the last record short, as a crash halfway through writing it would.
+  std::string data;
+  {
+    std::ifstream file(filename + ".1", std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+  }
+  {
+    std::ofstream file(filename + ".1", std::ios::binary | std::ios::trunc);
+    file << data.substr(0, data.size() - 2);
+  }
+  MqttSpool spool(MakeOptions(filename));
+  BOOST_TEST(spool.GetStatistics().records == 1);
+  spool.Append("topic", "after", 1, false, now);
+  std::vector<std::string> expected{"topic=complete", "topic=after"};
+  BOOST_TEST(Drain(spool, now) == expected, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(MqttSpoolPolicies) {
+  const std::string filename = "mqtt_spool_test.spool";
+  SpoolFiles files(filename);
+  auto now = MqttSpool::Clock::now();
+  auto options = MakeOptions(filename);
+  options.policies.emplace_back("hub/report/statistics",
+                                MqttSpool::Policy::Drop);
+  options.policies.emplace_back("hub/+/linkquality",
+                                MqttSpool::Policy::KeepLatest);
+  {
+    MqttSpool spool(options);
+    BOOST_TEST(!spool.Append("hub/report/statistics", "{}", 0, false, now));
+    spool.Append("hub/a/linkquality", "10", 0, false, now);
+    spool.Append("hub/b/linkquality", "20", 0, false, now);
+    spool.Append("hub/a/1/in/OnOff/OnOff", "true", 0, false, now);
+    spool.Append("hub/a/linkquality", "11", 0, false, now);
+    spool.Sync();
+  }
+  // Which values are superseded is known again after a restart.
+  MqttSpool spool(options);
+  spool.Append("hub/a/1/in/OnOff/OnOff", "false", 0, false, now);
+  std::vector<std::string> expected{
+      "hub/b/linkquality=20", "hub/a/1/in/OnOff/OnOff=true",
+      "hub/a/linkquality=11", "hub/a/1/in/OnOff/OnOff=false"};
+  BOOST_TEST(Drain(spool, now) == expected, boost::test_tools::per_element());
+  // The superseded value, statistics only count since the restart.
+  BOOST_TEST(spool.GetStatistics().dropped == 1);
+}
+
+BOOST_AUTO_TEST_CASE(MqttSpoolLimits) {
+  const std::string filename = "mqtt_spool_test.spool";
+  SpoolFiles files(filename);
+  auto now = MqttSpool::Clock::now();
+  auto options = MakeOptions(filename);
+  options.segment_bytes = 100;
+  options.max_bytes = 300;
+  options.max_age = std::chrono::hours(1);
+  MqttSpool spool(options);
+  std::string message(50, 'x');
+  for (int i = 0; i < 10; i++) {
+    spool.Append("topic", std::to_string(i) + message, 0, false, now);
+  }
+  // One record per segment, only the last three segments are kept.
+  BOOST_TEST(spool.GetStatistics().records == 3);
+  BOOST_TEST(spool.GetStatistics().bytes <= 300u);
+  BOOST_TEST(spool.GetStatistics().dropped == 7);
+  auto record = spool.Next(now);
+  BOOST_TEST_REQUIRE(!!record);
+  BOOST_TEST(record->message == "7" + message);
+
+  BOOST_TEST(Drain(spool, now + std::chrono::hours(2)).empty());
+  BOOST_TEST(spool.GetStatistics().dropped == 9);
+  BOOST_TEST(spool.Empty());
+}
+
+BOOST_AUTO_TEST_CASE(MqttSpoolTopicMatches) {
+  BOOST_TEST(MqttSpool::TopicMatches("a/b", "a/b"));
+  BOOST_TEST(!MqttSpool::TopicMatches("a/b", "a/bc"));
+  BOOST_TEST(!MqttSpool::TopicMatches("a/b", "a/b/c"));
+  BOOST_TEST(!MqttSpool::TopicMatches("a/b/c", "a/b"));
+  BOOST_TEST(MqttSpool::TopicMatches("a/+/c", "a/b/c"));
+  BOOST_TEST(MqttSpool::TopicMatches("a/+/c", "a//c"));
+  BOOST_TEST(!MqttSpool::TopicMatches("a/+/c", "a/b/d"));
+  BOOST_TEST(MqttSpool::TopicMatches("a/#", "a/b/c"));
+  BOOST_TEST(MqttSpool::TopicMatches("a/#", "a"));
+  BOOST_TEST(!MqttSpool::TopicMatches("a/#", "b/c"));
+  BOOST_TEST(MqttSpool::TopicMatches("#", "a/b"));
+  BOOST_TEST(MqttSpool::TopicMatches("+/+", "a/b"));
+  BOOST_TEST(!MqttSpool::TopicMatches("+", "a/b"));
+}
@@ -1,6 +1,11 @@
 #include <mqtt_wrapper.h>
+#include <mqtt_wrapper_impl.h>
 #include <boost/optional/optional_io.hpp>
 #include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
 
 BOOST_AUTO_TEST_CASE(FullExample) {
   std::string uri(
@@ -25,3 +30,268 @@ BOOST_AUTO_TEST_CASE(MinimalExample) {
   };
   BOOST_TEST(result == expected);
 }
+
+namespace {
+// Stands in for an mqtt_cpp client, recording what is sent and letting the
+// test play the broker.
+class FakeClient {
+ public:
+  typedef std::function<void(const boost::system::error_code&)> Handler;
+  struct Sent {
+    std::uint16_t packet_id;
+    std::string topic;
+    std::string message;
+  };
+
+  void set_clean_session(bool clean) { clean_session = clean; }
+  void set_connack_handler(std::function<bool(bool, std::uint8_t)> f) {
+    connack = f;
+  }
+  void set_puback_handler(std::function<bool(std::uint16_t)> f) {
+    puback = f;
+  }
+  void set_pubcomp_handler(std::function<bool(std::uint16_t)> f) {}
+  void set_publish_handler(
+      std::function<bool(std::uint8_t, boost::optional<std::uint16_t>,
+                         std::string, std::string)>
+          f) {}
+  void set_error_handler(
+      std::function<bool(const boost::system::error_code&)> f) {
+    error = f;
+  }
+  void connect(Handler f) { connects++; }
+  std::uint16_t acquire_unique_packet_id() { return ++last_packet_id; }
+  void acquired_async_publish(std::uint16_t packet_id,
+                              const std::string& topic,
+                              const std::string& message, std::uint8_t qos,
+                              bool retain, Handler f) {
+    sent.push_back(Sent{packet_id, topic, message});
+  }
+  void async_subscribe(
+      std::vector<std::tuple<std::string, std::uint8_t>> topics) {
+    subscribes++;
+  }
+
+  std::function<bool(bool, std::uint8_t)> connack;
+  std::function<bool(std::uint16_t)> puback;
+  std::function<bool(const boost::system::error_code&)> error;
+  std::uint16_t last_packet_id = 0;
+  bool clean_session = true;
+  std::size_t connects = 0;
+  std::size_t subscribes = 0;
+  std::vector<Sent> sent;
+};
+
+void Poll(boost::asio::io_service& io_service) {
+  io_service.reset();
+  io_service.poll();
+}
+
+std::shared_ptr<MqttWrapperImpl<FakeClient>> MakeWrapper(
+    boost::asio::io_service& io_service, std::shared_ptr<FakeClient> client,
+    std::size_t max_in_flight) {
+  MqttWrapper::Options options;
+  options.max_in_flight = max_in_flight;
+  auto wrapper = std::make_shared<MqttWrapperImpl<FakeClient>>(
+      io_service, options, client);
+  wrapper->PostConstructor();
+  Poll(io_service);
+  return wrapper;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(InFlightWindow) {
+  boost::asio::io_service io_service;
+  auto client = std::make_shared<FakeClient>();
+  auto wrapper = MakeWrapper(io_service, client, 2);
+  for (int i = 0; i < 5; i++) {
+    wrapper->Publish("topic", std::to_string(i), mqtt::qos::at_least_once)
+        .detach();
+  }
+  Poll(io_service);
+  // Queued while connecting
+  BOOST_TEST(client->sent.size() == 0);
+  BOOST_TEST(wrapper->GetStatistics().queued == 5);
+
+  client->connack(false, mqtt::connect_return_code::accepted);
+  Poll(io_service);
+  BOOST_TEST_REQUIRE(client->sent.size() == 2);
+  BOOST_TEST(wrapper->GetStatistics().queued == 3);
+  BOOST_TEST(wrapper->GetStatistics().in_flight == 2);
+
+  client->puback(client->sent[0].packet_id);
+  Poll(io_service);
+  BOOST_TEST_REQUIRE(client->sent.size() == 3);
+  BOOST_TEST(client->sent[2].message == "2");
+  BOOST_TEST(wrapper->GetStatistics().acknowledged == 1);
+
+  // QoS 0 doesn't take up room, but doesn't overtake either.
+  wrapper->Publish("topic", "qos0", mqtt::qos::at_most_once).detach();
+  Poll(io_service);
+  BOOST_TEST(client->sent.size() == 3);
+  for (std::size_t i = 1; i < 3; i++) {
+    client->puback(client->sent[i].packet_id);
+  }
+  Poll(io_service);
+  BOOST_TEST_REQUIRE(client->sent.size() == 6);
+  BOOST_TEST(client->sent[3].message == "3");
+  BOOST_TEST(client->sent[4].message == "4");
+  BOOST_TEST(client->sent[5].message == "qos0");
+  BOOST_TEST(wrapper->GetStatistics().queued == 0);
+}
+
+BOOST_AUTO_TEST_CASE(InFlightRequeuedOnDisconnect) {
+  boost::asio::io_service io_service;
+  auto client = std::make_shared<FakeClient>();
+  auto wrapper = MakeWrapper(io_service, client, 2);
+  client->connack(false, mqtt::connect_return_code::accepted);
+  Poll(io_service);
+  for (int i = 0; i < 3; i++) {
+    wrapper->Publish("topic", std::to_string(i), mqtt::qos::at_least_once)
+        .detach();
+  }
+  Poll(io_service);
+  BOOST_TEST_REQUIRE(client->sent.size() == 2);
+
+  client->error(boost::asio::error::connection_reset);
+  Poll(io_service);
+  BOOST_TEST(wrapper->GetStatistics().requeued == 2);
+  BOOST_TEST(wrapper->GetStatistics().queued == 3);
+  BOOST_TEST(wrapper->GetStatistics().in_flight == 0);
+
+  client->sent.clear();
+  client->connack(false, mqtt::connect_return_code::accepted);
+  Poll(io_service);
+  BOOST_TEST_REQUIRE(client->sent.size() == 2);
+  BOOST_TEST(client->sent[0].message == "0");
+  BOOST_TEST(client->sent[1].message == "1");
+}
+
+BOOST_AUTO_TEST_CASE(SpooledWhileDisconnected) {
+  const std::string filename = "mqtt_wrapper_test.spool";
+  boost::asio::io_service io_service;
+  auto client = std::make_shared<FakeClient>();
+  MqttWrapper::Options options;
+  options.max_in_flight = 2;
+  MqttSpool::Options spool_options;
+  spool_options.filename = filename;
+  options.spool = std::make_shared<MqttSpool>(spool_options);
+  auto wrapper = std::make_shared<MqttWrapperImpl<FakeClient>>(
+      io_service, options, client);
+  wrapper->PostConstructor();
+  Poll(io_service);
+
+  for (int i = 0; i < 3; i++) {
+    wrapper->Publish("topic", std::to_string(i), mqtt::qos::at_least_once)
+        .detach();
+  }
+  Poll(io_service);
+  BOOST_TEST(wrapper->GetStatistics().queued == 0);
+  BOOST_TEST_REQUIRE(!!wrapper->GetStatistics().spool);
+  BOOST_TEST(wrapper->GetStatistics().spool->records == 3);
+
+  // Drained within the window, with later publishes staying behind it.
+  client->connack(false, mqtt::connect_return_code::accepted);
+  Poll(io_service);
+  wrapper->Publish("topic", "3", mqtt::qos::at_least_once).detach();
+  Poll(io_service);
+  BOOST_TEST_REQUIRE(client->sent.size() == 2);
+  for (int i = 0; i < 2; i++) {
+    client->puback(client->sent[i].packet_id);
+    Poll(io_service);
+  }
+  BOOST_TEST_REQUIRE(client->sent.size() == 4);
+  for (int i = 0; i < 4; i++) {
+    BOOST_TEST(client->sent[i].message == std::to_string(i));
+  }
+  BOOST_TEST(wrapper->GetStatistics().spool->drained == 4);
+
+  wrapper.reset();
+  options.spool.reset();
+  // What the server didn't acknowledge is sent again after a restart.
+  {
+    MqttSpool spool(spool_options);
+    BOOST_TEST(spool.GetStatistics().records == 2);
+  }
+  std::remove((filename + ".cursor").c_str());
+  std::remove((filename + ".1").c_str());
+  std::remove((filename + ".2").c_str());
+}
+
+BOOST_AUTO_TEST_CASE(ReconnectDelay) {
+  MqttWrapper::Options options;
+  options.reconnect_delay = std::chrono::seconds(1);
+  options.reconnect_max_delay = std::chrono::seconds(10);
+  BOOST_TEST(MqttWrapper::ReconnectDelay(options, 0, 0.99).count() == 0);
+  BOOST_TEST(MqttWrapper::ReconnectDelay(options, 1, 0.5).count() == 500);
+  BOOST_TEST(MqttWrapper::ReconnectDelay(options, 2, 0.5).count() == 1000);
+  BOOST_TEST(MqttWrapper::ReconnectDelay(options, 4, 0.5).count() == 4000);
+  BOOST_TEST(MqttWrapper::ReconnectDelay(options, 5, 0.5).count() == 5000);
+  BOOST_TEST(MqttWrapper::ReconnectDelay(options, 1000, 0.5).count() == 5000);
+  BOOST_TEST(MqttWrapper::ReconnectDelay(options, 1000, 0.0).count() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(ReconnectsRightAway) {
+  boost::asio::io_service io_service;
+  auto client = std::make_shared<FakeClient>();
+  MqttWrapper::Options options;
+  options.reconnect_delay = std::chrono::hours(1);
+  auto wrapper = std::make_shared<MqttWrapperImpl<FakeClient>>(
+      io_service, options, client);
+  wrapper->PostConstructor();
+  Poll(io_service);
+  BOOST_TEST(client->connects == 1);
+  client->connack(false, mqtt::connect_return_code::accepted);
+  Poll(io_service);
+
+  client->error(boost::asio::error::connection_reset);
+  Poll(io_service);
+  BOOST_TEST(client->connects == 2);
+  // The next attempt waits
+  client->error(boost::asio::error::connection_refused);
+  Poll(io_service);
+  BOOST_TEST(client->connects == 2);
+  BOOST_TEST(wrapper->GetStatistics().reconnect_attempts == 1);
+  BOOST_TEST(wrapper->GetStatistics().reconnects == 0);
+}
+
+BOOST_AUTO_TEST_CASE(PersistentSession) {
+  boost::asio::io_service io_service;
+  auto client = std::make_shared<FakeClient>();
+  MqttWrapper::Options options;
+  options.clean_session = false;
+  auto wrapper = std::make_shared<MqttWrapperImpl<FakeClient>>(
+      io_service, options, client);
+  wrapper->PostConstructor();
+  wrapper->Subscribe({std::make_tuple("topic", mqtt::qos::at_least_once)})
+      .detach();
+  Poll(io_service);
+  BOOST_TEST(!client->clean_session);
+  client->connack(false, mqtt::connect_return_code::accepted);
+  Poll(io_service);
+  BOOST_TEST(client->subscribes == 1);
+  wrapper->Publish("topic", "0", mqtt::qos::at_least_once).detach();
+  Poll(io_service);
+  BOOST_TEST_REQUIRE(client->sent.size() == 1);
+
+  // The server still has the subscription & the publish in flight.
+  client->error(boost::asio::error::connection_reset);
+  Poll(io_service);
+  client->connack(true, mqtt::connect_return_code::accepted);
+  Poll(io_service);
+  BOOST_TEST(client->subscribes == 1);
+  BOOST_TEST(client->sent.size() == 1);
+  BOOST_TEST(wrapper->GetStatistics().requeued == 0);
+  BOOST_TEST(wrapper->GetStatistics().in_flight == 1);
+  BOOST_TEST(wrapper->GetStatistics().reconnects == 1);
+
+  // Unless it lost the session.
+  client->error(boost::asio::error::connection_reset);
+  Poll(io_service);
+  client->connack(false, mqtt::connect_return_code::accepted);
+  Poll(io_service);
+  BOOST_TEST(client->subscribes == 2);
+  BOOST_TEST_REQUIRE(client->sent.size() == 2);
+  BOOST_TEST(client->sent[1].message == "0");
+  BOOST_TEST(wrapper->GetStatistics().requeued == 1);
+}
@@ -0,0 +1,111 @@
+#include <topic_cache.h>
+#include <boost/test/unit_test.hpp>
+#include <string>
+
+namespace {
+clusterdb::ClusterInfo MakeCluster() {
+  clusterdb::ClusterInfo cluster;
+  cluster.id = (zcl::ZclClusterId)0x0006;
+  cluster.name = "OnOff";
+  return cluster;
+}
+
+clusterdb::CommandInfo MakeCommand() {
+  clusterdb::CommandInfo command;
+  command.id = (zcl::ZclCommandId)0x0A;
+  command.name = "Report Attributes";
+  command.is_global = true;
+  return command;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TopicCacheInternsTopics) {
+  TopicCache cache("hub/");
+  auto cluster = MakeCluster();
+  auto command = MakeCommand();
+  auto& topics = cache.Command(0x00158D0001234567ULL, 1,
+                               zcl::ZclDirection::ServerToClient, cluster,
+                               command, 1);
+  BOOST_TEST(*topics.topic ==
+             "hub/00158D0001234567/1/in/OnOff/Report Attributes");
+  TopicCache::Topic first = topics.topic;
+  BOOST_TEST(cache
+                 .Command(0x00158D0001234567ULL, 1,
+                          zcl::ZclDirection::ServerToClient, cluster, command,
+                          1)
+                 .topic == first);
+  BOOST_TEST(cache
+                 .Command(0x00158D0001234567ULL, 2,
+                          zcl::ZclDirection::ServerToClient, cluster, command,
+                          1)
+                 .topic != first);
+
+  auto& same = cache.Command(0x00158D0001234567ULL, 1,
+                             zcl::ZclDirection::ServerToClient, cluster,
+                             command, 1);
+  int calls = 0;
+  auto subtopic = [&calls]() {
+    calls++;
+    return std::string("OnOff");
+  };
+  TopicCache::Topic attribute =
+      cache.AttributeTopic(same, "\"OnOff\"", subtopic);
+  BOOST_TEST(*attribute ==
+             "hub/00158D0001234567/1/in/OnOff/Report Attributes/OnOff");
+  BOOST_TEST(cache.AttributeTopic(same, "\"OnOff\"", subtopic) == attribute);
+  BOOST_TEST(calls == 1);
+
+  BOOST_TEST(*cache.LinkQualityTopic(0x1234) ==
+             "hub/0000000000001234/linkquality");
+  BOOST_TEST(cache.LinkQualityTopic(0x1234) == cache.LinkQualityTopic(0x1234));
+
+  // Topics already handed out stay valid.
+  cache.Clear();
+  BOOST_TEST(*first == "hub/00158D0001234567/1/in/OnOff/Report Attributes");
+  BOOST_TEST(cache
+                 .Command(0x00158D0001234567ULL, 1,
+                          zcl::ZclDirection::ServerToClient, cluster, command,
+                          1)
+                 .topic != first);
+}
+
+BOOST_AUTO_TEST_CASE(TopicCacheLimits) {
+  TopicCache cache("", 2);
+  auto cluster = MakeCluster();
+  auto command = MakeCommand();
+  for (uint8_t endpoint = 1; endpoint <= 3; endpoint++) {
+    cache.Command(1, endpoint, zcl::ZclDirection::ServerToClient, cluster,
+                  command, 1);
+  }
+  auto& topics = cache.Command(1, 3, zcl::ZclDirection::ServerToClient,
+                               cluster, command, 1);
+  BOOST_TEST(*topics.topic == "0000000000000001/3/in/OnOff/Report Attributes");
+
+  for (int id = 0; id < 1000; id++) {
+    std::string key = std::to_string(id);
+    cache.AttributeTopic(topics, key, [&key]() { return key; });
+  }
+  BOOST_TEST(topics.attributes.size() < 1000);
+  BOOST_TEST(*cache.AttributeTopic(topics, "999", []() {
+    return std::string("999");
+  }) == "0000000000000001/3/in/OnOff/Report Attributes/999");
+}
+
+BOOST_AUTO_TEST_CASE(TopicCacheGenerations) {
+  TopicCache cache("");
+  auto cluster = MakeCluster();
+  auto command = MakeCommand();
+  auto renamed = cluster;
+  renamed.name = "Switch";
+  // A message still being handled with the database from before a reload puts
+  // its topic back after the cache was cleared.
+  cache.Command(1, 1, zcl::ZclDirection::ServerToClient, cluster, command, 1);
+  auto& topics = cache.Command(1, 1, zcl::ZclDirection::ServerToClient,
+                               renamed, command, 2);
+  BOOST_TEST(*topics.topic == "0000000000000001/1/in/Switch/Report Attributes");
+  TopicCache::Topic current = topics.topic;
+  BOOST_TEST(cache
+                 .Command(1, 1, zcl::ZclDirection::ServerToClient, renamed,
+                          command, 2)
+                 .topic == current);
+}
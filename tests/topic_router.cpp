@@ -0,0 +1,161 @@
+#include <topic_router.h>
+#include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+struct Recorder {
+  std::string name;
+  std::vector<std::string>* calls;
+
+  void operator()(const TopicRouter::Match& match,
+                  const std::string& message) const {
+    std::string call = name;
+    for (std::size_t i = 0; i < match.size; i++) {
+      call += " " + match.text[i].to_string() + "=" +
+              std::to_string(match.number[i]);
+    }
+    calls->push_back(call + " " + message);
+  }
+};
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TopicRouterCaptures) {
+  std::vector<std::string> calls;
+  TopicRouter router;
+  router.Add("control/permitjoin", Recorder{"permitjoin", &calls});
+  router.Add("control/hub/1/directjoin/{hex}", Recorder{"directjoin", &calls});
+  router.Add("group/{dec}/out/{name}", Recorder{"group", &calls});
+  router.Add("{hex}/{dec}/out/{name}", Recorder{"short", &calls});
+  router.Add("{hex}/{dec}/out/{name}/{name}", Recorder{"long", &calls});
+
+  BOOST_TEST(router.Route("control/permitjoin", "60"));
+  BOOST_TEST(router.Route("control/hub/1/directjoin/00158D00FF", ""));
+  BOOST_TEST(router.Route("group/12/out/On", "{}"));
+  BOOST_TEST(router.Route("00158d0001234567/1/out/OnOff", "{}"));
+  BOOST_TEST(router.Route("00158d0001234567/1/out/OnOff/Toggle", ""));
+  std::vector<std::string> expected{
+      "permitjoin 60",
+      "directjoin 00158D00FF=361562367 ",
+      "group 12=12 On=0 {}",
+      "short 00158d0001234567=6066005669528935 1=1 OnOff=0 {}",
+      "long 00158d0001234567=6066005669528935 1=1 OnOff=0 Toggle=0 ",
+  };
+  BOOST_TEST(calls == expected, boost::test_tools::per_element());
+
+  // Only the literal "group" matches the start of this, so it must not be
+  // taken for a shorter group topic, nor for a hexadecimal address.
+  calls.clear();
+  BOOST_TEST(!router.Route("group/12/out/On/Off/Toggle", ""));
+  BOOST_TEST(calls.empty());
+}
+
+BOOST_AUTO_TEST_CASE(TopicRouterMismatches) {
+  std::vector<std::string> calls;
+  TopicRouter router;
+  router.Add("control/permitjoin", Recorder{"permitjoin", &calls});
+  router.Add("{hex}/{dec}/out/{name}", Recorder{"short", &calls});
+
+  BOOST_TEST(!router.Route("control/permitjoin/", ""));
+  BOOST_TEST(!router.Route("control", ""));
+  BOOST_TEST(!router.Route("", ""));
+  BOOST_TEST(!router.Route("xyz/1/out/OnOff", ""));
+  BOOST_TEST(!router.Route("00158d0001234567/x/out/OnOff", ""));
+  BOOST_TEST(!router.Route("00158d0001234567/1/out/", ""));
+  BOOST_TEST(!router.Route("00158d0001234567/1/out/OnOff/Toggle", ""));
+  // More than 64 bits
+  BOOST_TEST(!router.Route("100158d0001234567/1/out/OnOff", ""));
+  BOOST_TEST(!router.Route("1/18446744073709551616/out/OnOff", ""));
+  BOOST_TEST(router.Route("1/18446744073709551615/out/OnOff", ""));
+  BOOST_TEST(calls.size() == 1);
+
+  BOOST_CHECK_THROW(router.Add("control/permitjoin", Recorder{"", &calls}),
+                    std::runtime_error);
+  BOOST_CHECK_THROW(router.Add("control//permitjoin", Recorder{"", &calls}),
+                    std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(TopicRouterBacktracks) {
+  std::vector<std::string> calls;
+  TopicRouter router;
+  // "add" is a literal, valid hexadecimal and a name, so all of these start
+  // out matching.
+  router.Add("{hex}/groups", Recorder{"hex", &calls});
+  router.Add("{name}/members", Recorder{"name", &calls});
+  router.Add("add/{name}/x", Recorder{"literal", &calls});
+
+  BOOST_TEST(router.Route("add/groups", ""));
+  BOOST_TEST(router.Route("add/members", ""));
+  BOOST_TEST(router.Route("add/members/x", ""));
+  BOOST_TEST(!router.Route("add/members/y", ""));
+  std::vector<std::string> expected{
+      "hex add=2781 ",
+      "name add=0 ",
+      "literal members=0 ",
+  };
+  BOOST_TEST(calls == expected, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(TopicRouterBenchmark) {
+  const std::size_t message_count = 200000;
+  std::vector<std::string> topics;
+  for (unsigned int i = 0; i < 64; i++) {
+    topics.push_back("00158d00012345" + std::to_string(10 + i) + "/" +
+                     std::to_string(1 + i % 3) + "/out/OnOff/" +
+                     (i % 2 ? "On" : "Toggle"));
+  }
+
+  // The regular expressions OnPublish went through before a long-form device
+  // command matched.
+  std::vector<std::regex> expressions{
+      std::regex("permitjoin"),
+      std::regex("group/([0-9]+)/out/([^/]+)"),
+      std::regex("group/([0-9]+)/out/([^/]+)/([^/]+)"),
+      std::regex("([0-9a-fA-F]+)/([0-9]+)/out/([^/]+)"),
+      std::regex("([0-9a-fA-F]+)/([0-9]+)/out/([^/]+)/([^/]+)"),
+  };
+  auto start = std::chrono::steady_clock::now();
+  std::size_t regex_matched = 0;
+  for (std::size_t i = 0; i < message_count; i++) {
+    const std::string& topic = topics[i % topics.size()];
+    std::smatch match;
+    for (const auto& expression : expressions) {
+      if (std::regex_match(topic, match, expression)) {
+        regex_matched += std::stoull(match[2], 0, 10);
+        break;
+      }
+    }
+  }
+  std::chrono::duration<double> regex_time =
+      std::chrono::steady_clock::now() - start;
+
+  std::size_t matched = 0;
+  TopicRouter router;
+  auto count = [&matched](const TopicRouter::Match& match,
+                          const std::string& message) {
+    matched += match.number[1];
+  };
+  router.Add("control/permitjoin", count);
+  router.Add("group/{dec}/out/{name}", count);
+  router.Add("group/{dec}/out/{name}/{name}", count);
+  router.Add("{hex}/{dec}/out/{name}", count);
+  router.Add("{hex}/{dec}/out/{name}/{name}", count);
+  router.Add("{hex}/{dec}/request/{name}/{name}", count);
+  router.Add("{hex}/{dec}/get/{name}/{name}", count);
+  std::string message;
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < message_count; i++) {
+    router.Route(topics[i % topics.size()], message);
+  }
+  std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+
+  BOOST_TEST(matched == regex_matched);
+  BOOST_TEST_MESSAGE("Command topic dispatch, std::regex: "
+                     << (message_count / regex_time.count()) << " msgs/s");
+  BOOST_TEST_MESSAGE("Command topic dispatch, topic trie: "
+                     << (message_count / time.count()) << " msgs/s");
+}
@@ -0,0 +1,83 @@
+#include <zcl/encoding.h>
+#include <zcl/zcl_endpoint.h>
+#include <znp/znp_raw_interface.h>
+#include <boost/test/unit_test.hpp>
+#include <vector>
+
+namespace {
+const znp::ShortAddress kDevice = 0x1234;
+const zcl::ZclClusterId kOnOff = (zcl::ZclClusterId)0x0006;
+const zcl::ZclCommandId kReadAttributes = (zcl::ZclCommandId)0x00;
+const zcl::ZclCommandId kReadAttributesResponse = (zcl::ZclCommandId)0x01;
+const zcl::ZclCommandId kReportAttributes = (zcl::ZclCommandId)0x0A;
+
+// Leaves answering to the test.
+class FakeZnp : public znp::ZnpRawInterface {
+ public:
+  void SendFrame(znp::ZnpCommandType cmdtype, znp::ZnpCommand command,
+                 const std::vector<uint8_t>& payload) override {}
+};
+
+znp::IncomingMsg MakeMessage(zcl::ZclCommandId command_id,
+                             uint8_t trans_seq_number) {
+  zcl::ZclFrame frame;
+  frame.frame_type = zcl::ZclFrameType::Global;
+  frame.direction = zcl::ZclDirection::ServerToClient;
+  frame.disable_default_response = true;
+  frame.reserved = 0;
+  frame.transaction_sequence_number = trans_seq_number;
+  frame.command_identifier = command_id;
+  znp::IncomingMsg message;
+  message.GroupId = 0;
+  message.ClusterId = (uint16_t)kOnOff;
+  message.SrcAddr = kDevice;
+  message.SrcEndpoint = 1;
+  message.DstEndpoint = 1;
+  message.WasBroadcast = 0;
+  message.LinkQuality = 100;
+  message.SecurityUse = 0;
+  message.TimeStamp = 0;
+  message.TransSeqNumber = 0;
+  message.Data = znp::Encode(frame);
+  return message;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(ZclEndpointResponseSharesSeqWithReport) {
+  boost::asio::io_service io_service;
+  auto raw = std::make_shared<FakeZnp>();
+  auto api = std::make_shared<znp::ZnpApi>(io_service, raw);
+  auto created = zcl::ZclEndpoint::Create(api, 1, 0x0104, 0x0005, 0,
+                                          znp::Latency::NoLatency, {}, {});
+  raw->on_frame_(znp::ZnpCommandType::SRSP, znp::AfCommand::REGISTER,
+                 znp::ByteSpan(std::vector<uint8_t>{0}));
+  BOOST_TEST_REQUIRE(!!created.get_try());
+  auto endpoint = *created.get_try();
+  std::vector<uint8_t> commands;
+  endpoint->on_command_.connect(
+      [&commands](znp::ShortAddress, uint8_t, uint8_t, zcl::ZclClusterId, bool,
+                  zcl::ZclDirection, zcl::ZclCommandId command_id,
+                  std::vector<uint8_t>) {
+        commands.push_back((uint8_t)command_id);
+      });
+
+  // First request of the endpoint, so it has sequence number 0.
+  auto response = endpoint->Request(0x00158D0001020304, kDevice, 1, kOnOff,
+                                    true, zcl::ZclDirection::ClientToServer,
+                                    kReadAttributes, {0x00, 0x00});
+  // The device happens to use the same number for a report of its own.
+  api->af_on_incoming_msg_(MakeMessage(kReportAttributes, 0));
+  BOOST_TEST(!response.get_try());
+  api->af_on_incoming_msg_(MakeMessage(kReadAttributesResponse, 0));
+  BOOST_TEST_REQUIRE(!!response.get_try());
+  BOOST_TEST((uint8_t)response.get_try()->command_id ==
+             (uint8_t)kReadAttributesResponse);
+
+  // Retransmissions of either are still recognized.
+  api->af_on_incoming_msg_(MakeMessage(kReportAttributes, 0));
+  api->af_on_incoming_msg_(MakeMessage(kReadAttributesResponse, 0));
+  std::vector<uint8_t> expected{(uint8_t)kReportAttributes,
+                                (uint8_t)kReadAttributesResponse};
+  BOOST_TEST(commands == expected, boost::test_tools::per_element());
+  BOOST_TEST(endpoint->GetDuplicateStatistics().suppressed == 2);
+}
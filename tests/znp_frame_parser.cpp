@@ -0,0 +1,180 @@
+#include <znp/znp_frame_parser.h>
+#include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <cstring>
+#include <memory>
+
+namespace {
+struct ParsedFrame {
+  znp::ZnpCommandType type;
+  znp::ZnpCommand command;
+  std::vector<uint8_t> payload;
+};
+
+std::vector<uint8_t> MakeFrame(znp::ZnpCommandType type,
+                               znp::ZnpCommand command,
+                               const std::vector<uint8_t>& payload) {
+  std::vector<uint8_t> frame{
+      0xFE, (uint8_t)payload.size(),
+      (uint8_t)((((unsigned int)type) << 4) |
+                (((unsigned int)command.Subsystem()) & 0xF)),
+      command.RawCommand()};
+  frame.insert(frame.end(), payload.begin(), payload.end());
+  uint8_t crc = 0;
+  for (std::size_t i = 1; i < frame.size(); i++) {
+    crc ^= frame[i];
+  }
+  frame.push_back(crc);
+  return frame;
+}
+
+std::vector<ParsedFrame> Feed(znp::ZnpFrameParser& parser,
+                              const std::vector<uint8_t>& data,
+                              std::size_t chunk_size) {
+  std::vector<ParsedFrame> frames;
+  std::size_t offset = 0;
+  while (offset < data.size()) {
+    auto buffer = parser.Prepare();
+    std::size_t size =
+        std::min({chunk_size, data.size() - offset,
+                  boost::asio::buffer_size(buffer)});
+    std::memcpy(boost::asio::buffer_cast<uint8_t*>(buffer),
+                data.data() + offset, size);
+    offset += size;
+    parser.Commit(size);
+    parser.Parse([&frames](znp::ZnpCommandType type, znp::ZnpCommand command,
+                           znp::ByteSpan payload) {
+      frames.push_back({type, command, payload.ToVector()});
+    });
+  }
+  return frames;
+}
+
+// Mimics the previous receive path: SOF, length and body are read
+// separately, with fresh allocations for every frame.
+std::size_t LegacyParse(const std::vector<uint8_t>& data, std::size_t& reads) {
+  std::size_t frames = 0;
+  std::size_t offset = 0;
+  while (offset < data.size()) {
+    auto marker = std::make_shared<uint8_t>(data[offset++]);
+    reads++;
+    if (*marker != 0xFE) {
+      continue;
+    }
+    *marker = data[offset++];
+    reads++;
+    auto frame =
+        std::make_shared<std::vector<uint8_t>>(2 + ((std::size_t)*marker) + 1);
+    std::memcpy(frame->data(), data.data() + offset, frame->size());
+    offset += frame->size();
+    reads++;
+    uint8_t crc = frame->size() - 3;
+    for (std::size_t i = 0; i < frame->size() - 1; i++) {
+      crc ^= (*frame)[i];
+    }
+    if (crc != (*frame)[frame->size() - 1]) {
+      continue;
+    }
+    std::vector<uint8_t> payload(frame->begin() + 2, frame->end() - 1);
+    frames++;
+  }
+  return frames;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(FrameParserSplitFrames) {
+  std::vector<uint8_t> stream;
+  std::vector<std::vector<uint8_t>> payloads{
+      {}, {0x01}, {0x00, 0x01, 0x02, 0x03}, std::vector<uint8_t>(255, 0xFE)};
+  for (const auto& payload : payloads) {
+    auto frame = MakeFrame(znp::ZnpCommandType::AREQ,
+                           znp::AfCommand::INCOMING_MSG, payload);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+  for (std::size_t chunk_size : {1, 2, 3, 7, 64, 1024}) {
+    znp::ZnpFrameParser parser;
+    auto frames = Feed(parser, stream, chunk_size);
+    BOOST_TEST_REQUIRE(frames.size() == payloads.size());
+    for (std::size_t i = 0; i < frames.size(); i++) {
+      BOOST_TEST((frames[i].type == znp::ZnpCommandType::AREQ));
+      BOOST_TEST((frames[i].command ==
+                  znp::ZnpCommand(znp::AfCommand::INCOMING_MSG)));
+      BOOST_TEST(frames[i].payload == payloads[i]);
+    }
+    BOOST_TEST(parser.BufferedBytes() == 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(FrameParserResync) {
+  auto good = MakeFrame(znp::ZnpCommandType::SRSP, znp::SysCommand::PING,
+                        {0x79, 0x01});
+  auto bad = good;
+  bad[4] ^= 0xFF;
+  std::vector<uint8_t> stream{0x00, 0x12, 0x34};
+  stream.insert(stream.end(), bad.begin(), bad.end());
+  stream.insert(stream.end(), good.begin(), good.end());
+  // A truncated frame, immediately followed by a valid one.
+  stream.insert(stream.end(), {0xFE, 0x03});
+  stream.insert(stream.end(), good.begin(), good.end());
+
+  znp::ZnpFrameParser parser;
+  auto frames = Feed(parser, stream, 1024);
+  BOOST_TEST(frames.size() == 2);
+  for (const auto& frame : frames) {
+    BOOST_TEST((frame.command == znp::ZnpCommand(znp::SysCommand::PING)));
+    BOOST_TEST(frame.payload == std::vector<uint8_t>({0x79, 0x01}));
+  }
+  BOOST_TEST(parser.CrcErrors() >= 1);
+  BOOST_TEST(parser.BufferedBytes() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(FrameParserBenchmark) {
+  const std::size_t frame_count = 200000;
+  // A typical attribute report
+  auto frame = MakeFrame(
+      znp::ZnpCommandType::AREQ, znp::AfCommand::INCOMING_MSG,
+      {0x00, 0x00, 0x06, 0x00, 0x12, 0x34, 0x01, 0x01, 0x00, 0x5A,
+       0x00, 0x11, 0x22, 0x33, 0x00, 0x07, 0x18, 0x01, 0x0A, 0x00,
+       0x00, 0x10, 0x01, 0x12, 0x34, 0x00});
+  std::vector<uint8_t> stream;
+  stream.reserve(frame.size() * frame_count);
+  for (std::size_t i = 0; i < frame_count; i++) {
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::size_t legacy_reads = 0;
+  std::size_t legacy_frames = LegacyParse(stream, legacy_reads);
+  std::chrono::duration<double> legacy_time =
+      std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  znp::ZnpFrameParser parser;
+  std::size_t frames = 0;
+  std::size_t reads = 0;
+  std::size_t offset = 0;
+  while (offset < stream.size()) {
+    auto buffer = parser.Prepare();
+    std::size_t size =
+        std::min(stream.size() - offset, boost::asio::buffer_size(buffer));
+    std::memcpy(boost::asio::buffer_cast<uint8_t*>(buffer),
+                stream.data() + offset, size);
+    offset += size;
+    reads++;
+    parser.Commit(size);
+    frames += parser.Parse(
+        [](znp::ZnpCommandType, znp::ZnpCommand, znp::ByteSpan) {});
+  }
+  std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+
+  BOOST_TEST(legacy_frames == frame_count);
+  BOOST_TEST(frames == frame_count);
+  BOOST_TEST_MESSAGE("Frame parsing, legacy: "
+                     << (legacy_frames / legacy_time.count()) << " frames/s, "
+                     << ((double)legacy_reads / legacy_frames)
+                     << " reads/frame");
+  BOOST_TEST_MESSAGE("Frame parsing, streaming: "
+                     << (frames / time.count()) << " frames/s, "
+                     << ((double)reads / frames) << " reads/frame");
+}